@@ -0,0 +1,647 @@
+#define _GNU_SOURCE     // fs.c uses sync_file_range
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// the bench is built together with the filesystem, so "alloc" can call the allocator
+// itself; the other modes work through the API of fs.h
+#include "fs.c"
+
+/************************** Defining Constants for bench *******************/
+
+#define BENCH_DISK "bench.bin"  // created by every mode, removed at its end
+
+#define ALLOC_BLOCKS 65536      // bitmap of "alloc": 64 MiB of 1K blocks
+#define ALLOC_OPS 2000          // single blocks taken at every fill
+#define ALLOC_RUN 16            // length of the runs taken at every fill
+#define ALLOC_RUN_OPS 200       // runs taken at every fill
+#define ALLOC_MAX_RUN 64        // longest file of the fill
+
+#define JOURNAL_DISK_BLOCKS 65536       // disk of "journal"
+#define JOURNAL_OPS 20000       // commands: create and write a file, every third one removes another
+#define JOURNAL_FILE_LEN 4096   // bytes of every file
+#define JOURNAL_SYNC 100        // commands between two fs_sync
+
+#define THREADS_DISK_BLOCKS 262144      // disk of "threads": 256 MiB, 65536 inodes
+#define THREADS_OPS 40000       // commands of every workload, shared by the threads
+#define THREADS_FILES 1000      // files looked up
+#define THREADS_APPEND_LEN 512  // bytes of every append
+
+#define IO_BLOCK_SIZE 4096      // disk of "io": 128 MiB of 4K blocks
+#define IO_DISK_BLOCKS 32768
+#define IO_FILE_BLOCKS 16384    // file read and written at random places
+#define IO_CACHE_KB 1024        // small cache, so reads go to the device
+#define IO_READS 20000          // reads of one block
+#define IO_WRITES 128           // blocks rewritten before every fs_sync, they fit in the cache
+#define IO_SYNCS 50
+
+/* every mode runs the same work on the variants it compares and shows a line for each
+of them; "journal", "io" and "threads" create their disk in BENCH_DISK with fs_mkfs. Times
+are measured with CLOCK_MONOTONIC around the searches or the calls of fs.h only */
+
+typedef struct {
+    char *name;
+    int (*run)(int, char **);
+    char *help;
+} bench_mode;
+
+// workloads of "threads": every command of "mixed" is a lookup, a create or an append
+enum { WORK_LOOKUP, WORK_CREATE, WORK_APPEND, WORK_MIXED, WORK_COUNT };
+char *work_names[WORK_COUNT] = {"cautare", "creare", "adaugare", "amestec"};
+int created_files;      // names of creates, unique on a disk
+
+typedef struct {
+    int id;
+    int ops;
+    int work;
+    pthread_barrier_t *start;
+    int err;                // first error of the thread, 0 if none
+} thread_work;
+
+/************************** functions *******************/
+
+int alloc_bench(int, char **);
+int journal_bench(int, char **);
+int journal_run(int, int, double *, double *, long *);
+int threads_bench(int, char **);
+int threads_setup(int);
+double threads_run(int, int);
+void *thread_worker(void *);
+int thread_command(int, int, int, char *, int);
+int io_bench(int, char **);
+int io_device(char *);
+int compare_double(const void *, const void *);
+void fill_map(unsigned char *, int);
+double old_take_blocks(unsigned char *, int, int);
+double new_take_blocks(unsigned char *, int, int);
+int old_find_bit_value(unsigned char *, int, int);
+int old_find_free_block(unsigned char *, int);
+int old_find_free_run(unsigned char *, int, int);
+void take_run(unsigned char *, int, int *, int);
+void bench_options(fs_options *, int);
+double now();
+
+bench_mode modes[] = {
+    {"alloc", alloc_bench, "alocarea blocurilor la 10%, 50% si 95% umplere, fata de scanarea veche"},
+    {"journal", journal_bench, "[comenzi] aceleasi comenzi cu jurnal si fara, cu fs_sync la fiecare 100"},
+    {"io", io_bench, "citiri si scrieri la intamplare prin dispozitivele sync, threads si uring"},
+    {"threads", threads_bench, "[N] cautari, creari si adaugari cu 1, 2, 4 ... N fire pe acelasi disc"},
+};
+
+
+/*****************************************************************/
+
+int main(int args, char *options[]) {
+    for (int i = 0; args > 1 && i < (int)(sizeof(modes) / sizeof(modes[0])); i++) {
+        if (!strcmp(options[1], modes[i].name)) {
+            int err = modes[i].run(args - 1, options + 1);
+            remove(BENCH_DISK);
+            return err;
+        }
+    }
+
+    printf("Folosire: %s <mod> [argumente]\n", options[0]);
+    for (int i = 0; i < (int)(sizeof(modes) / sizeof(modes[0])); i++) {
+        printf("  %-8s %s\n", modes[i].name, modes[i].help);
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// time of a single block and of a run of ALLOC_RUN blocks taken at 10%, 50% and 95% fill
+// of the same bitmap: by the scan of the first version (find_bit_value for every bit
+// from 0) and by alloc_run
+// return exit code of program
+int alloc_bench(int argc, char **argv) {
+    int fills[] = {10, 50, 95};
+    unsigned char *filled = malloc(ALLOC_BLOCKS / BYTE_LEN);
+    unsigned char *map = malloc(ALLOC_BLOCKS / BYTE_LEN);
+    if (!filled || !map) return 1;
+
+    printf("Alocarea pe un bitmap de %d blocuri, %d blocuri si %d secvente de %d la fiecare umplere:\n",
+           ALLOC_BLOCKS, ALLOC_OPS, ALLOC_RUN_OPS, ALLOC_RUN);
+    printf("%8s %14s %14s %8s %16s %16s %8s\n", "umplere", "bloc vechi", "bloc nou", "castig",
+           "secventa veche", "secventa noua", "castig");
+    for (int i = 0; i < (int)(sizeof(fills) / sizeof(fills[0])); i++) {
+        fill_map(filled, fills[i]);
+
+        // every search starts from the same filled bitmap
+        double times[4];
+        for (int t = 0; t < 4; t++) {
+            memcpy(map, filled, ALLOC_BLOCKS / BYTE_LEN);
+            int len = (t < 2) ? 1 : ALLOC_RUN;
+            int count = (t < 2) ? ALLOC_OPS : ALLOC_RUN_OPS;
+            times[t] = (t % 2 == 0) ? old_take_blocks(map, count, len) : new_take_blocks(map, count, len);
+        }
+        printf("%7d%% %11.3f us %11.3f us %7.1fx %13.3f us %13.3f us %7.1fx\n", fills[i],
+               times[0] * 1e6, times[1] * 1e6, (times[1] > 0) ? times[0] / times[1] : 0,
+               times[2] * 1e6, times[3] * 1e6, (times[3] > 0) ? times[2] / times[3] : 0);
+    }
+
+    free(filled);
+    free(map);
+    return 0;
+}
+
+
+/*****************************************************************/
+// the same commands, with fs_sync after every JOURNAL_SYNC of them, on a disk with
+// journal and on one without it: the price of the transactions is in the syncs
+// return exit code of program
+int journal_bench(int argc, char **argv) {
+    int ops = (argc > 1) ? atoi(argv[1]) : JOURNAL_OPS;
+    if (ops <= 0) ops = JOURNAL_OPS;
+
+    printf("%d comenzi (creare si scriere a %d octeti, stergere la fiecare a treia), fs_sync la fiecare %d:\n",
+           ops, JOURNAL_FILE_LEN, JOURNAL_SYNC);
+    printf("%8s %12s %16s %18s %18s\n", "jurnal", "comenzi/s", "total (ms)", "fs_sync (us)", "octeti/fs_sync");
+    for (int journal = 1; journal >= 0; journal--) {
+        double seconds, sync_seconds;
+        long bytes;
+        int syncs = journal_run(journal, ops, &seconds, &sync_seconds, &bytes);
+        if (syncs < 0) return 1;
+        printf("%8s %12.0f %16.1f %18.1f %18ld\n", journal ? "da" : "nu", ops / seconds, seconds * 1e3,
+               (syncs > 0) ? sync_seconds * 1e6 / syncs : 0, (syncs > 0) ? bytes / syncs : 0);
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// run "ops" commands of "journal" on a new disk with or without journal; "seconds" gets
+// the time of all commands, "sync_seconds" the part of fs_sync and "bytes" what the syncs wrote
+// return number of syncs, or -1 for an error
+int journal_run(int journal, int ops, double *seconds, double *sync_seconds, long *bytes) {
+    fs_options opts;
+    bench_options(&opts, JOURNAL_DISK_BLOCKS);
+    opts.journal = journal;
+    int err = fs_mkfs(BENCH_DISK, &opts);
+    if (err < 0) {
+        printf("Discul nu a putut fi creat: %s\n", fs_strerror(err));
+        return -1;
+    }
+
+    char *data = malloc(JOURNAL_FILE_LEN);
+    memset(data, 'j', JOURNAL_FILE_LEN);
+    int syncs = 0;
+    *sync_seconds = 0;
+    *bytes = 0;
+    double start = now();
+    for (int i = 0; i < ops && err >= 0; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/j%d", i);
+        int fd = fs_open(name, FS_O_WRONLY | FS_O_CREAT);
+        err = fd;
+        if (fd >= 0) {
+            err = fs_write(fd, data, JOURNAL_FILE_LEN);
+            fs_close(fd);
+        }
+        if (err >= 0 && i % 3 == 2) {
+            snprintf(name, sizeof(name), "/j%d", i - 2);
+            err = fs_unlink(name);
+        }
+        if (err >= 0 && (i + 1) % JOURNAL_SYNC == 0) {
+            double sync_start = now();
+            long written = fs_sync();
+            *sync_seconds += now() - sync_start;
+            if (written < 0) err = (int)written;
+            else *bytes += written;
+            syncs++;
+        }
+    }
+    *seconds = now() - start;
+
+    free(data);
+    fs_unmount();
+    if (err < 0) {
+        printf("Comanda esuata: %s\n", fs_strerror(err));
+        return -1;
+    }
+    return syncs;
+}
+
+
+/*****************************************************************/
+// every workload with 1, 2, 4 ... N threads (N is the number of processors, or the one
+// given), THREADS_OPS commands shared between them, on a new disk for every count
+// return exit code of program
+int threads_bench(int argc, char **argv) {
+    int most = (argc > 1) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (most < 1) most = 1;
+
+    printf("%d comenzi impartite intre fire, comenzi/s pentru fiecare lucru:\n", THREADS_OPS);
+    printf("%6s", "fire");
+    for (int w = 0; w < WORK_COUNT; w++) {
+        printf(" %12s", work_names[w]);
+    }
+    printf("\n");
+    for (int threads = 1; ; threads = (threads * 2 > most && threads < most) ? most : threads * 2) {
+        if (!threads_setup(threads)) return 1;
+        printf("%6d", threads);
+        for (int w = 0; w < WORK_COUNT; w++) {
+            double seconds = threads_run(threads, w);
+            if (seconds < 0) {
+                fs_unmount();
+                return 1;
+            }
+            printf(" %12.0f", THREADS_OPS / seconds);
+            fflush(stdout);
+        }
+        printf("\n");
+        fs_unmount();
+        if (threads >= most) break;
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// new disk for "threads" threads: THREADS_FILES files in /d to look up, and a directory
+// for the creates and the file for the appends of every thread
+// return 1 for success
+int threads_setup(int threads) {
+    fs_options opts;
+    bench_options(&opts, THREADS_DISK_BLOCKS);
+    int err = fs_mkfs(BENCH_DISK, &opts);
+    if (err >= 0) err = fs_mkdir("/d");
+    for (int i = 0; err >= 0 && i < THREADS_FILES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/d/f%d", i);
+        err = fs_open(name, FS_O_WRONLY | FS_O_CREAT);
+        if (err >= 0) err = fs_close(err);
+    }
+    for (int t = 0; err >= 0 && t < threads; t++) {
+        char name[32];
+        snprintf(name, sizeof(name), "/t%d", t);
+        err = fs_mkdir(name);
+        snprintf(name, sizeof(name), "/t%d/log", t);
+        if (err >= 0) err = fs_open(name, FS_O_WRONLY | FS_O_CREAT);
+        if (err >= 0) err = fs_close(err);
+    }
+    if (err >= 0) err = (int)fs_sync();
+    if (err < 0) {
+        printf("Discul nu a putut fi pregatit: %s\n", fs_strerror(err));
+        fs_unmount();
+        return 0;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// run workload "work" with "threads" threads, all started at once
+// return seconds from start until the last thread ends, or -1 for an error
+double threads_run(int threads, int work) {
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    thread_work *works = malloc(threads * sizeof(thread_work));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    for (int t = 0; t < threads; t++) {
+        works[t] = (thread_work){t, THREADS_OPS / threads + (t < THREADS_OPS % threads), work, &start, 0};
+        pthread_create(&ids[t], NULL, thread_worker, &works[t]);
+    }
+    pthread_barrier_wait(&start);
+    double begin = now();
+    int err = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        if (err == 0) err = works[t].err;
+    }
+    double seconds = now() - begin;
+
+    pthread_barrier_destroy(&start);
+    free(ids);
+    free(works);
+    if (err < 0) {
+        printf("Comanda esuata (%s): %s\n", work_names[work], fs_strerror(err));
+        return -1;
+    }
+    return seconds;
+}
+
+
+/*****************************************************************/
+// commands of one thread; the file of appends stays open for the whole workload
+void *thread_worker(void *arg) {
+    thread_work *w = arg;
+    char name[32];
+    char data[THREADS_APPEND_LEN];
+    memset(data, 'a', sizeof(data));
+    snprintf(name, sizeof(name), "/t%d/log", w->id);
+    int fd = fs_open(name, FS_O_WRONLY | FS_O_APPEND);
+    if (fd < 0) w->err = fd;
+
+    pthread_barrier_wait(w->start);
+    unsigned int seed = w->id + 1;
+    for (int i = 0; i < w->ops && w->err == 0; i++) {
+        int pick = rand_r(&seed);
+        int work = w->work;
+        if (work == WORK_MIXED) {
+            // 6 lookups, 2 creates and 2 appends in every 10 commands
+            work = (pick % 10 < 6) ? WORK_LOOKUP : (pick % 10 < 8) ? WORK_CREATE : WORK_APPEND;
+        }
+        int err = thread_command(w->id, work, fd, data, pick / 10);
+        if (err < 0) w->err = err;
+    }
+    if (fd >= 0) fs_close(fd);
+    return NULL;
+}
+
+
+/*****************************************************************/
+// one command "work" of thread "id": look up file "pick" of /d, create a new file in
+// the directory of the thread, or append to its file "fd"
+// return 0 or a negative error code
+int thread_command(int id, int work, int fd, char *data, int pick) {
+    char name[48];
+    if (work == WORK_LOOKUP) {
+        struct fs_stat st;
+        snprintf(name, sizeof(name), "/d/f%d", pick % THREADS_FILES);
+        return fs_stat(name, &st);
+    }
+    if (work == WORK_CREATE) {
+        snprintf(name, sizeof(name), "/t%d/c%d", id, __atomic_fetch_add(&created_files, 1, __ATOMIC_RELAXED));
+        int new_fd = fs_open(name, FS_O_WRONLY | FS_O_CREAT);
+        return (new_fd < 0) ? new_fd : fs_close(new_fd);
+    }
+    int written = fs_write(fd, data, THREADS_APPEND_LEN);
+    return (written < 0) ? written : 0;
+}
+
+
+/*****************************************************************/
+// the same reads and writes through every block device: reads of one block at random
+// places with a small cache, so every one goes to the device, and rewrites of random
+// blocks saved by fs_sync, which gives them to the device as one batch
+// return exit code of program
+int io_bench(int argc, char **argv) {
+    char *names[] = {"sync", "threads", "uring"};
+
+    printf("Disc de %d blocuri de %d octeti, cache de %d KiB:\n", IO_DISK_BLOCKS, IO_BLOCK_SIZE, IO_CACHE_KB);
+    printf("%-18s %14s %14s %14s %16s %14s\n", "dispozitiv", "citiri/s", "medie (us)", "p99 (us)",
+           "scrieri/s", "fs_sync (ms)");
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (!io_device(names[i])) return 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// run "io" through the device "name" and show its line; a device that can t start
+// is replaced by sync, which is shown next to its name
+// return 1 for success
+int io_device(char *name) {
+    fs_options opts;
+    bench_options(&opts, IO_DISK_BLOCKS);
+    opts.block_size = IO_BLOCK_SIZE;
+    opts.io = name;
+    int err = fs_mkfs(BENCH_DISK, &opts);
+
+    // the file is written once, then the disk is opened again with a cold cache
+    char *data = malloc((size_t)IO_FILE_BLOCKS * IO_BLOCK_SIZE);
+    memset(data, 'i', (size_t)IO_FILE_BLOCKS * IO_BLOCK_SIZE);
+    int fd = (err < 0) ? err : fs_open("/io", FS_O_WRONLY | FS_O_CREAT);
+    err = (fd < 0) ? fd : fs_write(fd, data, IO_FILE_BLOCKS * IO_BLOCK_SIZE);
+    if (fd >= 0) fs_close(fd);
+    if (err >= 0) {
+        fs_unmount();
+        opts.cache_kb = IO_CACHE_KB;
+        err = fs_mount(BENCH_DISK, &opts);
+    }
+    fd = (err < 0) ? err : fs_open("/io", FS_O_RDWR);
+    if (fd < 0) {
+        printf("Discul nu a putut fi pregatit: %s\n", fs_strerror(fd));
+        free(data);
+        fs_unmount();
+        return 0;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), strcmp(device->name, name) ? "%s (%s)" : "%s", name, device->name);
+
+    double *times = malloc(IO_READS * sizeof(double));
+    srand(IO_READS);
+    double start = now();
+    for (int i = 0; i < IO_READS && err >= 0; i++) {
+        double read_start = now();
+        err = fs_lseek(fd, (rand() % IO_FILE_BLOCKS) * IO_BLOCK_SIZE, SEEK_SET);
+        if (err >= 0) err = fs_read(fd, data, IO_BLOCK_SIZE);
+        times[i] = now() - read_start;
+    }
+    double read_seconds = now() - start;
+
+    double sync_seconds = 0;
+    start = now();
+    for (int sync = 0; sync < IO_SYNCS && err >= 0; sync++) {
+        for (int i = 0; i < IO_WRITES && err >= 0; i++) {
+            err = fs_lseek(fd, (rand() % IO_FILE_BLOCKS) * IO_BLOCK_SIZE, SEEK_SET);
+            if (err >= 0) err = fs_write(fd, data, IO_BLOCK_SIZE);
+        }
+        double sync_start = now();
+        if (err >= 0) err = (int)fs_sync();
+        sync_seconds += now() - sync_start;
+    }
+    double write_seconds = now() - start;
+
+    fs_close(fd);
+    fs_unmount();
+    free(data);
+    if (err < 0) {
+        printf("Comanda esuata (%s): %s\n", name, fs_strerror(err));
+        free(times);
+        return 0;
+    }
+    qsort(times, IO_READS, sizeof(double), compare_double);
+    printf("%-18s %14.0f %14.1f %14.1f %16.0f %14.1f\n", label, IO_READS / read_seconds,
+           read_seconds * 1e6 / IO_READS, times[IO_READS * 99 / 100] * 1e6, (double)IO_WRITES * IO_SYNCS / write_seconds,
+           sync_seconds * 1e3 / IO_SYNCS);
+    free(times);
+    return 1;
+}
+
+
+/*****************************************************************/
+// order of doubles for qsort
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*****************************************************************/
+// fill a bitmap of ALLOC_BLOCKS bits to "fill" percents with files of random lengths
+// (up to ALLOC_MAX_RUN blocks), remove every third one and fill it up again
+void fill_map(unsigned char *map, int fill) {
+    int *starts = malloc(ALLOC_BLOCKS * sizeof(int));
+    int *lens = malloc(ALLOC_BLOCKS * sizeof(int));
+    memset(map, 0, ALLOC_BLOCKS / BYTE_LEN);
+    if (!starts || !lens) return;
+
+    srand(fill);
+    int target = (int)((long long)ALLOC_BLOCKS * fill / 100);
+    int used = 0, files = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        while (used < target) {
+            int len = 1 + rand() % ALLOC_MAX_RUN;
+            if (len > target - used) len = target - used;
+            take_run(map, len, &starts[files], ALLOC_BLOCKS);
+            lens[files++] = len;
+            used += len;
+        }
+        for (int f = 0; pass == 0 && f < files; f += 3) {
+            for (int b = starts[f]; b < starts[f] + lens[f]; b++) {
+                map[b / BYTE_LEN] &= ~(1 << (b % BYTE_LEN));
+            }
+            used -= lens[f];
+        }
+    }
+
+    free(starts);
+    free(lens);
+}
+
+
+/*****************************************************************/
+// take "count" runs of "len" blocks from "map" with the scan of the first version
+// return seconds spent for every run taken
+double old_take_blocks(unsigned char *map, int count, int len) {
+    int taken = 0;
+    double start = now();
+    for (; taken < count; taken++) {
+        int nr = (len == 1) ? old_find_free_block(map, ALLOC_BLOCKS) : old_find_free_run(map, ALLOC_BLOCKS, len);
+        if (nr == -1) break;
+        for (int b = nr; b < nr + len; b++) {
+            map[b / BYTE_LEN] |= 1 << (b % BYTE_LEN);
+        }
+    }
+    double seconds = now() - start;
+    return taken ? seconds / taken : 0;
+}
+
+
+/*****************************************************************/
+// take "count" runs of "len" blocks from "map" with alloc_run, which searches the map
+// given to the block allocator as a disk of a single group; every search starts after
+// the last run taken, like a file that grows
+// return seconds spent for every run taken
+double new_take_blocks(unsigned char *map, int count, int len) {
+    int *regions = malloc(ALLOC_BLOCKS / REGION_BITS * sizeof(int));
+    if (!regions) return 0;
+    bitmap_allocator disk_alloc = block_alloc;
+    struct superblock disk_sb = sb;
+    group_desc *disk_groups = groups;
+    pthread_mutex_t *disk_locks = group_locks;
+
+    block_alloc = (bitmap_allocator){map, ALLOC_BLOCKS, 0, regions};
+    allocator_init(&block_alloc);
+    group_desc group = {0};
+    for (int r = 0; r < ALLOC_BLOCKS / REGION_BITS; r++) {
+        group.free_blocks += regions[r];
+    }
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    groups = &group;
+    group_locks = &lock;
+    sb.total_blocks = ALLOC_BLOCKS;
+    sb.blocks_per_group = ALLOC_BLOCKS;
+    sb.group_count = 1;
+    sb.free_blocks = group.free_blocks;
+
+    int taken = 0, goal = 0;
+    double start = now();
+    for (; taken < count; taken++) {
+        int nr = alloc_run(len, goal);
+        if (nr == -1) break;
+        goal = nr + len;
+    }
+    double seconds = now() - start;
+
+    block_alloc = disk_alloc;
+    sb = disk_sb;
+    groups = disk_groups;
+    group_locks = disk_locks;
+    free(regions);
+    return taken ? seconds / taken : 0;
+}
+
+
+/*****************************************************************/
+// find_bit_value of the first version
+int old_find_bit_value(unsigned char *arr, int pos, int size) {
+    // position should be valid
+    if (pos < 0 || pos >= size * BYTE_LEN) return -1;
+
+    int index = pos / BYTE_LEN;
+    int offset = pos % BYTE_LEN;
+    if ((arr[index] & (1 << offset)) == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// find_free_block of the first version, over a bitmap of "blocks" bits
+int old_find_free_block(unsigned char *map, int blocks) {
+    for (int i = 0; i < blocks; i++) {
+        if (old_find_bit_value(map, i, blocks / BYTE_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+// the scan of the first version looking for "len" free blocks in a row
+int old_find_free_run(unsigned char *map, int blocks, int len) {
+    for (int i = 0, free_len = 0; i < blocks; i++) {
+        free_len = (old_find_bit_value(map, i, blocks / BYTE_LEN) == 0) ? free_len + 1 : 0;
+        if (free_len == len) {
+            return i - len + 1;
+        }
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+// take "len" blocks for a file of the bitmap fill, in the first free ones like
+// the first version did; "start" gets the first of them
+void take_run(unsigned char *map, int len, int *start, int blocks) {
+    *start = -1;
+    for (int i = 0, taken = 0; i < blocks && taken < len; i++) {
+        if (map[i / BYTE_LEN] == 0xff) {
+            i += BYTE_LEN - 1;
+            continue;
+        }
+        if (!(map[i / BYTE_LEN] & (1 << (i % BYTE_LEN)))) {
+            map[i / BYTE_LEN] |= 1 << (i % BYTE_LEN);
+            if (*start == -1) *start = i;
+            taken++;
+        }
+    }
+}
+
+
+/*****************************************************************/
+// options of a bench disk of "blocks" 1K blocks, without background syncs
+void bench_options(fs_options *opts, int blocks) {
+    fs_default_options(opts);
+    opts->block_size = 1024;
+    opts->blocks = blocks;
+    opts->inodes = blocks / 4;
+    opts->flush_interval = 0;
+}
+
+
+/*****************************************************************/
+// seconds of the monotonic clock
+double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
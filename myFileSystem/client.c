@@ -0,0 +1,360 @@
+#define _GNU_SOURCE     // strndup
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "fs.h"
+#include "protocol.h"
+
+/************************** Defining Constants for client *******************/
+
+#define CHUNK 65536             // bytes read or received at once
+#define MAX_PENDING 4096        // commands sent before their answers
+
+/* the commands of "main" are read from stdin and sent to the server as soon as they
+are read, without waiting for the answers of the ones before; the answers come in
+the same order, so the output is the one of "main" */
+
+typedef struct {
+    char *data;
+    int len;
+    int size;
+} buffer;
+
+typedef struct {
+    int op;             // request_op, or -1 for a message shown without request
+    char *text;         // name used by the message of answer, or the message
+} pending;
+
+pending waiting[MAX_PENDING];   // commands without answer, in order
+unsigned first, last;           // first waiting, and after the last one
+int sock;
+uint32_t next_id;
+buffer to_send, received, input;
+
+/************************** functions *******************/
+
+int connect_server(const char *);
+int read_commands();
+void send_command(char **, int);
+void echo_command(char **, int);
+void send_request(int, const char *, const char *, int, const char *);
+void add_message(const char *);
+void show_answers();
+void show_answer(pending *, struct answer_header *, char *);
+int append(buffer *, const void *, int);
+void take_bytes(buffer *, int);
+int parse(char *, char **);
+const char *last_name(const char *);
+
+
+/*****************************************************************/
+
+int main(int args, char *options[]) {
+    const char *socket_path = (args > 1) ? options[1] : SERVER_SOCKET;
+    if (!connect_server(socket_path)) {
+        perror("Serverul nu raspunde");
+        return 1;
+    }
+
+    int input_done = 0;
+    while (!input_done || input.len > 0 || first != last || to_send.len > 0) {
+        if (input.len > 0) {
+            input_done |= read_commands();
+        }
+
+        // stdin is read only while there is room for the commands of a line
+        struct pollfd fds[2] = {{-1, POLLIN, 0}, {sock, POLLIN, 0}};
+        if (!input_done && last - first < MAX_PENDING / 2) fds[0].fd = 0;
+        if (to_send.len > 0) fds[1].events |= POLLOUT;
+
+        fflush(stdout);
+        if (poll(fds, 2, -1) == -1) continue;
+
+        if (fds[0].revents) {
+            char chunk[CHUNK];
+            int len = read(0, chunk, sizeof(chunk));
+            if (len > 0) {
+                append(&input, chunk, len);
+            } else {
+                // the last line may have no '\n'
+                append(&input, "\n", 1);
+                input_done = 1;
+            }
+        }
+        if (fds[1].revents & POLLOUT) {
+            int len = send(sock, to_send.data, to_send.len, MSG_NOSIGNAL);
+            if (len > 0) take_bytes(&to_send, len);
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            char chunk[CHUNK];
+            int len = recv(sock, chunk, sizeof(chunk), 0);
+            if (len <= 0) {
+                printf("Serverul a inchis conexiunea.\n");
+                return 1;
+            }
+            append(&received, chunk, len);
+            show_answers();
+        }
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// connect to the server listening at "socket_path"
+// return 1 for success
+int connect_server(const char *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return 0;
+    strcpy(addr.sun_path, socket_path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    return (sock != -1 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != -1);
+}
+
+
+/*****************************************************************/
+// send the commands of whole lines of input, while there is room for them
+// return 1 if "exit" ends the input
+int read_commands() {
+    char *end;
+    while (last - first < MAX_PENDING / 2 && input.len > 0 &&
+           (end = memchr(input.data, '\n', input.len)) != NULL) {
+        int len = end - input.data;
+        char *line = strndup(input.data, len);
+        char **argv = malloc((len / 2 + 2) * sizeof(char *));
+        take_bytes(&input, len + 1);
+        if (line == NULL || argv == NULL) {
+            free(line);
+            free(argv);
+            continue;
+        }
+
+        int argc = parse(line, argv);
+        int stop = (argc > 0 && !strcmp(argv[0], "exit"));
+        if (argc > 0 && !stop) {
+            send_command(argv, argc);
+        }
+        free(argv);
+        free(line);
+        if (stop) {
+            input.len = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// turn a command of "main" into requests
+void send_command(char **argv, int argc) {
+    if (!strcmp(argv[0], "mkdir")) {
+        for (int i = 1; i < argc; i++)
+            send_request(OP_MKDIR, argv[i], NULL, 0, last_name(argv[i]));
+    } else if (!strcmp(argv[0], "touch")) {
+        for (int i = 1; i < argc; i++)
+            send_request(OP_TOUCH, argv[i], NULL, 0, last_name(argv[i]));
+    } else if (!strcmp(argv[0], "ls")) {
+        if (argc > 2)
+            add_message("Argumente incorecte.\n");
+        else
+            send_request(OP_LS, argc == 2 ? argv[1] : "", NULL, 0, argc == 2 ? argv[1] : ".");
+    } else if (!strcmp(argv[0], "echo")) {
+        echo_command(argv, argc);
+    } else if (!strcmp(argv[0], "pwd") && argc == 1) {
+        send_request(OP_PWD, "", NULL, 0, "");
+    } else if (argc == 2 && (!strcmp(argv[0], "cd") || !strcmp(argv[0], "cat") ||
+                             !strcmp(argv[0], "rm") || !strcmp(argv[0], "rmdir"))) {
+        int op = !strcmp(argv[0], "cd") ? OP_CD : !strcmp(argv[0], "cat") ? OP_CAT :
+                 !strcmp(argv[0], "rm") ? OP_RM : OP_RMDIR;
+        send_request(op, argv[1], NULL, 0, last_name(argv[1]));
+    } else if (!strcmp(argv[0], "cd") || !strcmp(argv[0], "cat") || !strcmp(argv[0], "rm") ||
+               !strcmp(argv[0], "rmdir") || !strcmp(argv[0], "pwd")) {
+        add_message("Argumente incorecte.\n");
+    } else {
+        add_message("Comanda necunoscuta.\n");
+    }
+}
+
+
+/*****************************************************************/
+// the words before '>' or '>>' replace or are added to the file after it, each
+// followed by a space; without words, the file is only verified
+void echo_command(char **argv, int argc) {
+    int delete = 1;
+    int sign_position = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], ">")) {
+            delete = 1;
+            sign_position = i;
+        } else if (!strcmp(argv[i], ">>")) {
+            delete = 0;
+            sign_position = i;
+        }
+    }
+    if (argc != (sign_position + 2)) {
+        add_message("Argumente incorecte.\n");
+        return;
+    }
+
+    buffer content = {NULL, 0, 0};
+    for (int i = 1; i < sign_position; i++) {
+        append(&content, argv[i], strlen(argv[i]));
+        append(&content, " ", 1);
+    }
+    int op = (sign_position > 1 && delete) ? OP_WRITE : OP_APPEND;
+    send_request(op, argv[sign_position + 1], content.data, content.len, "");
+    free(content.data);
+}
+
+
+/*****************************************************************/
+// add a request to the bytes to send, and remember "text" for its answer
+void send_request(int op, const char *path, const char *data, int data_len, const char *text) {
+    struct request_header header = {next_id++, op, {0}, strlen(path), data_len};
+    append(&to_send, &header, sizeof(header));
+    append(&to_send, path, header.path_len);
+    append(&to_send, data, data_len);
+
+    waiting[last % MAX_PENDING] = (pending){op, strdup(text)};
+    last++;
+}
+
+
+/*****************************************************************/
+// show "message" after the answers of the commands before it
+void add_message(const char *message) {
+    waiting[last % MAX_PENDING] = (pending){-1, strdup(message)};
+    last++;
+    show_answers();
+}
+
+
+/*****************************************************************/
+// show the whole answers received, and the messages that wait for them
+void show_answers() {
+    while (first != last) {
+        pending *command = &waiting[first % MAX_PENDING];
+        if (command->op == -1) {
+            fputs(command->text ? command->text : "", stdout);
+        } else {
+            struct answer_header answer;
+            if (received.len < (int)sizeof(answer)) return;
+            memcpy(&answer, received.data, sizeof(answer));
+            int len = sizeof(answer) + answer.data_len;
+            if (received.len < len) return;
+
+            show_answer(command, &answer, received.data + sizeof(answer));
+            take_bytes(&received, len);
+        }
+        free(command->text);
+        first++;
+    }
+}
+
+
+/*****************************************************************/
+// show the answer of a command with the message of "main"
+void show_answer(pending *command, struct answer_header *answer, char *data) {
+    const char *name = command->text ? command->text : "";
+    if (answer->status < 0) {
+        if (command->op == OP_LS)
+            printf("Calea %s nu este corecta.\n", name);
+        else
+            printf("%s\n", fs_strerror(answer->status));
+        return;
+    }
+
+    switch (command->op) {
+    case OP_MKDIR:
+        printf("Directorul %s a fost creat cu succes.\n", name);
+        break;
+    case OP_TOUCH:
+        printf("Fisierul %s a fost creat cu succes.\n", name);
+        break;
+    case OP_WRITE:
+    case OP_APPEND:
+        printf("Continutul a fost adaugat.\n");
+        break;
+    case OP_CAT:
+        fwrite(data, 1, answer->data_len, stdout);
+        if (answer->data_len > 0) printf("\n");
+        break;
+    case OP_LS:
+        fwrite(data, 1, answer->data_len, stdout);
+        break;
+    case OP_RM:
+        printf("Fisierul %s a fost sters.\n", name);
+        break;
+    case OP_RMDIR:
+        printf("Directorul %s a fost sters.\n", name);
+        break;
+    case OP_PWD:
+        printf("-->%.*s\n", (int)answer->data_len, data);
+        break;
+    }
+}
+
+
+/*****************************************************************/
+// add "len" bytes to "buf"
+// return 1 for success
+int append(buffer *buf, const void *data, int len) {
+    if (buf->len + len > buf->size) {
+        int size = buf->size ? buf->size : CHUNK;
+        while (size < buf->len + len) {
+            size *= 2;
+        }
+        char *bigger = realloc(buf->data, size);
+        if (bigger == NULL) return 0;
+        buf->data = bigger;
+        buf->size = size;
+    }
+    if (len > 0) memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 1;
+}
+
+
+/*****************************************************************/
+// drop the first "len" bytes of "buf"
+void take_bytes(buffer *buf, int len) {
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+
+/*****************************************************************/
+// split "in" in words separated by spaces
+// return number of words
+int parse(char *in, char **argv) {
+    int count = 0;
+    char *save;
+    for (char *word = strtok_r(in, " ", &save); word; word = strtok_r(NULL, " ", &save)) {
+        argv[count++] = word;
+    }
+    return count;
+}
+
+
+/*****************************************************************/
+// the last name of a path, without the '/' after it
+const char *last_name(const char *path) {
+    static char name[FS_NAME_MAX + 2];
+    int len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    const char *start = path + len;
+    while (start > path && start[-1] != '/') {
+        start--;
+    }
+    if (start == path + len) start = path;      // only "/"
+    snprintf(name, sizeof(name), "%.*s", (int)(path + len - start), start);
+    return name;
+}
@@ -0,0 +1,6631 @@
+#define _GNU_SOURCE     // sync_file_range
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <time.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <endian.h>
+#include "fs.h"
+
+/************************** Defining Constants for file system *******************/
+
+#define DEFAULT_NR_BLOCKS 1024  // geometry of a disk created without mkfs options
+#define DEFAULT_BLOCK_SIZE 1024
+#define DEFAULT_INODES 256
+#define MIN_BLOCK_SIZE 1024     // header of a directory must fit in one block
+#define MAX_BLOCK_SIZE 65536
+#define MAX_DIRECT_BLOCKS 12    // blocks of file content kept directly in inode
+#define INDIRECT_LEVELS 3       // single, double and triple indirect blocks
+#define PTRS_PER_BLOCK (sb.block_size / (int)sizeof(int))
+#define MAX_FILE_BLOCKS (MAX_DIRECT_BLOCKS + (long long)PTRS_PER_BLOCK + \
+                         (long long)PTRS_PER_BLOCK * PTRS_PER_BLOCK + \
+                         (long long)PTRS_PER_BLOCK * PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+#define MAX_CONTENT_IN_FILE (MAX_FILE_BLOCKS * sb.block_size)
+#define BYTE_LEN 8
+#define WORD_LEN 64             // bits of bitmap examined at once
+#define REGION_BITS 256         // bits of bitmap summarised by one free counter, multiple of WORD_LEN
+#define MAX_FILE_NAME FS_NAME_MAX
+#define DIR_INDEX -1            // local_depth of an index block of a directory
+#define BLOCK_MAP_LEN (sb.total_blocks / BYTE_LEN)
+#define INODE_MAP_LEN (sb.inode_count / BYTE_LEN)
+#define ROOT_INODE_INDEX 2
+#define MAX_OPEN_FILES 256      // descriptors of fs_open
+#define DCACHE_SIZE 1024        // slots in dentry cache, should be a power of 2
+#define FEATURE_EXTENTS 1       // files are mapped by runs of blocks instead of block pointers
+#define EXTENTS_IN_INODE 4      // extents that fit in place of block pointers of inode
+#define EXTENT_MAX_DEPTH 4      // levels of nodes below the root of extents
+#define FLUSH_INTERVAL 5        // default seconds between two background syncs
+#define MIN_DATA_BLOCKS 16      // a disk must have room at least for root directory and a few files
+#define DEFAULT_CACHE_KB 65536  // memory for cached blocks of disk, 64 MiB
+#define MIN_CACHE_BLOCKS 16     // a command needs a few blocks at once
+#define RA_MIN_WINDOW 4         // blocks read ahead when a sequential read starts
+#define RA_MAX_WINDOW 128       // largest window of read-ahead
+#define RA_LOCKS 64             // locks of read-ahead state, shared by inodes with the same remainder
+#define WRITE_BEHIND_BATCH 32   // contiguous dirty data blocks written while a file grows
+#define SYNC_BATCH 64           // blocks written by one pwritev, not more than IOV_MAX
+#define IO_THREADS 4            // workers of the "threads" block device
+#define URING_ENTRIES 256       // requests in flight at once on the "uring" block device
+#define FEATURE_JOURNAL 2       // metadata is written to the journal before its place
+#define FEATURE_GROUPS 4        // disk is split in block groups described by a table after superblock
+#define FEATURE_INLINE_DATA 8   // content of a small file is kept in its inode, without blocks
+#define INLINE_DATA_LEN ((MAX_DIRECT_BLOCKS + INDIRECT_LEVELS) * (int)sizeof(int))    // room of block pointers
+#define FEATURE_CHECKSUMS 16    // every block has a CRC32C in a table of its group
+#define FEATURES_KNOWN (FEATURE_EXTENTS | FEATURE_JOURNAL | FEATURE_GROUPS | FEATURE_INLINE_DATA | \
+                        FEATURE_CHECKSUMS)
+#define CRC32C_POLY 0x82f63b78  // Castagnoli polynomial, bits reversed
+#define SCRUB_CHUNK 256         // blocks read at once by a thread of scrub
+#define MAX_SCRUB_THREADS 64    // also the most threads of fsck
+#define FSCK_CHUNK 1024         // inodes taken at once by a thread of fsck
+#define FSCK_MESSAGE_LEN 256     // longest description of a problem
+#define FSCK_CLAIM 0            // modes of fsck_walk: take the blocks of inode, the lowest inode wins
+#define FSCK_CHECK 1            // verify that the inode owns its blocks
+#define FSCK_CLAIM_FREE 2       // take only blocks of nobody
+#define FSCK_BAD_TYPE 1         // flags of an inode found by fsck
+#define FSCK_BAD_SIZE 2
+#define FSCK_SHARED 4           // a block of inode is used by another inode too
+#define FSCK_NAMED 8            // a directory entry gives its name
+#define FSCK_BAD_DIR 16         // directory can t be searched, it must be rebuilt
+#define FSCK_BAD_DOTS 32        // "." or ".." is wrong
+#define FSCK_BAD_COUNT 64       // header counts other entries than the buckets
+#define ENTRY_DANGLING 0        // kinds of entries found by fsck: points to no inode in use
+#define ENTRY_EXTRA 1           // another name of an inode that has one
+#define ENTRY_ADOPT 2           // the only name of an inode, in another directory than its parent
+#define ENTRY_REVIVE 3          // inode is free in bitmap, but it says it lives in this directory
+#define ENTRY_LOST 4            // inode that can t be reached from root, "dir" is -1 or ends a cycle
+#define FS_MAGIC 0x5346594d     // "MYFS", first bytes of a disk of version 2 or later
+#define FS_VERSION 2            // format of superblock and inodes written by this build
+#define V1_SUPERBLOCK_LEN (16 * (int)sizeof(int))     // fields of version 1, up to gdt_start
+#define DISK_INODE_SIZE ((int)sizeof(disk_inode))
+#define INODES_PER_BLOCK (sb.block_size / DISK_INODE_SIZE)     // an inode never crosses two blocks
+#define INODE_BLOCKS_MASK 0xffffff      // crtBLocks is less than 2^31 / MIN_BLOCK_SIZE
+#define JOURNAL_BLOCKS 64       // least blocks reserved for journal after the descriptors
+#define JOURNAL_RATIO 256       // and one more for every JOURNAL_RATIO blocks of disk, up to a header
+#define WRITE_PIECE_META 10     // metadata blocks dirtied by a piece of fs_write, besides pointers
+#define JOURNAL_MAGIC 0x4a524e4c        // "JRNL", first block of a transaction
+#define COMMIT_MAGIC 0x434d4954         // "CMIT", last block of a transaction
+#define NO_LOCK -1              // modes of lock_inode
+#define READ_LOCK 0
+#define WRITE_LOCK 1
+
+/* every structure below is sized from the superblock when the disk is mounted;
+total_blocks and inode_count are multiples of 8, block_size a power of 2 */
+struct superblock {
+    int total_blocks;
+    int block_size;
+    int inode_count;
+    int free_blocks;    // number of the blocks that are free of writing
+    int free_nodes;     // number of the nodes that are free of writing
+
+    int inode_bitmap_start;     // position for starting reading from disk
+    int block_bitmap_start;
+    int inode_table_start;
+    int data_blocks_start;
+
+    int features;               // FEATURE_* flags chosen when disk was created
+    int journal_start;
+    int journal_blocks;
+
+    int blocks_per_group;       // multiple of 8, at most the bits of one block
+    int inodes_per_group;       // multiple of 8
+    int group_count;
+    int gdt_start;              // first block of group descriptor table
+    int inode_table_blocks;     // blocks of inode table of every group
+    int checksum_blocks;        // blocks of checksum table of every group, 0 without FEATURE_CHECKSUMS
+} sb;
+
+/* superblock as it is written at the start of block 0: fields of fixed width, in
+little-endian order, after a magic number and the version of format. Disks of version 1
+kept "struct superblock" and "struct inode" just like in memory, without magic; they are
+converted when mounted */
+typedef struct {
+    uint32_t magic;             // FS_MAGIC
+    uint16_t version;           // FS_VERSION
+    uint8_t block_bits;         // block_size is 1 << block_bits
+    uint8_t inode_size;         // DISK_INODE_SIZE
+    uint32_t features;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+    uint32_t free_blocks;
+    uint32_t free_nodes;
+    uint32_t blocks_per_group;
+    uint32_t inodes_per_group;
+    uint32_t group_count;
+    uint32_t gdt_start;
+    uint32_t journal_start;
+    uint16_t journal_blocks;
+    uint32_t inode_bitmap_start;
+    uint32_t block_bitmap_start;
+    uint32_t inode_table_start;
+    uint32_t inode_table_blocks;
+    uint32_t data_blocks_start;
+    uint32_t checksum_blocks;
+    uint32_t checksum;          // CRC32C of the fields before it, with FEATURE_CHECKSUMS
+} __attribute__((packed)) disk_superblock;
+
+int disk_version;       // format found on the mounted disk, FS_VERSION after it s converted
+int disk_converted;     // 1 if the last mount wrote an older disk in the format of this build
+
+/* like ext2, the disk is split in groups of blocks_per_group blocks; every group has
+its block bitmap, inode bitmap and a slice of inode table at its start. Group 0 keeps
+superblock, group descriptors and journal in front of them. In memory, bitmaps and
+inode table of all groups are kept one after the other */
+typedef struct {
+    int block_bitmap;       // block with bitmap of blocks of group
+    int inode_bitmap;       // first block of bitmap of inodes of group
+    int inode_table;        // first block of inodes of group
+    int free_blocks;
+    int free_inodes;
+} group_desc;
+
+group_desc *groups;     // sb.group_count descriptors
+pthread_mutex_t *group_locks;   // one for every group, taken to change its bitmaps and free counters
+
+int mkfs_features = FEATURE_JOURNAL;      // features of a disk created by this run
+int mkfs_block_size = DEFAULT_BLOCK_SIZE;
+int mkfs_blocks = DEFAULT_NR_BLOCKS;
+int mkfs_inodes = DEFAULT_INODES;
+int mkfs_group_blocks;          // 0 for the bits of one block, like ext2
+
+struct bitmap{
+    unsigned char *block_map;       // BLOCK_MAP_LEN bytes
+    unsigned char *inode_map;       // INODE_MAP_LEN bytes
+} bm;
+
+typedef struct {
+    unsigned char *map;
+    int nr_bits;
+    int cursor;             // next-fit: bit where the last search ended
+    int *region_free;       // free bits in every region of REGION_BITS
+} bitmap_allocator;     // finds zero bits of a bitmap a word at a time
+
+bitmap_allocator block_alloc;
+bitmap_allocator inode_alloc;
+
+typedef struct {
+    int logical;    // first logical block of file mapped by extent
+    int start;      // first block on disk
+    int length;     // number of contiguous blocks
+} extent;
+
+typedef struct {
+    int count;
+    int depth;      // 0 if entries are extents, else levels of nodes below root
+    int unused;
+    extent entries[EXTENTS_IN_INODE];
+} extent_root;      // takes the place of block pointers of inode
+
+/* a node of the tree of extents is a block: a leaf keeps extents, the nodes above
+leaves keep an entry {first logical block, block of node below, 0} for every node below.
+Extents are only added and removed at the end of file, so only the last node of every
+level changes; when the root is full, its entries move to a new node and the tree
+gets one level deeper */
+typedef struct {
+    int count;
+    extent entries[];
+} extent_leaf;
+
+#define EXTENTS_PER_LEAF ((sb.block_size - (int)sizeof(extent_leaf)) / (int)sizeof(extent))
+
+struct inode {
+    int file_size;                         // content size of memorised file
+    int file_type;                         // 0 for file, 1 for directory
+    union {
+        struct {
+            int direct_blocks[MAX_DIRECT_BLOCKS];  // first blocks of content, 0 if not allocated
+            int indirect_blocks[INDIRECT_LEVELS];  // blocks of pointers: to data, to pointers, to pointers of pointers
+        };
+        extent_root extents;               // used instead of block pointers with FEATURE_EXTENTS
+        unsigned char inline_data[INLINE_DATA_LEN];    // content of a file without blocks, with FEATURE_INLINE_DATA
+    };
+    int crtBLocks;
+    int parent_inode_index;                // the inode of directory where s located current file/directory
+} *inodes;         // inode table, sb.inode_count entries
+
+/* an inode in inode table, little-endian like the superblock. The records are packed
+one after the other and fill INODES_PER_BLOCK of them in every block */
+typedef struct {
+    uint32_t file_size;
+    uint32_t parent_inode;
+    uint32_t blocks_type;               // crtBLocks in the low 24 bits, file_type in the high 8
+    uint8_t data[INLINE_DATA_LEN];      // block pointers or extents as 32 bit words, or inline content
+} __attribute__((packed)) disk_inode;
+
+/* every inode has a reader/writer lock: reads of a file or lookups in a directory
+share it, changes take it alone. Locks are taken in this order: descriptor, directory,
+inode from it (a parent before its child, never two unrelated inodes), then the locks
+of groups, dentry cache, block cache and device, that are held only for a moment.
+A path is walked without locks through dentry cache, only a missing name is looked up
+under the lock of its directory */
+pthread_rwlock_t *inode_locks;
+
+typedef struct {
+    int base;       // logical block mapped by the first pointer of leaf
+    int leaf;       // last used block of pointers to data blocks, 0 if none
+} __attribute__((aligned(8))) leaf_hint;       // read and written at once, readers of a file share it
+
+struct bmap_cache {
+    leaf_hint hint;
+    int goal;       // block after the last one allocated for inode, where the next search starts
+    int behind;     // logical block where the next run written behind a growing file starts
+} *bmap_cache;       // one for every inode, saves the walk of indirect blocks for sequential access
+
+long bmap_hits, bmap_misses;
+
+// reverse index of names: the name of every inode in its directory, which with
+// parent_inode_index gives the path of inode without reading directories. It s set
+// when the name is created, or found once for inodes of an older mount ("" until then)
+char (*inode_names)[MAX_FILE_NAME + 1];
+
+typedef struct {
+    int inode_index;
+    char filename[MAX_FILE_NAME + 1];
+} directory_entry;      // an instance that represents a file/directory in current directory
+
+/* a directory is an extendible hash table: block 0 keeps the header, every other block
+is a bucket. The last bits of the name hash choose the bucket (dir_top_bits at most, as many
+as the table of header can index); a full bucket is split in two. A full bucket that uses
+all bits of header gets an index block in its slot, whose table chooses among buckets by the
+next dir_index_bits bits and grows the same way.
+Only when all bits are used, a bucket gets an overflow bucket */
+typedef struct {
+    int count;                      // current number of files/directories
+    int global_depth;               // bits of hash used to index the table
+    int table[];                    // logical block of the bucket for every hash suffix
+} directory_header;
+
+typedef struct {
+    int local_depth;                // DIR_INDEX
+    int count;                      // always 0, so walks of entries take it for an empty bucket
+    int depth;                      // bits of hash after the ones of header used by the table
+    int table[];                    // logical block of the bucket for every suffix of these bits
+} directory_index;
+
+typedef struct {
+    int local_depth;                // bits of hash shared by all entries of bucket
+    int count;
+    int overflow;                   // logical block of next bucket of chain, 0 if none
+    directory_entry entries[];
+} directory_bucket;
+
+#define DIR_BUCKET_ENTRIES ((sb.block_size - sizeof(directory_bucket)) / sizeof(directory_entry))
+
+int dir_top_bits;       // hash bits indexed by the table of a directory header
+int dir_index_bits;     // and by the table of an index block
+
+typedef struct {
+    int inode_index;
+    int pos;        // next byte of file
+    int end;        // first byte after the range
+    int held;       // block of the last piece, kept in cache until the next one; -1 if none
+    int error;      // 1 if a block of the range has a wrong checksum
+} data_iter;        // walks a range of a file as pointers into disk blocks, without copying
+
+typedef struct {
+    int inode_index;
+    int block;      // logical block of the current bucket
+    int slot;       // next entry from bucket
+} dir_iter;         // walks all entries of a directory, bucket by bucket
+
+unsigned char *disk_buffer;     // with --mmap it points into the disk file, else blocks are cached
+int use_mmap;       // 1 if disk file is mapped instead of read
+void (*fatal_handler)(int);     // told about an error that no call can return, before exit
+int disk_fd = -1;   // disk file opened for writing blocks back
+
+unsigned char *dirty_map;       // blocks modified since the last sync
+bitmap_allocator dirty_blocks;
+
+struct sync_stats {
+    long syncs;
+    long last_bytes;        // written by the last sync
+    long total_bytes;
+} sync_stats;
+
+/* ordered journal, like ext3: at every sync, dirty data blocks are written in place,
+then all dirty metadata blocks (bitmaps, inodes, directories, pointers) are written to the
+journal as one transaction: a header with their places, their copies and a commit block.
+Only after that, metadata is written in place, so a crash leaves the old or the new state */
+typedef struct {
+    int magic;          // JOURNAL_MAGIC
+    int sequence;
+    int count;          // blocks copied after header
+    int blocks[];       // place of every copied block
+} journal_header;
+
+typedef struct {
+    int magic;          // COMMIT_MAGIC
+    int sequence;
+    unsigned int checksum;      // of header and copies, a torn transaction is ignored
+} journal_commit_block;
+
+unsigned char *meta_map;        // dirty blocks that go through journal
+bitmap_allocator meta_blocks;
+unsigned char *freed_map;       // blocks given back since the last commit, still marked in bitmap
+bitmap_allocator freed_blocks;
+
+struct journal_state {
+    int sequence;               // of the next transaction
+    int checkpoint_pending;     // metadata of last transaction was written in place, but not flushed
+    int data_pending;           // data was written behind, but not flushed
+    long commits;
+    long flushes;               // fdatasync calls
+    long bytes;                 // written to journal
+    long overflows;             // syncs with more metadata than journal, written in place
+} journal;
+
+/* without --mmap, only blocks in use stay in memory, at most "budget" of them.
+A block is read with pread the first time it s needed and stays while it s pinned;
+the others are replaced by CLOCK: the hand gives a second chance to referenced blocks.
+A dirty victim is written back first, except metadata that waits for journal */
+typedef struct {
+    int block;          // -1 for an empty slot
+    int pins;           // users that keep a pointer into data
+    int referenced;     // used since the hand passed
+    int prefetched;     // read ahead and not used yet
+    int loading;        // being read from disk, users wait for "loaded"
+    unsigned char *data;
+} cache_slot;
+
+struct block_cache {
+    pthread_mutex_t lock;       // taken for every change of slots, not while a block is read
+    pthread_cond_t loaded;      // a block finished loading
+    cache_slot *slots;
+    int count;          // slots in use, more than budget only if all were pinned
+    int budget;
+    int hand;
+    unsigned char *arena;       // data of the first "budget" slots, registered with io_uring
+    int *slot_of;       // slot of every block of disk, -1 if not cached
+    long hits;
+    long misses;
+    long evictions;
+    long writebacks;
+} bcache = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+struct held_blocks {
+    int *blocks;        // pinned by disk_block until the end of the call
+    int count;
+    int len;
+};
+__thread struct held_blocks held;      // every thread has its own
+pthread_key_t held_key;         // frees the list of a thread when it ends
+pthread_once_t held_once = PTHREAD_ONCE_INIT;
+
+int cache_kb = DEFAULT_CACHE_KB;
+
+/* blocks go between cache and disk file through a block device: a batch of requests
+is given at once and returns when all of them are done, so a device may keep them in
+flight together. "sync" runs them one by one with preadv/pwritev, "threads" shares
+them between a pool of workers and "uring" submits them to an io_uring ring, block by
+block, reading and writing straight from the cache buffers registered with the kernel */
+typedef struct {
+    int write;              // 1 to write the buffers, 0 to read them
+    int first;              // first block
+    int count;              // blocks, at most SYNC_BATCH
+    unsigned char **data;   // buffer of every block
+    long done;              // bytes transferred from the start of request
+} io_request;
+
+typedef struct {
+    char *name;
+    int (*open)();                      // return 1 for success
+    void (*run)(io_request *, int);     // return when every request is done
+    void (*close)();                    // stop what open started, at unmount
+} block_device;
+
+block_device *device;
+char *device_name = "sync";     // chosen with --io
+
+struct io_stats {
+    long batches;
+    long requests;
+    long blocks;
+    long nanos;                 // spent waiting for batches
+} io_stats;
+
+struct io_pool {
+    pthread_mutex_t batch;      // one batch at a time is shared between workers
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a batch was given
+    pthread_cond_t finished;    // the last request of batch is done
+    io_request *reqs;
+    int count;
+    int next;                   // first request not taken by a worker
+    int pending;                // requests not done yet
+    pthread_t workers[IO_THREADS];
+    int started;
+    int stop;                   // 1 when workers must end, at unmount
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           PTHREAD_COND_INITIALIZER};
+
+struct io_ring {
+    pthread_mutex_t lock;       // one batch at a time uses the ring
+    int fd;
+    unsigned *sq_head;          // rings shared with the kernel
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe *cqes;
+    int registered;             // 1 if cache arena is registered as buffer 0
+    void *maps[3];              // mappings of submission ring, completion ring and entries
+    size_t map_lens[3];
+} ring = {PTHREAD_MUTEX_INITIALIZER};
+
+/* read-ahead follows every inode: while its blocks are read in order, the next window
+is read in cache with a few large reads, and the one after it is announced to the kernel
+to be read in background. Windows double up to max_window, which shrinks by half when
+blocks read ahead are replaced unused and grows back while they are used */
+typedef struct {
+    int next;       // logical block expected if access is sequential
+    int window;     // blocks of the last window
+    int end;        // first logical block not read ahead yet
+} readahead_state;
+
+readahead_state *ra_state;      // one for every inode
+pthread_mutex_t ra_locks[RA_LOCKS];     // readers of the same file share its state
+
+struct ahead_stats {
+    int max_window;
+    long read;          // blocks read ahead
+    long used;
+    long wasted;        // replaced before being used
+    long batches;       // runs of dirty data written behind a growing file
+    long written;
+} ahead = {RA_MAX_WINDOW / 4};
+
+int flush_interval = FLUSH_INTERVAL;    // seconds between background syncs, 0 to disable
+
+/* with FEATURE_CHECKSUMS, every block except superblock, journal and the checksum tables
+has a CRC32C in the table of its group, kept after its inode table. The checksum is
+computed when a block is written to its place, and verified when it s read from disk */
+uint32_t *checksums;            // one for every block, little-endian like on disk
+unsigned char *bad_map;         // blocks read from disk with a wrong checksum
+int checksums_ready;            // blocks read from now on are verified
+
+struct checksum_stats {
+    long verified;
+    long errors;        // every read of a bad block
+    long bad_blocks;    // different blocks found bad
+    int first_bad;      // first block found bad, -1 if none
+} csum_stats;
+
+uint32_t crc_table[8][256];     // slicing by 8 bytes, for processors without the crc32 instruction
+uint32_t (*crc32c_update)(uint32_t, const unsigned char *, size_t);
+
+typedef struct {
+    int next_chunk;             // taken by threads with an atomic add
+    int chunks;
+    long blocks;
+    long errors;
+    int first_error;
+    pthread_mutex_t lock;       // for the totals
+} scrub_state;
+
+/* fsck rebuilds what bitmaps and directories should be, from inodes and entries:
+a pass over inodes takes the blocks of every one, then a pass over directories counts
+the names of every inode. Both are shared by threads a chunk of inodes at a time */
+typedef struct {
+    int dir;
+    int inode;
+    int kind;                   // ENTRY_*
+    char name[MAX_FILE_NAME + 1];
+} fsck_entry;
+
+typedef struct {
+    int next_chunk;             // taken by threads with an atomic add
+    int chunks;
+    int *owner;                 // lowest inode that uses every block, -1 if none
+    int *cut;                   // first logical block of every inode with a wrong mapping, -1 if none
+    int *parent;                // directory of every inode after the names found
+    unsigned char *flags;       // FSCK_* of every inode
+    fsck_entry *entries;        // entries to be repaired
+    int entry_count;
+    int entry_len;
+    long inodes;
+    long directories;
+    long blocks;
+    long errors;
+    int threads;                // that ran the passes
+    int quiet;                  // 1 while problems are only counted
+    int pass;                   // 0 before the repair, 1 after it
+    void (*found)(int, const char *);   // told about the problems, from fs_fsck
+    pthread_mutex_t lock;       // for the entries and the calls of "found"
+} fsck_state;
+
+typedef struct {
+    fsck_state *state;
+    int inode_index;
+    int mode;                   // FSCK_CLAIM, FSCK_CHECK or FSCK_CLAIM_FREE
+    int blocks;                 // logical blocks of inode
+    int cut;                    // first wrong logical block, -1 if none
+    long used;                  // blocks taken
+} fsck_walk;
+
+// calls of the API share it; sync, mount and unmount take it alone. Waiting writers
+// go first, so a sync isn t delayed forever by a stream of calls
+pthread_rwlock_t fs_rwlock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+
+/* a slot is changed under the lock of cache, but read without locks like a seqlock:
+"seq" is odd while a writer changes the slot, and a reader that saw it change tries again */
+typedef struct {
+    unsigned seq;
+    int valid;
+    int parent_inode;
+    int inode_index;
+    char name[MAX_FILE_NAME + 1];
+} dentry;       // remembers that "name" from directory "parent_inode" is "inode_index"
+
+struct dentry_cache {
+    pthread_mutex_t lock;       // taken by writers
+    dentry slots[DCACHE_SIZE];
+    long hits;
+    long misses;
+} dcache = {PTHREAD_MUTEX_INITIALIZER};
+
+int crtInode;          // current directory, start of relative paths
+__thread int thread_cwd = -1;   // current directory of one thread set by fs_fchdir, -1 for crtInode
+const char *disk_name;  // disk file given to fs_mount
+int mounted;
+
+/* a descriptor keeps its inode and its own offset; a directory opened for
+fs_readdir keeps where the walk of its entries arrived */
+typedef struct {
+    pthread_mutex_t lock;       // held by a call that uses the descriptor
+    int inode_index;    // -1 for a free descriptor
+    int flags;          // FS_O_* given to fs_open
+    int offset;
+    dir_iter dir;
+} open_file;
+
+open_file files[MAX_OPEN_FILES];
+pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;    // taken to give or free a descriptor
+int *open_count;        // descriptors of every inode, an open inode can t be removed
+
+struct flusher_state {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // unmount stops the thread
+    int running;
+    int stop;
+} flush = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+/************************** functions *******************/
+
+int create_file(int, const char *);
+int create_dir(int, const char *);
+int remove_dir(int, const char *);
+int remove_file(int, const char *);
+int lookup_error(const char *);
+void set_options(const fs_options *);
+open_file *fd_get(int);
+void fd_put(open_file *);
+int open_inode(int, int);
+int write_file(open_file *, const void *, int);
+int fs_lock(int);
+int fs_unlock(int);
+int lock_path(const char *, int, int, int *, char **);
+void lock_inode(int, int);
+void unlock_inode(int);
+int inode_in_use(int);
+int inode_type(int);
+
+int file_is_empty(const char*);
+int superblock_init();
+int check_geometry(int, int, int);
+int load_superblock(const unsigned char *);
+int check_superblock();
+void pack_superblock(disk_superblock *);
+void load_inode_table(int);
+void store_inode_table(int);
+void pack_inode(int, disk_inode *);
+void unpack_inode(int, const disk_inode *);
+int layout_superblock(int, int, int, int, int);
+int geometry_init();
+void close_disk();
+void groups_init(int);
+void single_group();
+void groups_count_free();
+int group_end(int);
+int group_data_start(int);
+int group_meta_blocks();
+unsigned char *disk_block(int);
+unsigned char *get_block(int);
+unsigned char *get_zero_block(int);
+unsigned char *cache_get(int, int);
+void put_block(int);
+void put_held_blocks();
+void held_key_init();
+void free_held_blocks();
+void fatal_error(int) __attribute__((noreturn));
+int cache_init();
+int cache_victim(int);
+void cache_shrink();
+void cache_prefetch(int *, int *, int);
+void read_ahead(int, int);
+void write_behind(int, int);
+int cache_evict(int);
+void load_blocks(int, void *, int);
+int map_disk();
+void mark_dirty(int);
+void mark_meta_dirty(int);
+int count_set_bits(bitmap_allocator *);
+int write_blocks(int, int);
+int write_vector(int, unsigned char **, int);
+int write_runs(int *, int *, int);
+int device_init();
+int device_run(io_request *, int);
+int add_requests(io_request *, int, int, int, unsigned char **, int);
+void request_run(io_request *);
+int sync_open();
+void sync_run(io_request *, int);
+void sync_close();
+int pool_open();
+void pool_run(io_request *, int);
+void *pool_worker(void *);
+void pool_close();
+int uring_open();
+void uring_close();
+void uring_run(io_request *, int);
+void uring_batch(io_request *, int);
+long write_dirty(int);
+void clear_dirty(int, int);
+long journal_commit(int);
+int journal_full();
+int write_piece();
+void journal_replay();
+unsigned int journal_checksum(unsigned int, unsigned char *);
+void crc32c_init();
+uint32_t crc32c_table(uint32_t, const unsigned char *, size_t);
+uint32_t crc32c_sse42(uint32_t, const unsigned char *, size_t);
+uint32_t crc32c(const void *, size_t);
+int has_checksum(int);
+void checksum_block(int, const unsigned char *);
+void verify_block(int, const unsigned char *);
+int block_is_bad(int);
+void load_checksums();
+void store_checksums();
+void *scrub_worker(void *);
+int run_threads(int, void *(*)(void *), void *);
+void fsck_check(fsck_state *, int);
+void fsck_report(fsck_state *, const char *, ...);
+void fsck_add_entry(fsck_state *, int, int, int, const char *);
+void *fsck_inode_worker(void *);
+void *fsck_dir_worker(void *);
+void fsck_inode(fsck_state *, int, long *);
+int fsck_walk_inode(fsck_state *, int, int, long *);
+void fsck_walk_pointer(fsck_walk *, int, long long);
+void fsck_walk_tree(fsck_walk *, int, int, long long);
+int fsck_walk_extent(fsck_walk *, extent *, long long *);
+int fsck_walk_node(fsck_walk *, extent *, int, int, long long *);
+void fsck_bad(fsck_walk *, long long);
+int fsck_use(fsck_walk *, int);
+int block_is_meta(int);
+void fsck_dir(fsck_state *, int);
+int fsck_dir_chains(int, int, int *);
+int fsck_dir_chain(int, int, int, int, int *);
+int fsck_dir_head(int, directory_header *, unsigned int);
+void fsck_dir_entry(fsck_state *, int, directory_entry *);
+int fsck_bucket_count(directory_bucket *, int, directory_header *, int);
+int valid_name(const char *);
+void fsck_graph(fsck_state *);
+int compare_fsck_entry(const void *, const void *);
+void fsck_maps(fsck_state *);
+void fsck_repair(fsck_state *, int);
+void fsck_detach(fsck_state *, int, int);
+void fsck_detach_tree(fsck_state *, int, int *, int, long long, int);
+int fsck_detach_node(extent *, int, int, long long *, int);
+void fsck_fix_size(fsck_state *, int);
+void fsck_revive(fsck_state *, int);
+void fsck_rebuild_dir(fsck_state *, int);
+void fsck_fix_dots(int, int);
+void fsck_fix_count(int);
+void fsck_reconnect(fsck_state *, fsck_entry *);
+void fsck_set_map(fsck_state *, int);
+void fsck_count_free();
+void dirty_inode_block(int, int);
+void dirty_last_leaf(int);
+void store_metadata();
+void store_blocks(int, void *, int);
+long sync_disk();
+void *flusher(void *);
+int filesystem_init();
+int set_bit_to_value(unsigned char*, int, int, int);
+int find_bit_value(unsigned char*, int, int);
+int alloc_inode(int, int);
+void free_inode(int);
+int alloc_run(int, int);
+int take_block(int);
+int find_group_dir();
+int block_goal(int);
+void mark_block(int, int);
+void mark_inode(int, int);
+void allocator_init(bitmap_allocator *);
+uint64_t load_word(unsigned char *, int);
+int next_bit(bitmap_allocator *, int, int, int);
+int mark_bit(bitmap_allocator *, int, int);
+int update_memory(void*, int, int);
+int find_inode_of_path(unsigned char *, int, int* ,unsigned char **, int);
+int find_path_of_inode (int, unsigned char **);
+int find_inode_name(int, int, char *);
+int cwd_inode();
+int write_data(int, int, void *, int);
+int is_inline(int);
+int inline_to_block(int);
+int append_data(int, void *, int);
+int read_data(int, int, void *, int);
+void data_iter_start(data_iter *, int, int, int);
+unsigned char *data_iter_next(data_iter *, int *);
+void data_iter_end(data_iter *);
+unsigned int name_hash(const char *, int);
+unsigned int dcache_hash(int, const char *, int);
+int dcache_lookup(int, const char *, int);
+void dcache_insert(int, const char *, int, int);
+void dcache_remove(int, const char *);
+void dcache_write(dentry *, int, int, const char *, int, int);
+unsigned char *inode_block(int, int);
+int append_block(int);
+int alloc_block(int);
+void release_block(int);
+void release_freed_blocks();
+int bmap(int, int, int);
+void truncate_blocks(int, int);
+void free_tree(int *, int, long long, long long);
+void clear_block(int);
+int bmap_run(int, int, int *);
+extent *find_extent(int, int);
+extent *last_extent(int);
+int extent_search(extent *, int, int);
+int extent_path(int, int *, extent_leaf **);
+int add_extent(int, int, int, int);
+int extent_grow(int);
+void remove_last_extent(int);
+int extent_alloc(int, int, int);
+int extent_bmap(int, int, int);
+void extent_truncate(int, int);
+int dir_init(int, int);
+int dir_chain(int, directory_header *, unsigned int);
+int table_bits(int);
+int dir_lookup(int, const char *, int);
+int dir_add_entry(int, const char *, int);
+int dir_remove_entry(int, const char *);
+int dir_count(int);
+void dir_iter_start(dir_iter *, int);
+directory_entry *dir_iter_next(dir_iter *);
+
+block_device devices[] = {
+    {"sync", sync_open, sync_run, sync_close},
+    {"threads", pool_open, pool_run, pool_close},
+    {"uring", uring_open, uring_run, uring_close},
+};
+
+
+/*****************************************************************/
+// initiates filesystem: (default initialization & create root) / read disk
+// return 0 for success or a negative error code
+int filesystem_init() {
+    crc32c_init();
+    int is_disk = superblock_init();
+    if (is_disk < 0) return is_disk;
+
+    if (is_disk) {
+        // finish the last committed transaction, it may change the superblock too,
+        // even its format if the disk was being converted
+        journal_replay();
+        disk_version = load_superblock(disk_block(0));
+        if (disk_version <= 0) return -EUCLEAN;
+        groups_init(1);
+        if (sb.features & FEATURE_CHECKSUMS) load_checksums();
+
+        // gather the slices of bitmaps and inode table of every group
+        for (int g = 0; g < sb.group_count; g++) {
+            int first_block = g * sb.blocks_per_group;
+            int first_inode = g * sb.inodes_per_group;
+            load_blocks(groups[g].block_bitmap, bm.block_map + first_block / BYTE_LEN,
+                        (group_end(g) - first_block) / BYTE_LEN);
+            load_blocks(groups[g].inode_bitmap, bm.inode_map + first_inode / BYTE_LEN,
+                        sb.inodes_per_group / BYTE_LEN);
+            if (disk_version == 1) {
+                load_blocks(groups[g].inode_table, &inodes[first_inode],
+                            sb.inodes_per_group * sizeof(struct inode));
+            } else {
+                load_inode_table(g);
+            }
+        }
+        allocator_init(&block_alloc);
+        allocator_init(&inode_alloc);
+        groups_count_free();
+
+        // an older disk is written at once in the format of this build
+        if (disk_version < FS_VERSION) {
+            disk_version = FS_VERSION;
+            if (sync_disk() == -1) return -EIO;
+            disk_converted = 1;
+        }
+    } else {
+        groups_init(0);
+
+        // blocks never written are zeroes
+        if (sb.features & FEATURE_CHECKSUMS) {
+            unsigned char *zeroes = calloc(1, sb.block_size);
+            if (zeroes == NULL) return -ENOMEM;
+            uint32_t zero_crc = htole32(crc32c(zeroes, sb.block_size));
+            free(zeroes);
+            for (int i = 0; i < sb.total_blocks; i++) {
+                checksums[i] = zero_crc;
+            }
+            checksums_ready = 1;
+        }
+
+        // reset bitmap of blocks
+        memset(bm.block_map, 0, BLOCK_MAP_LEN);
+        allocator_init(&block_alloc);
+
+        // reset bitmap of inodes
+        memset(bm.inode_map, 0, INODE_MAP_LEN);
+        allocator_init(&inode_alloc);
+        groups_count_free();
+
+        // all this blocks are occupied by superblock, group descriptors, journal,
+        // and by bitmaps and inode table of every group
+        for (int i = 0; i < sb.data_blocks_start; i++) {
+            mark_block(i, 1);
+        }
+        for (int g = 1; g < sb.group_count; g++) {
+            for (int i = g * sb.blocks_per_group; i < group_data_start(g); i++) {
+                mark_block(i, 1);
+            }
+        }
+
+        // create root directory
+        inodes[ROOT_INODE_INDEX].file_type = 1;
+        inodes[ROOT_INODE_INDEX].parent_inode_index = ROOT_INODE_INDEX;
+        mark_inode(ROOT_INODE_INDEX, 1);
+        //printf("bit: %d", find_bit_value(bm.inode_map, ROOT_INODE_INDEX, INODE_MAP_LEN));
+
+        // counters of superblock start from the bitmaps, blocks of root are taken from them
+        sb.free_blocks = sb.free_nodes = 0;
+        for (int g = 0; g < sb.group_count; g++) {
+            sb.free_blocks += groups[g].free_blocks;
+            sb.free_nodes += groups[g].free_inodes;
+        }
+
+        dir_init(ROOT_INODE_INDEX, ROOT_INODE_INDEX);
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// this function reads the superblock and sizes every structure after it;
+// blocks are read later, when used; a new disk gets the mkfs geometry
+// return 1 if disk contains data, 0 for a new disk, or a negative error code
+int superblock_init() {
+    int is_disk = 0;
+
+    disk_fd = open(disk_name, O_RDWR | O_CREAT, 0644);
+    if (disk_fd == -1) return -errno;
+
+    // disk file was created, but nothing was synced yet, if block 0 is empty
+    unsigned char head[MIN_BLOCK_SIZE] = {0};
+    if (!file_is_empty(disk_name) && pread(disk_fd, head, sizeof(head), 0) == sizeof(head)) {
+        disk_version = load_superblock(head);
+        if (disk_version < 0) return disk_version;
+        if (disk_version > 0 && !check_superblock()) return -EUCLEAN;
+        is_disk = (disk_version > 0);
+    }
+    if (!is_disk) {
+        disk_version = FS_VERSION;
+        int err = layout_superblock(mkfs_block_size, mkfs_blocks, mkfs_inodes, mkfs_features, mkfs_group_blocks);
+        if (err < 0) return err;
+    }
+
+    if (!geometry_init()) return -ENOMEM;
+
+    // a disk that can t be mapped is cached, fs_statfs tells which one is used
+    if (use_mmap && map_disk() == -1) use_mmap = 0;
+
+    if (!use_mmap) {
+        if (!cache_init()) return -ENOMEM;
+
+        // blocks are written back one by one, so disk file gets its full size now
+        ftruncate(disk_fd, (off_t)sb.total_blocks * sb.block_size);
+        device_init();
+    }
+
+    return is_disk;
+}
+
+
+/*****************************************************************/
+// fill the superblock from the start of block 0, in the format of version 2,
+// or in the one of version 1 (struct superblock as it was in memory)
+// return version of disk, 0 if block 0 is empty, or a negative error code
+int load_superblock(const unsigned char *data) {
+    const disk_superblock *d = (const disk_superblock *)data;
+    memset(&sb, 0, sizeof(sb));
+
+    if (le32toh(d->magic) != FS_MAGIC) {
+        memcpy(&sb, data, V1_SUPERBLOCK_LEN);
+        if (sb.total_blocks == 0) return 0;
+        if (sb.block_size < MIN_BLOCK_SIZE || sb.block_size > MAX_BLOCK_SIZE) return -EUCLEAN;
+
+        // version 1 kept every struct inode whole, across the blocks of inode table
+        if (!(sb.features & FEATURE_GROUPS)) single_group();
+        if (sb.inodes_per_group <= 0) return -EUCLEAN;
+        sb.inode_table_blocks = (int)(((long long)sb.inodes_per_group * sizeof(struct inode) +
+                                       sb.block_size - 1) / sb.block_size);
+        return 1;
+    }
+
+    int version = le16toh(d->version);
+    int features = le32toh(d->features);
+    if (version > FS_VERSION || (features & ~FEATURES_KNOWN) || d->inode_size != DISK_INODE_SIZE) {
+        return -EOPNOTSUPP;
+    }
+    if (d->block_bits >= 31) return -EUCLEAN;
+
+    sb.block_size = 1 << d->block_bits;
+    sb.features = features;
+    sb.total_blocks = le32toh(d->total_blocks);
+    sb.inode_count = le32toh(d->inode_count);
+    sb.free_blocks = le32toh(d->free_blocks);
+    sb.free_nodes = le32toh(d->free_nodes);
+    sb.blocks_per_group = le32toh(d->blocks_per_group);
+    sb.inodes_per_group = le32toh(d->inodes_per_group);
+    sb.group_count = le32toh(d->group_count);
+    sb.gdt_start = le32toh(d->gdt_start);
+    sb.journal_start = le32toh(d->journal_start);
+    sb.journal_blocks = le16toh(d->journal_blocks);
+    sb.inode_bitmap_start = le32toh(d->inode_bitmap_start);
+    sb.block_bitmap_start = le32toh(d->block_bitmap_start);
+    sb.inode_table_start = le32toh(d->inode_table_start);
+    sb.inode_table_blocks = le32toh(d->inode_table_blocks);
+    sb.data_blocks_start = le32toh(d->data_blocks_start);
+    sb.checksum_blocks = le32toh(d->checksum_blocks);
+
+    if ((features & FEATURE_CHECKSUMS) &&
+        crc32c(d, offsetof(disk_superblock, checksum)) != le32toh(d->checksum)) {
+        return -EBADMSG;
+    }
+    return version;
+}
+
+
+/*****************************************************************/
+// verify the superblock of a disk before anything is read after it:
+// geometry, groups, and that metadata fits before the data blocks
+// return 1 if it s valid
+int check_superblock() {
+    if (check_geometry(sb.block_size, sb.total_blocks, sb.inode_count) < 0 ||
+        sb.data_blocks_start <= 0 || sb.data_blocks_start >= sb.total_blocks) {
+        return 0;
+    }
+
+    if ((sb.features & FEATURE_GROUPS) &&
+        (sb.blocks_per_group <= 0 || sb.inodes_per_group <= 0 ||
+         sb.group_count != (sb.total_blocks + sb.blocks_per_group - 1) / sb.blocks_per_group ||
+         sb.inodes_per_group * sb.group_count != sb.inode_count ||
+         sb.gdt_start <= 0 || sb.gdt_start >= sb.data_blocks_start)) {
+        return 0;
+    }
+
+    // journal, bitmaps and inode table of group 0 come before its data, in this order
+    if (sb.journal_blocks < 0 || ((sb.features & FEATURE_JOURNAL) && sb.journal_blocks < 2) ||
+        sb.journal_start < 0 || sb.journal_start + sb.journal_blocks > sb.block_bitmap_start ||
+        sb.block_bitmap_start <= 0 || sb.inode_bitmap_start <= 0 ||
+        sb.inode_table_start <= 0 || sb.inode_table_blocks <= 0 ||
+        sb.inode_table_start + sb.inode_table_blocks + sb.checksum_blocks > sb.data_blocks_start) {
+        return 0;
+    }
+    int table_entries = (sb.blocks_per_group < sb.total_blocks) ? sb.blocks_per_group : sb.total_blocks;
+    if ((sb.features & FEATURE_CHECKSUMS) &&
+        ((long long)sb.checksum_blocks * sb.block_size < (long long)table_entries * (int)sizeof(uint32_t))) {
+        return 0;
+    }
+    if (disk_version >= 2 && (long long)sb.inode_table_blocks * INODES_PER_BLOCK < sb.inodes_per_group) {
+        return 0;
+    }
+
+    return sb.free_blocks >= 0 && sb.free_blocks <= sb.total_blocks &&
+           sb.free_nodes >= 0 && sb.free_nodes <= sb.inode_count;
+}
+
+
+/*****************************************************************/
+// fill the superblock of disk, in the format of FS_VERSION
+void pack_superblock(disk_superblock *d) {
+    int block_bits = 0;
+    while ((1 << block_bits) < sb.block_size) {
+        block_bits++;
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->magic = htole32(FS_MAGIC);
+    d->version = htole16(FS_VERSION);
+    d->block_bits = block_bits;
+    d->inode_size = DISK_INODE_SIZE;
+    d->features = htole32(sb.features);
+    d->total_blocks = htole32(sb.total_blocks);
+    d->inode_count = htole32(sb.inode_count);
+    d->free_blocks = htole32(__atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED));
+    d->free_nodes = htole32(__atomic_load_n(&sb.free_nodes, __ATOMIC_RELAXED));
+    d->blocks_per_group = htole32(sb.blocks_per_group);
+    d->inodes_per_group = htole32(sb.inodes_per_group);
+    d->group_count = htole32(sb.group_count);
+    d->gdt_start = htole32(sb.gdt_start);
+    d->journal_start = htole32(sb.journal_start);
+    d->journal_blocks = htole16(sb.journal_blocks);
+    d->inode_bitmap_start = htole32(sb.inode_bitmap_start);
+    d->block_bitmap_start = htole32(sb.block_bitmap_start);
+    d->inode_table_start = htole32(sb.inode_table_start);
+    d->inode_table_blocks = htole32(sb.inode_table_blocks);
+    d->data_blocks_start = htole32(sb.data_blocks_start);
+    d->checksum_blocks = htole32(sb.checksum_blocks);
+    if (sb.features & FEATURE_CHECKSUMS) {
+        d->checksum = htole32(crc32c(d, offsetof(disk_superblock, checksum)));
+    }
+}
+
+
+/*****************************************************************/
+// read the inodes of group "g" from their records
+void load_inode_table(int g) {
+    int first_inode = g * sb.inodes_per_group;
+    for (int b = 0; b * INODES_PER_BLOCK < sb.inodes_per_group; b++) {
+        const disk_inode *records = (const disk_inode *)get_block(groups[g].inode_table + b);
+        for (int i = 0; i < INODES_PER_BLOCK && b * INODES_PER_BLOCK + i < sb.inodes_per_group; i++) {
+            unpack_inode(first_inode + b * INODES_PER_BLOCK + i, &records[i]);
+        }
+        put_block(groups[g].inode_table + b);
+    }
+}
+
+
+/*****************************************************************/
+// write the records of inodes of group "g" to the blocks of its inode table;
+// like store_blocks, only blocks with changed content become dirty
+void store_inode_table(int g) {
+    unsigned char *image = malloc(sb.block_size);
+    if (image == NULL) return;
+
+    // blocks after the last record (left by version 1) are cleared
+    int first_inode = g * sb.inodes_per_group;
+    for (int b = 0; b < sb.inode_table_blocks; b++) {
+        memset(image, 0, sb.block_size);
+        disk_inode *records = (disk_inode *)image;
+        for (int i = 0; i < INODES_PER_BLOCK && b * INODES_PER_BLOCK + i < sb.inodes_per_group; i++) {
+            pack_inode(first_inode + b * INODES_PER_BLOCK + i, &records[i]);
+        }
+
+        int block = groups[g].inode_table + b;
+        unsigned char *data = get_block(block);
+        if (memcmp(data, image, sb.block_size)) {
+            memmove(data, image, sb.block_size);
+            mark_meta_dirty(block);
+        }
+        put_block(block);
+    }
+    free(image);
+}
+
+
+/*****************************************************************/
+// fill the record of an inode; block pointers and extents are ints, an inline
+// content is copied byte by byte
+void pack_inode(int inode_index, disk_inode *d) {
+    struct inode *in = &inodes[inode_index];
+    d->file_size = htole32(in->file_size);
+    d->parent_inode = htole32(in->parent_inode_index);
+    d->blocks_type = htole32((in->crtBLocks & INODE_BLOCKS_MASK) | ((uint32_t)in->file_type << 24));
+
+    if (is_inline(inode_index)) {
+        memcpy(d->data, in->inline_data, INLINE_DATA_LEN);
+        return;
+    }
+    for (int i = 0; i < INLINE_DATA_LEN; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, in->inline_data + i, sizeof(word));
+        word = htole32(word);
+        memcpy(d->data + i, &word, sizeof(word));
+    }
+}
+
+
+/*****************************************************************/
+// fill an inode from its record
+void unpack_inode(int inode_index, const disk_inode *d) {
+    struct inode *in = &inodes[inode_index];
+    uint32_t blocks_type = le32toh(d->blocks_type);
+    in->file_size = le32toh(d->file_size);
+    in->parent_inode_index = le32toh(d->parent_inode);
+    in->crtBLocks = blocks_type & INODE_BLOCKS_MASK;
+    in->file_type = blocks_type >> 24;
+
+    memcpy(in->inline_data, d->data, INLINE_DATA_LEN);
+    if (is_inline(inode_index)) return;
+    for (int i = 0; i < INLINE_DATA_LEN; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, in->inline_data + i, sizeof(word));
+        word = le32toh(word);
+        memcpy(in->inline_data + i, &word, sizeof(word));
+    }
+}
+
+
+/*****************************************************************/
+// verify that a geometry can be used by the filesystem
+// return 0 if it s valid or a negative error code
+int check_geometry(int block_size, int blocks, int inodes) {
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+        return -FS_EBLOCKSIZE;
+    }
+    if (blocks <= 0 || blocks % BYTE_LEN) return -FS_EBLOCKS;
+    if (inodes <= ROOT_INODE_INDEX || inodes % BYTE_LEN) return -FS_EINODES;
+    return 0;
+}
+
+
+/*****************************************************************/
+// fill the superblock of a new disk: superblock, group descriptors and journal,
+// then every group starts with its block bitmap, inode bitmap and inode table
+// return 0 if there s room for data in every group or a negative error code
+int layout_superblock(int block_size, int blocks, int inodes, int features, int group_blocks) {
+    int err = check_geometry(block_size, blocks, inodes);
+    if (err < 0) return err;
+
+    // the bitmap of blocks of a group fits in one block
+    if (group_blocks == 0) group_blocks = block_size * BYTE_LEN;
+    if (group_blocks <= 0 || group_blocks % BYTE_LEN || group_blocks > block_size * BYTE_LEN) {
+        return -FS_EGROUP;
+    }
+
+    memset(&sb, 0, sizeof(sb));
+    sb.block_size = block_size;
+    sb.blocks_per_group = group_blocks;
+    sb.features = features | FEATURE_GROUPS;
+    // a table has a checksum for every block of a group; a single group may be smaller
+    int table_entries = (group_blocks < blocks) ? group_blocks : blocks;
+    sb.checksum_blocks = (features & FEATURE_CHECKSUMS) ?
+                         (int)((table_entries * sizeof(uint32_t) + block_size - 1) / block_size) : 0;
+
+    // a last group too small for its own metadata is left out
+    int group_count = (blocks + group_blocks - 1) / group_blocks;
+    for (int pass = 0; pass < 2; pass++) {
+        sb.group_count = group_count;
+        sb.inodes_per_group = ((inodes + group_count - 1) / group_count + BYTE_LEN - 1) / BYTE_LEN * BYTE_LEN;
+        sb.inode_table_blocks = (sb.inodes_per_group + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+        int last = blocks - (group_count - 1) * group_blocks;
+        if (group_count == 1 || last >= group_meta_blocks() + MIN_DATA_BLOCKS) break;
+        group_count--;
+        blocks = group_count * group_blocks;
+    }
+
+    sb.total_blocks = blocks;
+    sb.inode_count = sb.inodes_per_group * sb.group_count;
+    sb.free_blocks = blocks - 1;
+    sb.free_nodes = sb.inode_count - 1;
+    sb.gdt_start = 1;
+    sb.journal_start = sb.gdt_start +
+                       (int)((sb.group_count * sizeof(group_desc) + block_size - 1) / block_size);
+
+    // a mapped disk is written by kernel at any time, so it can t keep the order of journal
+    if (use_mmap) sb.features &= ~FEATURE_JOURNAL;
+    // a bigger disk gets a bigger journal, so long commands need fewer commits
+    sb.journal_blocks = 0;
+    if (sb.features & FEATURE_JOURNAL) {
+        int most = (block_size - (int)sizeof(journal_header)) / (int)sizeof(int) + 2;
+        sb.journal_blocks = JOURNAL_BLOCKS + blocks / JOURNAL_RATIO;
+        if (sb.journal_blocks > most) sb.journal_blocks = most;
+    }
+
+    // metadata of group 0 comes after journal
+    sb.block_bitmap_start = sb.journal_start + sb.journal_blocks;
+    sb.inode_bitmap_start = sb.block_bitmap_start + 1;
+    sb.inode_table_start = sb.inode_bitmap_start +
+                           (sb.inodes_per_group / BYTE_LEN + block_size - 1) / block_size;
+    sb.data_blocks_start = sb.block_bitmap_start + group_meta_blocks();
+
+    int first_group = (sb.group_count == 1) ? blocks : group_blocks;
+    if (sb.data_blocks_start + MIN_DATA_BLOCKS > first_group) return -FS_ESMALL;
+    return 0;
+}
+
+
+/*****************************************************************/
+// blocks used by bitmaps and inode table at the start of every group
+int group_meta_blocks() {
+    int inode_bitmap = (sb.inodes_per_group / BYTE_LEN + sb.block_size - 1) / sb.block_size;
+    return 1 + inode_bitmap + sb.inode_table_blocks + sb.checksum_blocks;
+}
+
+
+/*****************************************************************/
+// fill the group descriptors: read from their table on disk, or computed from superblock
+void groups_init(int is_disk) {
+    if (!(sb.features & FEATURE_GROUPS)) {
+        // disk made before block groups: one group with the places from superblock
+        single_group();
+        groups[0].block_bitmap = sb.block_bitmap_start;
+        groups[0].inode_bitmap = sb.inode_bitmap_start;
+        groups[0].inode_table = sb.inode_table_start;
+        return;
+    }
+
+    if (is_disk) {
+        load_blocks(sb.gdt_start, groups, sb.group_count * sizeof(group_desc));
+        return;
+    }
+
+    for (int g = 0; g < sb.group_count; g++) {
+        groups[g].block_bitmap = (g == 0) ? sb.block_bitmap_start : g * sb.blocks_per_group;
+        groups[g].inode_bitmap = groups[g].block_bitmap + 1;
+        groups[g].inode_table = groups[g].inode_bitmap +
+                                (sb.inodes_per_group / BYTE_LEN + sb.block_size - 1) / sb.block_size;
+    }
+}
+
+
+/*****************************************************************/
+// describe a disk made before block groups as a single group
+void single_group() {
+    sb.blocks_per_group = sb.total_blocks;
+    sb.inodes_per_group = sb.inode_count;
+    sb.group_count = 1;
+    sb.gdt_start = 0;
+}
+
+
+/*****************************************************************/
+// count free blocks and inodes of every group from the bitmaps
+void groups_count_free() {
+    for (int g = 0; g < sb.group_count; g++) {
+        groups[g].free_blocks = 0;
+        for (int i = g * sb.blocks_per_group; i < group_end(g); i++) {
+            if (find_bit_value(bm.block_map, i, BLOCK_MAP_LEN) == 0) groups[g].free_blocks++;
+        }
+
+        groups[g].free_inodes = 0;
+        for (int i = g * sb.inodes_per_group; i < (g + 1) * sb.inodes_per_group; i++) {
+            if (find_bit_value(bm.inode_map, i, INODE_MAP_LEN) == 0) groups[g].free_inodes++;
+        }
+    }
+}
+
+
+/*****************************************************************/
+// first block after group "g"
+int group_end(int g) {
+    int end = (g + 1) * sb.blocks_per_group;
+    return (end < sb.total_blocks) ? end : sb.total_blocks;
+}
+
+
+/*****************************************************************/
+// first block of group "g" that can keep data
+int group_data_start(int g) {
+    if (g == 0) return sb.data_blocks_start;
+    return groups[g].block_bitmap + group_meta_blocks();
+}
+
+
+/*****************************************************************/
+// allocate bitmaps, inode table and caches for the geometry of superblock
+// return 1 for success
+int geometry_init() {
+    int block_regions = (sb.total_blocks + REGION_BITS - 1) / REGION_BITS;
+    int inode_regions = (sb.inode_count + REGION_BITS - 1) / REGION_BITS;
+
+    bm.block_map = calloc(BLOCK_MAP_LEN, 1);
+    bm.inode_map = calloc(INODE_MAP_LEN, 1);
+    dirty_map = calloc(BLOCK_MAP_LEN, 1);
+    freed_map = calloc(BLOCK_MAP_LEN, 1);
+    meta_map = calloc(BLOCK_MAP_LEN, 1);
+    inodes = calloc(sb.inode_count, sizeof(struct inode));
+    bmap_cache = calloc(sb.inode_count, sizeof(struct bmap_cache));
+    groups = calloc(sb.group_count, sizeof(group_desc));
+    ra_state = calloc(sb.inode_count, sizeof(readahead_state));
+    open_count = calloc(sb.inode_count, sizeof(int));
+    inode_names = calloc(sb.inode_count, MAX_FILE_NAME + 1);
+    inode_locks = malloc(sb.inode_count * sizeof(pthread_rwlock_t));
+    group_locks = malloc(sb.group_count * sizeof(pthread_mutex_t));
+    checksums_ready = 0;
+    checksums = NULL;
+    bad_map = NULL;
+    csum_stats = (struct checksum_stats){0, 0, 0, -1};
+    if (sb.features & FEATURE_CHECKSUMS) {
+        checksums = calloc(sb.total_blocks, sizeof(uint32_t));
+        bad_map = calloc(BLOCK_MAP_LEN, 1);
+        if (!checksums || !bad_map) return 0;
+    }
+
+    block_alloc = (bitmap_allocator){bm.block_map, sb.total_blocks, 0, calloc(block_regions, sizeof(int))};
+    inode_alloc = (bitmap_allocator){bm.inode_map, sb.inode_count, 0, calloc(inode_regions, sizeof(int))};
+    dirty_blocks = (bitmap_allocator){dirty_map, sb.total_blocks, 0, calloc(block_regions, sizeof(int))};
+    meta_blocks = (bitmap_allocator){meta_map, sb.total_blocks, 0, calloc(block_regions, sizeof(int))};
+    freed_blocks = (bitmap_allocator){freed_map, sb.total_blocks, 0, calloc(block_regions, sizeof(int))};
+
+    if (!bm.block_map || !bm.inode_map || !dirty_map || !meta_map || !freed_map || !inodes || !bmap_cache || !groups || !ra_state ||
+        !open_count || !inode_names || !inode_locks || !group_locks ||
+        !block_alloc.region_free || !inode_alloc.region_free ||
+        !dirty_blocks.region_free || !meta_blocks.region_free || !freed_blocks.region_free) {
+        return 0;
+    }
+
+    allocator_init(&dirty_blocks);
+    allocator_init(&meta_blocks);
+    allocator_init(&freed_blocks);
+
+    // tables of directories take their whole block
+    dir_top_bits = table_bits(sb.block_size - (int)sizeof(directory_header));
+    dir_index_bits = table_bits(sb.block_size - (int)sizeof(directory_index));
+
+    // names remembered from a disk mounted before are not valid for this one
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        dcache.slots[i].valid = 0;
+    }
+
+    for (int i = 0; i < sb.inode_count; i++) {
+        pthread_rwlock_init(&inode_locks[i], NULL);
+    }
+    for (int g = 0; g < sb.group_count; g++) {
+        pthread_mutex_init(&group_locks[g], NULL);
+    }
+    for (int i = 0; i < RA_LOCKS; i++) {
+        pthread_mutex_init(&ra_locks[i], NULL);
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// stop the block device, free everything sized by the geometry and close the disk
+// file, so another disk can be mounted; used by unmount and by a failed mount
+void close_disk() {
+    if (device != NULL) {
+        device->close();
+        device = NULL;
+    }
+    if (disk_buffer != NULL) {
+        munmap(disk_buffer, (size_t)sb.total_blocks * sb.block_size);
+        disk_buffer = NULL;
+    }
+
+    // slots after the budget got their own buffers when the cache grew
+    for (int s = bcache.budget; bcache.slots != NULL && s < bcache.count; s++) {
+        free(bcache.slots[s].data);
+    }
+    free(bcache.slots);
+    free(bcache.arena);
+    free(bcache.slot_of);
+    bcache.slots = NULL;
+    bcache.arena = NULL;
+    bcache.slot_of = NULL;
+    bcache.count = 0;
+
+    void **arrays[] = {(void **)&bm.block_map, (void **)&bm.inode_map, (void **)&dirty_map, (void **)&meta_map,
+                       (void **)&freed_map, (void **)&inodes, (void **)&bmap_cache, (void **)&groups, (void **)&ra_state,
+                       (void **)&open_count, (void **)&inode_names, (void **)&inode_locks, (void **)&group_locks,
+                       (void **)&checksums, (void **)&bad_map, (void **)&block_alloc.region_free,
+                       (void **)&inode_alloc.region_free, (void **)&dirty_blocks.region_free,
+                       (void **)&meta_blocks.region_free, (void **)&freed_blocks.region_free};
+    for (int i = 0; i < (int)(sizeof(arrays) / sizeof(arrays[0])); i++) {
+        free(*arrays[i]);
+        *arrays[i] = NULL;
+    }
+
+    if (disk_fd != -1) close(disk_fd);
+    disk_fd = -1;
+}
+
+
+/*****************************************************************/
+// block "nr" in memory, kept in cache until the end of the current command;
+// used by metadata (pointers, extents, directories), that needs few blocks at once
+unsigned char *disk_block(int nr) {
+    unsigned char *data = get_block(nr);
+    if (use_mmap) return data;
+
+    if (held.count == held.len) {
+        if (held.len == 0) pthread_once(&held_once, held_key_init);
+        int len = held.len ? 2 * held.len : MIN_CACHE_BLOCKS;
+        int *blocks = realloc(held.blocks, len * sizeof(int));
+        if (blocks == NULL) fatal_error(-ENOMEM);
+        held.blocks = blocks;
+        held.len = len;
+        pthread_setspecific(held_key, blocks);
+    }
+    held.blocks[held.count++] = nr;
+    return data;
+}
+
+
+/*****************************************************************/
+// end the process on an error that the running call can t return; the program
+// that gave a handler in fs_options is told first
+void fatal_error(int err) {
+    if (fatal_handler != NULL) fatal_handler(err);
+    exit(1);
+}
+
+
+/*****************************************************************/
+// read block "nr" if needed and pin it in memory until put_block
+unsigned char *get_block(int nr) {
+    return cache_get(nr, 1);
+}
+
+
+/*****************************************************************/
+// pin block "nr" in memory filled with zeroes, without reading it
+unsigned char *get_zero_block(int nr) {
+    unsigned char *data = cache_get(nr, 0);
+    memset(data, 0, sb.block_size);
+    return data;
+}
+
+
+/*****************************************************************/
+// find block "nr" in cache or bring it in a free or replaced slot
+// "read" tells if the old content from disk is needed
+unsigned char *cache_get(int nr, int read) {
+    if (use_mmap) return disk_buffer + (size_t)nr * sb.block_size;
+
+    pthread_mutex_lock(&bcache.lock);
+    int s;
+    while ((s = bcache.slot_of[nr]) != -1 && bcache.slots[s].loading) {
+        pthread_cond_wait(&bcache.loaded, &bcache.lock);
+    }
+    if (s != -1) {
+        cache_slot *slot = &bcache.slots[s];
+        bcache.hits++;
+        slot->pins++;
+        slot->referenced = 1;
+        if (slot->prefetched) {
+            // read-ahead was right, let windows grow again
+            slot->prefetched = 0;
+            ahead.used++;
+            if (ahead.used % ahead.max_window == 0 && ahead.max_window < RA_MAX_WINDOW) {
+                __atomic_store_n(&ahead.max_window, ahead.max_window + 1, __ATOMIC_RELAXED);
+            }
+        }
+        unsigned char *data = slot->data;
+        pthread_mutex_unlock(&bcache.lock);
+        return data;
+    }
+    bcache.misses++;
+
+    s = cache_victim(1);
+    if (s == -1) fatal_error(-ENOMEM);
+
+    // the slot is pinned and found by others while it s read, without the lock
+    cache_slot *slot = &bcache.slots[s];
+    unsigned char *data = slot->data;
+    slot->block = nr;
+    slot->pins = 1;
+    slot->referenced = 1;
+    slot->prefetched = 0;
+    slot->loading = read;
+    bcache.slot_of[nr] = s;
+    pthread_mutex_unlock(&bcache.lock);
+
+    if (read) {
+        io_request req = {0, nr, 1, &data};
+        device_run(&req, 1);
+        if (req.done < sb.block_size) {
+            memset(data + req.done, 0, sb.block_size - req.done);
+        }
+        verify_block(nr, data);
+
+        pthread_mutex_lock(&bcache.lock);
+        bcache.slots[s].loading = 0;
+        pthread_cond_broadcast(&bcache.loaded);
+        pthread_mutex_unlock(&bcache.lock);
+    }
+    return data;
+}
+
+
+/*****************************************************************/
+// unpin a block taken with get_block, it can be replaced from now on
+void put_block(int nr) {
+    if (use_mmap) return;
+
+    pthread_mutex_lock(&bcache.lock);
+    int s = bcache.slot_of[nr];
+    if (s != -1 && bcache.slots[s].pins > 0) {
+        bcache.slots[s].pins--;
+    }
+    cache_shrink();
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+
+/*****************************************************************/
+// unpin all blocks taken with disk_block by the last command of this thread
+void put_held_blocks() {
+    if (use_mmap) return;
+
+    pthread_mutex_lock(&bcache.lock);
+    for (int i = 0; i < held.count; i++) {
+        int s = bcache.slot_of[held.blocks[i]];
+        if (s != -1 && bcache.slots[s].pins > 0) {
+            bcache.slots[s].pins--;
+        }
+    }
+    cache_shrink();
+    pthread_mutex_unlock(&bcache.lock);
+    held.count = 0;
+}
+
+
+/*****************************************************************/
+// create the key whose destructor frees the list of held blocks of a thread that ends
+void held_key_init() {
+    pthread_key_create(&held_key, free);
+}
+
+
+/*****************************************************************/
+// free the list of held blocks of this thread, at unmount; the lists of other threads
+// are freed when they end
+void free_held_blocks() {
+    if (held.len == 0) return;
+
+    pthread_setspecific(held_key, NULL);
+    free(held.blocks);
+    held = (struct held_blocks){NULL, 0, 0};
+}
+
+
+/*****************************************************************/
+// prepare an empty cache for "cache_kb" of blocks
+// return 1 for success
+int cache_init() {
+    bcache.budget = (int)((long long)cache_kb * 1024 / sb.block_size);
+    if (bcache.budget < MIN_CACHE_BLOCKS) bcache.budget = MIN_CACHE_BLOCKS;
+    if (bcache.budget > sb.total_blocks) bcache.budget = sb.total_blocks;
+
+    bcache.slots = calloc(bcache.budget, sizeof(cache_slot));
+    bcache.arena = malloc((size_t)bcache.budget * sb.block_size);
+    bcache.slot_of = malloc(sb.total_blocks * sizeof(int));
+    if (!bcache.slots || !bcache.arena || !bcache.slot_of) return 0;
+
+    for (int i = 0; i < sb.total_blocks; i++) {
+        bcache.slot_of[i] = -1;
+    }
+    bcache.count = 0;
+    bcache.hand = 0;
+    return 1;
+}
+
+
+/*****************************************************************/
+// find a slot for a new block: an unused one while the budget allows it,
+// else the first one that the CLOCK hand can replace; if all are pinned,
+// the cache grows over its budget, only if "grow" is 1; called with the lock of cache
+// return index of slot or -1 for error
+int cache_victim(int grow) {
+    if (bcache.count < bcache.budget) {
+        bcache.slots[bcache.count].data = bcache.arena + (size_t)bcache.count * sb.block_size;
+        return bcache.count++;
+    }
+
+    // two turns: the first one may only clear the referenced bits
+    for (int steps = 0; steps < 2 * bcache.count; steps++) {
+        int s = bcache.hand;
+        bcache.hand = (bcache.hand + 1) % bcache.count;
+
+        cache_slot *slot = &bcache.slots[s];
+        if (slot->pins > 0) continue;
+        if (slot->referenced) {
+            slot->referenced = 0;
+            continue;
+        }
+        if (cache_evict(s)) return s;
+    }
+
+    // every block is in use: one more slot
+    if (!grow) return -1;
+    cache_slot *slots = realloc(bcache.slots, (bcache.count + 1) * sizeof(cache_slot));
+    if (slots == NULL) return -1;
+    bcache.slots = slots;
+    bcache.slots[bcache.count].data = malloc(sb.block_size);
+    if (bcache.slots[bcache.count].data == NULL) return -1;
+    return bcache.count++;
+}
+
+
+/*****************************************************************/
+// give back the slots taken over the budget when all were pinned, from the last one,
+// as soon as their blocks can leave the cache; called with the lock of cache
+void cache_shrink() {
+    while (bcache.count > bcache.budget) {
+        int s = bcache.count - 1;
+        cache_slot *slot = &bcache.slots[s];
+        if (slot->pins > 0 || slot->loading || !cache_evict(s)) return;
+
+        free(slot->data);
+        bcache.count--;
+        if (bcache.hand >= bcache.count) bcache.hand = 0;
+    }
+}
+
+
+/*****************************************************************/
+// take the block of slot "s" out of cache, writing it first if it s dirty
+// return 1 for success, 0 if block must stay
+int cache_evict(int s) {
+    cache_slot *slot = &bcache.slots[s];
+    int block = slot->block;
+    if (block == -1) return 1;
+
+    if (find_bit_value(dirty_map, block, BLOCK_MAP_LEN) == 1) {
+        // metadata reaches its place only after journal
+        if ((sb.features & FEATURE_JOURNAL) && find_bit_value(meta_map, block, BLOCK_MAP_LEN) == 1) {
+            return 0;
+        }
+        checksum_block(block, slot->data);
+        io_request req = {1, block, 1, &slot->data};
+        if (!device_run(&req, 1)) return 0;
+        mark_bit(&dirty_blocks, block, 0);
+        mark_bit(&meta_blocks, block, 0);
+        bcache.writebacks++;
+    }
+
+    if (slot->prefetched) {
+        // read-ahead went too far for this cache
+        slot->prefetched = 0;
+        ahead.wasted++;
+        __atomic_store_n(&ahead.max_window, (ahead.max_window / 2 > RA_MIN_WINDOW) ?
+                         ahead.max_window / 2 : RA_MIN_WINDOW, __ATOMIC_RELAXED);
+    }
+
+    bcache.slot_of[block] = -1;
+    slot->block = -1;
+    bcache.evictions++;
+    return 1;
+}
+
+
+/*****************************************************************/
+// read the blocks of runs [first[r], first[r] + count[r]) that aren t cached, all
+// of them in one batch; they stay unpinned and are the first to be replaced if unused
+void cache_prefetch(int *first, int *count, int runs) {
+    io_request reqs[RA_MAX_WINDOW];
+    unsigned char *data[RA_MAX_WINDOW];
+    int slots[RA_MAX_WINDOW];
+    int n = 0, total = 0;
+
+    pthread_mutex_lock(&bcache.lock);
+    for (int r = 0; r < runs; r++) {
+        for (int block = first[r]; block < first[r] + count[r] && total < RA_MAX_WINDOW; block++) {
+            if (bcache.slot_of[block] != -1) continue;
+
+            // slots are pinned and loading while they are read, like in cache_get
+            int s = cache_victim(0);
+            if (s == -1) break;
+            cache_slot *slot = &bcache.slots[s];
+            slot->block = block;
+            slot->pins = 1;
+            slot->loading = 1;
+            bcache.slot_of[block] = s;
+            slots[total] = s;
+            data[total] = slot->data;
+
+            // a block next to the last one on disk is read by the same request
+            if (n > 0 && reqs[n - 1].first + reqs[n - 1].count == block && reqs[n - 1].count < SYNC_BATCH) {
+                reqs[n - 1].count++;
+            } else {
+                reqs[n++] = (io_request){0, block, 1, &data[total]};
+            }
+            total++;
+        }
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    if (total == 0) return;
+    device_run(reqs, n);
+
+    for (int r = 0, i = 0; r < n; r++) {
+        for (int j = 0; j < reqs[r].count; j++, i++) {
+            long valid = reqs[r].done - (long)j * sb.block_size;
+            if (valid < sb.block_size) {
+                memset(data[i] + (valid > 0 ? valid : 0), 0, sb.block_size - (valid > 0 ? valid : 0));
+            }
+            verify_block(reqs[r].first + j, data[i]);
+        }
+    }
+
+    pthread_mutex_lock(&bcache.lock);
+    for (int i = 0; i < total; i++) {
+        cache_slot *slot = &bcache.slots[slots[i]];
+        slot->pins--;
+        slot->referenced = 0;
+        slot->prefetched = 1;
+        slot->loading = 0;
+    }
+    ahead.read += total;
+    pthread_cond_broadcast(&bcache.loaded);
+    pthread_mutex_unlock(&bcache.lock);
+}
+
+
+/*****************************************************************/
+// logical block "nr" of an inode is going to be read: if reads are sequential,
+// when half of the last window was used, read the next one in cache and ask
+// the kernel to read the one after it in background
+void read_ahead(int inode_index, int nr) {
+    if (use_mmap) return;       // the kernel reads ahead mapped files by itself
+
+    // readers of the same file share its state, the window is chosen by one of them
+    readahead_state *st = &ra_state[inode_index];
+    pthread_mutex_t *lock = &ra_locks[inode_index % RA_LOCKS];
+    pthread_mutex_lock(lock);
+    int sequential = (nr == st->next);
+    st->next = nr + 1;
+    if (!sequential) {
+        // random access doesn t read ahead, until it becomes sequential or starts again
+        st->window = 0;
+        st->end = nr + 1;
+    }
+    if ((!sequential && nr != 0) || st->end - st->window / 2 > nr + 1) {
+        pthread_mutex_unlock(lock);
+        return;
+    }
+
+    int max_window = __atomic_load_n(&ahead.max_window, __ATOMIC_RELAXED);
+    int limit = (max_window < bcache.budget / 4) ? max_window : bcache.budget / 4;
+    st->window = (st->window == 0) ? RA_MIN_WINDOW : st->window * 2;
+    if (st->window > limit) st->window = limit;
+
+    int window = st->window;
+    int from = (st->end > nr + 1) ? st->end : nr + 1;
+    int to = from + window;
+    if (to > inodes[inode_index].crtBLocks) to = inodes[inode_index].crtBLocks;
+    if (from < to) st->end = to;
+    pthread_mutex_unlock(lock);
+    if (from >= to) return;
+
+    // blocks contiguous on disk are read together, all runs of window at once
+    int start[RA_MAX_WINDOW], count[RA_MAX_WINDOW];
+    int runs = 0;
+    for (int i = from; i < to; ) {
+        int run;
+        int block = bmap_run(inode_index, i, &run);
+        if (block == -1) break;
+        if (run > to - i) run = to - i;
+
+        if (runs > 0 && block == start[runs - 1] + count[runs - 1]) {
+            count[runs - 1] += run;
+        } else {
+            start[runs] = block;
+            count[runs++] = run;
+        }
+        i += run;
+    }
+    if (runs == 0) return;
+    cache_prefetch(start, count, runs);
+
+    // the next window probably follows on disk
+    posix_fadvise(disk_fd, (off_t)(start[runs - 1] + count[runs - 1]) * sb.block_size,
+                  (off_t)window * sb.block_size, POSIX_FADV_WILLNEED);
+}
+
+
+/*****************************************************************/
+// a file grows with its logical block "nr": once WRITE_BEHIND_BATCH blocks were added
+// before it, write those that are still dirty now and let the kernel send them to disk in
+// background. Only blocks of this inode are written, the caller holds it locked, so no
+// other thread changes them meanwhile; they may be in a few runs if files grow together
+void write_behind(int inode_index, int nr) {
+    if (use_mmap) return;
+
+    // a truncated file starts again
+    int from = bmap_cache[inode_index].behind;
+    if (from > nr) from = 0;
+    if (nr - from < WRITE_BEHIND_BATCH) {
+        bmap_cache[inode_index].behind = from;
+        return;
+    }
+    bmap_cache[inode_index].behind = nr;
+    from = nr - WRITE_BEHIND_BATCH;
+
+    int first[WRITE_BEHIND_BATCH], count[WRITE_BEHIND_BATCH];
+    int runs = 0, total = 0;
+    for (int i = from; i < nr; i++) {
+        int block = bmap(inode_index, i, 0);
+        if (block == -1 || find_bit_value(dirty_map, block, BLOCK_MAP_LEN) == 0) continue;
+
+        if (runs > 0 && first[runs - 1] + count[runs - 1] == block) {
+            count[runs - 1]++;
+        } else {
+            first[runs] = block;
+            count[runs++] = 1;
+        }
+        total++;
+    }
+    if (runs == 0) return;
+
+    for (int r = 0; r < runs; r++) {
+        for (int i = first[r]; i < first[r] + count[r]; i++) {
+            mark_bit(&dirty_blocks, i, 0);
+            if (has_checksum(i)) {
+                checksum_block(i, get_block(i));
+                put_block(i);
+            }
+        }
+    }
+    if (!write_runs(first, count, runs)) {
+        for (int r = 0; r < runs; r++) {
+            for (int i = first[r]; i < first[r] + count[r]; i++) {
+                mark_dirty(i);
+            }
+        }
+        return;
+    }
+
+    for (int r = 0; r < runs; r++) {
+        sync_file_range(disk_fd, (off_t)first[r] * sb.block_size, (off_t)count[r] * sb.block_size,
+                        SYNC_FILE_RANGE_WRITE);
+    }
+    __atomic_store_n(&journal.data_pending, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ahead.batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ahead.written, total, __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// copy "len" bytes from the blocks starting with "first"
+void load_blocks(int first, void *dst, int len) {
+    unsigned char *data = (unsigned char *)dst;
+    for (int i = 0; len > 0; i++) {
+        int size = (len < sb.block_size) ? len : sb.block_size;
+        memmove(data, get_block(first + i), size);
+        put_block(first + i);
+        data += size;
+        len -= size;
+    }
+}
+
+
+/*****************************************************************/
+// map the disk file in memory, so disk_buffer points into it
+// return 1 for success, -1 for error
+int map_disk() {
+    size_t size = (size_t)sb.total_blocks * sb.block_size;
+
+    struct stat st;
+    if (fstat(disk_fd, &st) == -1) return -1;
+
+    // a new or short disk is extended with zeroes
+    if ((size_t)st.st_size < size && ftruncate(disk_fd, size) == -1) return -1;
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, disk_fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    disk_buffer = map;
+    return 1;
+}
+
+
+
+/*****************************************************************/
+// build the path of "crt_inode" from the reverse index of names, one step for every
+// directory above it, in "*str" (replaced)
+// return 1 for success
+int find_path_of_inode(int crt_inode, unsigned char **str) {
+    if (str == NULL) return 0; // for safety
+
+    // names from inode to root, each with its '/'
+    int depth = 0, max_depth = 16, length = 2;
+    char (*names)[MAX_FILE_NAME + 1] = malloc(max_depth * sizeof(*names));
+    if (names == NULL) return 0;
+
+    // a child is unlocked before its parent is locked
+    while (crt_inode != ROOT_INODE_INDEX) {
+        if (depth == max_depth) {
+            max_depth *= 2;
+            void *bigger = realloc(names, max_depth * sizeof(*names));
+            if (bigger == NULL) {
+                free(names);
+                return 0;
+            }
+            names = bigger;
+        }
+
+        lock_inode(crt_inode, READ_LOCK);
+        int parent_inode = inodes[crt_inode].parent_inode_index;
+        strcpy(names[depth], inode_names[crt_inode]);
+        unlock_inode(crt_inode);
+        if (names[depth][0] == '\0' && !find_inode_name(crt_inode, parent_inode, names[depth])) {
+            free(names);
+            return 0;
+        }
+
+        length += strlen(names[depth]) + 1;
+        depth++;
+        crt_inode = parent_inode;
+    }
+
+    // copy the names from root down, into a buffer of the right size
+    unsigned char *path = malloc(length);
+    if (path == NULL) {
+        free(names);
+        return 0;
+    }
+    int len = 0;
+    path[len++] = '/';
+    while (depth-- > 0) {
+        int name_len = strlen(names[depth]);
+        memcpy(path + len, names[depth], name_len);
+        len += name_len;
+        path[len++] = '/';
+    }
+    path[len] = '\0';
+
+    free(names);
+    free(*str);
+    *str = path;
+    return 1;
+}
+
+
+/*****************************************************************/
+// find the name of "inode" in "parent_inode" for the reverse index, when it was
+// created before the disk was mounted; the directory is read only the first time
+// return 1 for success
+int find_inode_name(int inode, int parent_inode, char *name) {
+    dir_iter it;
+    directory_entry *entry;
+    int found = 0;
+    lock_inode(parent_inode, READ_LOCK);
+    dir_iter_start(&it, parent_inode);
+    while ((entry = dir_iter_next(&it)) != NULL) {
+        if (entry->inode_index == inode && strcmp(entry->filename, ".") && strcmp(entry->filename, "..")) {
+            strcpy(name, entry->filename);
+            found = 1;
+            break;
+        }
+    }
+    unlock_inode(parent_inode);
+    if (!found) return 0;
+
+    // remembered under the lock of inode, like when it s created
+    lock_inode(inode, WRITE_LOCK);
+    strcpy(inode_names[inode], name);
+    unlock_inode(inode);
+    return 1;
+}
+
+
+/*****************************************************************/
+// write "len" bytes at "offset" of a file, touching only the blocks of this range.
+// the blocks after the end of file are allocated if file grows
+// return number of written bytes or -1 for error
+int write_data(int inode_index, int offset, void *buf, int len) {
+    unsigned char *src = (unsigned char *)buf;
+    if (offset < 0 || len < 0 || (long long)offset + len > MAX_CONTENT_IN_FILE) return -1;
+
+    int end = offset + len;
+
+    // a small file is changed in its inode, until it grows past it
+    if (is_inline(inode_index)) {
+        if (end <= INLINE_DATA_LEN) {
+            memmove(inodes[inode_index].inline_data + offset, src, len);
+            if (end > inodes[inode_index].file_size) {
+                inodes[inode_index].file_size = end;
+            }
+            return len;
+        }
+        if (!inline_to_block(inode_index)) return -1;
+    }
+
+    int usedBlocks = inodes[inode_index].crtBLocks;
+    int requiredBlocks = (end + sb.block_size - 1) / sb.block_size;
+
+    // allocate only the blocks after the old end of file
+    if (requiredBlocks > usedBlocks) {
+        if (__atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED) < requiredBlocks - usedBlocks) return -1;
+
+        if ((sb.features & FEATURE_EXTENTS) &&
+            !extent_alloc(inode_index, usedBlocks, requiredBlocks - usedBlocks)) {
+            truncate_blocks(inode_index, usedBlocks);
+            return -1;
+        }
+        for (int i = usedBlocks; i < requiredBlocks; i++) {
+            if (bmap(inode_index, i, 1) == -1) {
+                truncate_blocks(inode_index, usedBlocks);
+                return -1;
+            }
+        }
+        inodes[inode_index].crtBLocks = requiredBlocks;
+    }
+
+    // copy one run of contiguous blocks at a time
+    int pos = offset;
+    while (pos < end) {
+        int run;
+        int block = bmap_run(inode_index, pos / sb.block_size, &run);
+        int in_block = pos % sb.block_size;
+        int copy_size = run * sb.block_size - in_block;
+        if (copy_size > end - pos) copy_size = end - pos;
+
+        // blocks of the run are cached one by one
+        for (int i = 0; copy_size > 0; i++) {
+            int size = sb.block_size - in_block;
+            if (size > copy_size) size = copy_size;
+
+            memmove(get_block(block + i) + in_block, src, size);
+            mark_dirty(block + i);
+            put_block(block + i);
+            src += size;
+            pos += size;
+            copy_size -= size;
+            in_block = 0;
+        }
+    }
+
+    if (end > inodes[inode_index].file_size) {
+        inodes[inode_index].file_size = end;
+    }
+
+    // the last block may still grow, the ones before it can go to disk
+    if (requiredBlocks > usedBlocks) {
+        write_behind(inode_index, requiredBlocks - 1);
+    }
+    return len;
+}
+
+
+/*****************************************************************/
+// verify if the content of an inode is kept in the inode itself: a file of a disk with
+// FEATURE_INLINE_DATA, without blocks
+// return 1 if it s inline
+int is_inline(int inode_index) {
+    return (sb.features & FEATURE_INLINE_DATA) && inodes[inode_index].file_type == 0 &&
+           inodes[inode_index].crtBLocks == 0;
+}
+
+
+/*****************************************************************/
+// move the inline content of a file to its first block, before it grows past inode
+// return 1 for success
+int inline_to_block(int inode_index) {
+    struct inode *in = &inodes[inode_index];
+    unsigned char content[INLINE_DATA_LEN];
+    memcpy(content, in->inline_data, INLINE_DATA_LEN);
+
+    // block pointers (or extents) take the place of content
+    memset(in->inline_data, 0, INLINE_DATA_LEN);
+    int block = bmap(inode_index, 0, 1);
+    if (block == -1) {
+        truncate_blocks(inode_index, 0);
+        memcpy(in->inline_data, content, INLINE_DATA_LEN);
+        return 0;
+    }
+    in->crtBLocks = 1;
+
+    memmove(get_block(block), content, in->file_size);
+    mark_dirty(block);
+    put_block(block);
+    return 1;
+}
+
+
+/*****************************************************************/
+// copy "len" bytes from "offset" of a file, one run of contiguous blocks at a time
+// return number of copied bytes (less at the end of file) or -1 for error
+int read_data(int inode_index, int offset, void *buf, int len) {
+    unsigned char *dst = (unsigned char *)buf;
+    if (offset < 0 || len < 0) return -1;
+
+    data_iter it;
+    unsigned char *piece;
+    int piece_len;
+    data_iter_start(&it, inode_index, offset, len);
+    while ((piece = data_iter_next(&it, &piece_len)) != NULL) {
+        memmove(dst, piece, piece_len);
+        dst += piece_len;
+    }
+    if (it.error) {
+        data_iter_end(&it);
+        return -1;
+    }
+    return dst - (unsigned char *)buf;
+}
+
+
+/*****************************************************************/
+// prepare to walk "len" bytes from "offset" of a file
+void data_iter_start(data_iter *it, int inode_index, int offset, int len) {
+    int size = inodes[inode_index].file_size;
+    it->inode_index = inode_index;
+    it->held = -1;
+    it->error = 0;
+    it->pos = (offset < size) ? offset : size;
+    it->end = (len > size - it->pos) ? size : it->pos + len;
+}
+
+
+/*****************************************************************/
+// return a pointer to the next piece of the range, straight into disk blocks,
+// and its length in "len"; a piece covers a run of contiguous blocks of a mapped
+// disk, or one cached block, valid until the next call
+// return NULL at the end of range
+unsigned char *data_iter_next(data_iter *it, int *len) {
+    data_iter_end(it);
+    if (it->pos >= it->end) return NULL;
+
+    // inline content is all in one piece, without reading a block
+    if (is_inline(it->inode_index)) {
+        *len = it->end - it->pos;
+        it->pos = it->end;
+        return inodes[it->inode_index].inline_data + it->pos - *len;
+    }
+
+    int run;
+    read_ahead(it->inode_index, it->pos / sb.block_size);
+    int block = bmap_run(it->inode_index, it->pos / sb.block_size, &run);
+    if (block == -1) return NULL;
+    if (!use_mmap) run = 1;
+
+    int in_block = it->pos % sb.block_size;
+    *len = run * sb.block_size - in_block;
+    if (*len > it->end - it->pos) *len = it->end - it->pos;
+
+    it->pos += *len;
+    it->held = block;
+    unsigned char *data = get_block(block);
+    if (block_is_bad(block)) {
+        it->error = 1;
+        it->pos = it->end;
+        return NULL;
+    }
+    return data + in_block;
+}
+
+
+/*****************************************************************/
+// let the cache replace the block of the last piece
+void data_iter_end(data_iter *it) {
+    if (it->held != -1) {
+        put_block(it->held);
+        it->held = -1;
+    }
+}
+
+
+/*****************************************************************/
+// write "len" bytes after the end of a file
+// return number of written bytes or -1 for error
+int append_data(int inode_index, void *buf, int len) {
+    return write_data(inode_index, inodes[inode_index].file_size, buf, len);
+}
+
+
+/*****************************************************************/
+// verify if a file (disk) contains data from a precedent writing
+// return 1 if file is empty
+int file_is_empty(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+
+    fclose(f);
+    return (size == 0);
+}
+
+
+/*****************************************************************/
+// set a specific bit to 0 or 1
+// return 1 for success, 0 error
+int set_bit_to_value(unsigned char *arr, int nr_bit, int arr_len_in_bytes, int value) {
+    // verify if bit can be set
+    if ((nr_bit < 0 || nr_bit >= arr_len_in_bytes * BYTE_LEN)|| 
+    (value != 0 && value != 1)) {
+        return 0;
+    }
+
+    int pos = nr_bit / BYTE_LEN;        // find position of byte
+    nr_bit = nr_bit % BYTE_LEN;         // find position of bit within byte
+    switch (value) {
+        case 1:
+            arr[pos] |= (1 << nr_bit);  // set to 1
+        break;
+        case 0:
+            arr[pos] &= ~(1 << nr_bit); // set to 0
+        break;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// find value of a specific bit from an array
+// return 0/1, or -1 for error
+int find_bit_value(unsigned char* arr, int pos, int size) {
+    // position should be valid
+    if (pos < 0 || pos >= size * BYTE_LEN) return -1;
+
+    // bits of a byte may be changed by other threads, the byte is read at once
+    int index = pos / BYTE_LEN;
+    int offset = pos % BYTE_LEN;
+    if ((__atomic_load_n(&arr[index], __ATOMIC_RELAXED) & (1 << offset)) == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+
+/* if size of a file/directory is modified, update disk, bitmap of blocks and inode fields that manage memory.
+Can be used to delete blocks, add  blocks, but another changes as delete inode, add inode,
+update bm of inodes etc, should be changed manually */
+int update_memory(void *a, int size, int inode_index) {
+    unsigned char *arr = (unsigned char *)a;
+    // calculate all blocks that we need
+    int requiredBlocks = (size + sb.block_size - 1) / sb.block_size;
+
+    if (requiredBlocks > MAX_FILE_BLOCKS) return 0;
+
+    // inode must be in use
+    if (!find_bit_value(bm.inode_map, inode_index, INODE_MAP_LEN)) return 0;
+    int usedBlocks = inodes[inode_index].crtBLocks;
+
+    // a small file keeps its content in inode and gives back its blocks
+    if ((sb.features & FEATURE_INLINE_DATA) && inodes[inode_index].file_type == 0 &&
+        size <= INLINE_DATA_LEN) {
+        if (usedBlocks > 0) truncate_blocks(inode_index, 0);
+        memset(inodes[inode_index].inline_data, 0, INLINE_DATA_LEN);
+        if (size > 0) memmove(inodes[inode_index].inline_data, arr, size);
+        inodes[inode_index].crtBLocks = 0;
+        inodes[inode_index].file_size = size;
+        return 1;
+    }
+
+    if (__atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED) < requiredBlocks - usedBlocks) return 0;
+
+    // with extents, new blocks are taken as few long runs
+    if ((sb.features & FEATURE_EXTENTS) && requiredBlocks > usedBlocks &&
+        !extent_alloc(inode_index, usedBlocks, requiredBlocks - usedBlocks)) {
+        truncate_blocks(inode_index, usedBlocks);
+        return 0;
+    }
+
+    // write data to the old blocks and allocate new blocks (and blocks of pointers) if necessary
+    for (int i = 0; i < requiredBlocks; ) {
+        int run;
+        int block = bmap(inode_index, i, 1);
+        if (block == -1) {
+            truncate_blocks(inode_index, usedBlocks);
+            return 0;
+        }
+        bmap_run(inode_index, i, &run);
+        if (run > requiredBlocks - i) run = requiredBlocks - i;
+
+        // the last block is copied partially, its rest is cleared
+        for (int j = 0; j < run; j++, i++) {
+            int copy_size = (size - sb.block_size * i < sb.block_size) ? size - sb.block_size * i : sb.block_size;
+            unsigned char *data = get_block(block + j);
+            memmove(data, arr + (long)sb.block_size * i, copy_size);
+            memset(data + copy_size, 0, sb.block_size - copy_size);
+            mark_dirty(block + j);
+            put_block(block + j);
+        }
+    }
+
+    // if necessary, delete blocks
+    truncate_blocks(inode_index, requiredBlocks);
+
+    inodes[inode_index].crtBLocks = requiredBlocks;
+    inodes[inode_index].file_size = size;
+
+    return 1;
+
+}
+
+
+/*****************************************************************/
+// take a free inode: a file stays in the group of "parent_inode",
+// a directory goes in a group with many free inodes and blocks;
+// every group is searched under its own lock, so threads allocate in parallel
+// return index or -1 for error
+int alloc_inode(int parent_inode, int is_dir) {
+    if (__atomic_load_n(&sb.free_nodes, __ATOMIC_RELAXED) == 0) return -1;
+
+    int first = is_dir ? find_group_dir() : parent_inode / sb.inodes_per_group;
+    for (int i = 0; i < sb.group_count; i++) {
+        int g = (first + i) % sb.group_count;
+        if (__atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED) == 0) continue;
+
+        pthread_mutex_lock(&group_locks[g]);
+        int nr = next_bit(&inode_alloc, g * sb.inodes_per_group, (g + 1) * sb.inodes_per_group, 0);
+        if (nr != -1) {
+            mark_inode(nr, 1);
+            __atomic_fetch_sub(&sb.free_nodes, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&group_locks[g]);
+        if (nr != -1) return nr;
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+// give an inode back to its group
+void free_inode(int nr) {
+    int g = nr / sb.inodes_per_group;
+    pthread_mutex_lock(&group_locks[g]);
+    mark_inode(nr, 0);
+    __atomic_fetch_add(&sb.free_nodes, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&group_locks[g]);
+}
+
+
+/*****************************************************************/
+// choose the group of a new directory, like ext2: from groups with at least
+// the average of free inodes, the one with most free blocks
+// return index of group
+int find_group_dir() {
+    // counters change under other threads, a snapshot is enough to choose
+    long free_inodes = 0;
+    for (int g = 0; g < sb.group_count; g++) {
+        free_inodes += __atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED);
+    }
+    long average = free_inodes / sb.group_count;
+
+    int best = 0;
+    int best_inodes = __atomic_load_n(&groups[0].free_inodes, __ATOMIC_RELAXED);
+    int best_blocks = __atomic_load_n(&groups[0].free_blocks, __ATOMIC_RELAXED);
+    for (int g = 0; g < sb.group_count; g++) {
+        int inodes_left = __atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED);
+        int blocks_left = __atomic_load_n(&groups[g].free_blocks, __ATOMIC_RELAXED);
+        if (inodes_left == 0 || inodes_left < average) continue;
+        if (best_inodes == 0 || best_inodes < average || blocks_left > best_blocks) {
+            best = g;
+            best_inodes = inodes_left;
+            best_blocks = blocks_left;
+        }
+    }
+    return best;
+}
+
+
+/*****************************************************************/
+// take the first "count" contiguous free blocks: from "goal" to the end of its group,
+// then in the next groups, and at last in the start of the group of "goal";
+// every group is searched under its own lock, so threads allocate in parallel
+// return index or -1 if there s no such run
+int alloc_run(int count, int goal) {
+    if (count <= 0 || __atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED) < count) return -1;
+    if (goal < 0 || goal >= sb.total_blocks) goal = 0;
+
+    // a run never crosses the end of a group, so the lock of its group is enough
+    int first = goal / sb.blocks_per_group;
+    for (int i = 0; i <= sb.group_count; i++) {
+        int g = (first + i) % sb.group_count;
+        if (__atomic_load_n(&groups[g].free_blocks, __ATOMIC_RELAXED) < count) continue;
+
+        int from = (i == 0) ? goal : g * sb.blocks_per_group;
+        int to = (i == sb.group_count) ? goal : group_end(g);
+        int pos = from;
+        pthread_mutex_lock(&group_locks[g]);
+        while (pos < to) {
+            int start = next_bit(&block_alloc, pos, to, 0);
+            if (start == -1) break;
+
+            // only the first "count" bits after "start" matter
+            int limit = (to - start > count) ? start + count : to;
+            int end = next_bit(&block_alloc, start, limit, 1);
+            if (end == -1) end = limit;
+
+            if (end - start >= count) {
+                for (int b = start; b < start + count; b++) {
+                    mark_block(b, 1);
+                }
+                __atomic_fetch_sub(&sb.free_blocks, count, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&group_locks[g]);
+                return start;
+            }
+            pos = end;
+        }
+        pthread_mutex_unlock(&group_locks[g]);
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+// take "block" if it s free, to grow a run in place
+// return 1 for success
+int take_block(int block) {
+    int g = block / sb.blocks_per_group;
+    pthread_mutex_lock(&group_locks[g]);
+    int is_free = (find_bit_value(bm.block_map, block, BLOCK_MAP_LEN) == 0);
+    if (is_free) {
+        mark_block(block, 1);
+        __atomic_fetch_sub(&sb.free_blocks, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&group_locks[g]);
+    return is_free;
+}
+
+
+/*****************************************************************/
+// block where the search for a new block of an inode starts: after the last block
+// allocated for it, or at the first data block of its group
+int block_goal(int inode_index) {
+    int goal = bmap_cache[inode_index].goal;
+    if (goal > 0 && goal < sb.total_blocks) return goal;
+    return group_data_start(inode_index / sb.inodes_per_group);
+}
+
+
+/*****************************************************************/
+// set the bit of a block and keep summaries up to date, under the lock of its group
+void mark_block(int nr, int value) {
+    if (mark_bit(&block_alloc, nr, value)) {
+        __atomic_fetch_add(&groups[nr / sb.blocks_per_group].free_blocks, value ? -1 : 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************/
+// set the bit of an inode and keep summaries up to date, under the lock of its group
+void mark_inode(int nr, int value) {
+    if (mark_bit(&inode_alloc, nr, value)) {
+        __atomic_fetch_add(&groups[nr / sb.inodes_per_group].free_inodes, value ? -1 : 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************/
+// set a bit of an allocator map, counting it in its region if it changed
+// return 1 if the bit changed
+int mark_bit(bitmap_allocator *a, int nr, int value) {
+    if (nr < 0 || nr >= a->nr_bits) return 0;
+
+    // threads may change other bits of the same byte, or this one too
+    unsigned char bit = 1 << (nr % BYTE_LEN);
+    unsigned char old = value ? __atomic_fetch_or(&a->map[nr / BYTE_LEN], bit, __ATOMIC_RELAXED) :
+                                __atomic_fetch_and(&a->map[nr / BYTE_LEN], (unsigned char)~bit, __ATOMIC_RELAXED);
+    if (((old & bit) != 0) == value) return 0;
+
+    __atomic_fetch_add(&a->region_free[nr / REGION_BITS], value ? -1 : 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+
+/*****************************************************************/
+// count free bits of every region after the map was loaded or reset
+void allocator_init(bitmap_allocator *a) {
+    int regions = (a->nr_bits + REGION_BITS - 1) / REGION_BITS;
+    for (int r = 0; r < regions; r++) {
+        a->region_free[r] = 0;
+    }
+    for (int i = 0; i < a->nr_bits; i++) {
+        if (find_bit_value(a->map, i, a->nr_bits / BYTE_LEN) == 0) {
+            a->region_free[i / REGION_BITS]++;
+        }
+    }
+    a->cursor = 0;
+}
+
+
+/*****************************************************************/
+// read WORD_LEN bits of a map starting with bit "word * WORD_LEN"; bit i of the word is bit i of the map
+uint64_t load_word(unsigned char *map, int word) {
+    uint64_t value = 0;
+    unsigned char *bytes = map + word * (WORD_LEN / BYTE_LEN);
+    for (int i = 0; i < WORD_LEN / BYTE_LEN; i++) {
+        value |= (uint64_t)__atomic_load_n(&bytes[i], __ATOMIC_RELAXED) << (i * BYTE_LEN);
+    }
+    return value;
+}
+
+
+/*****************************************************************/
+// find first bit equal to "value" from [from, to), a word at a time
+// regions without free bits are skipped when looking for 0
+// return index or -1 if there s no such bit
+int next_bit(bitmap_allocator *a, int from, int to, int value) {
+    if (to > a->nr_bits) to = a->nr_bits;
+    int words = a->nr_bits / WORD_LEN;
+
+    while (from < to) {
+        // whole region is used
+        if (value == 0 && from % REGION_BITS == 0 &&
+            __atomic_load_n(&a->region_free[from / REGION_BITS], __ATOMIC_RELAXED) == 0) {
+            from += REGION_BITS;
+            continue;
+        }
+
+        int word = from / WORD_LEN;
+        uint64_t bits;
+        if (word < words) {
+            bits = load_word(a->map, word);
+        } else {
+            // last bits of a map that isn t a multiple of WORD_LEN
+            bits = 0;
+            for (int i = word * WORD_LEN; i < a->nr_bits; i++) {
+                bits |= (uint64_t)find_bit_value(a->map, i, a->nr_bits / BYTE_LEN) << (i % WORD_LEN);
+            }
+        }
+
+        // looking for 0 is looking for 1 in the inverted word
+        if (value == 0) bits = ~bits;
+
+        // ignore bits before "from"
+        bits &= ~(uint64_t)0 << (from % WORD_LEN);
+
+        if (bits != 0) {
+            int nr = word * WORD_LEN + __builtin_ctzll(bits);
+            return (nr < to) ? nr : -1;
+        }
+        from = (word + 1) * WORD_LEN;
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+//this function returns inode of specified path
+//returns -2 if path is correct, but the last element isn t 
+//returns -1 if path is wrong
+//directories are walked without locks; the one of the last name is locked with "lock"
+//(unless NO_LOCK) and stays locked if -1 isn t returned, "parent_inode" is -1 if path
+//doesn t have names
+int find_inode_of_path(unsigned char *path, int crt_inode, int *parent_inode, unsigned char **last_file_name, int lock) {
+    if (path == NULL) return -1;
+
+    // verify if it s absolute path
+    if (path[0] == '/') { 
+        crt_inode = ROOT_INODE_INDEX;
+    }
+
+    if (parent_inode != NULL) {
+        *parent_inode = -1;
+    }
+
+    // names are used in place, as start and length inside path; only the one where
+    // the walk stops is copied for the caller
+    const char *token = (const char *)path + strspn((const char *)path, "/");
+    int token_len = strcspn(token, "/");
+    const char *stop = NULL;
+    int stop_len = 0;
+
+    int is_file = 0;
+
+    while (token_len > 0) {
+        const char *next = token + token_len;
+        next += strspn(next, "/");
+        int next_len = strcspn(next, "/");
+        int last = (next_len == 0);
+
+        stop = token;
+        stop_len = token_len;
+
+        // a name too long, a path that continues after a file, or a previous name
+        // that doesn t exist make the path wrong
+        if (token_len > MAX_FILE_NAME || is_file == 1 || crt_inode < 0) {
+            crt_inode = -1;
+            break;
+        }
+
+        // start_inode will be changed below
+        if (parent_inode != NULL) {
+            *parent_inode = crt_inode;
+        }
+
+        // the last name is looked up under the lock that the caller keeps
+        int locked = (last && lock != NO_LOCK);
+        if (locked) {
+            lock_inode(crt_inode, lock);
+        }
+
+        // try the dentry cache before reading the directory
+        int cached = (!locked || inode_in_use(crt_inode)) ? dcache_lookup(crt_inode, token, token_len) : -1;
+        if (cached >= 0) {
+            crt_inode = cached;
+            if (inode_type(cached) == 0) {
+                is_file = 1;
+            }
+            token = next;
+            token_len = next_len;
+            continue;
+        }
+
+        // find file/dir under the lock of directory: a directory removed meanwhile has
+        // no names, and a name is cached under this lock, so not after it was removed
+        if (!locked) {
+            lock_inode(crt_inode, READ_LOCK);
+        }
+        int is_dir = inode_in_use(crt_inode) && inode_type(crt_inode) == 1;
+        int found = is_dir ? dir_lookup(crt_inode, token, token_len) : -1;
+        if (found >= 0) {
+            dcache_insert(crt_inode, token, token_len, found);
+        }
+        if (!locked || !is_dir) {
+            unlock_inode(crt_inode);
+        }
+
+        // if directory doesn t exist, path is wrong
+        if (!is_dir) {
+            crt_inode = -1;
+            break;
+        }
+
+        if (found >= 0) {
+            crt_inode = found;
+
+            if (inode_type(found) == 0) {
+                is_file = 1;
+            }
+        } else {
+            // if -2 is returned, we know that last file/directory from path does n exist
+            crt_inode = -2;
+        }
+        token = next;
+        token_len = next_len;
+    }
+
+    // copy last name from path
+    if (last_file_name != NULL && stop != NULL) {
+        free(*last_file_name);
+        *last_file_name = (unsigned char *)strndup(stop, stop_len);
+    }
+    // will return necessary inode
+    return crt_inode;
+}
+
+
+/*****************************************************************/
+// hash a name with FNV-1a
+unsigned int name_hash(const char *name, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/*****************************************************************/
+// hash a (directory inode, name) pair to a slot of dentry cache
+unsigned int dcache_hash(int parent_inode, const char *name, int len) {
+    unsigned int hash = name_hash(name, len) ^ ((unsigned int)parent_inode * 2654435761u);
+    return hash & (DCACHE_SIZE - 1);
+}
+
+
+/*****************************************************************/
+// find the inode of "name" from directory "parent_inode" without reading the directory;
+// the slot is copied without locks and copied again if a writer changed it meanwhile
+// return inode or -1 if name isn t cached
+int dcache_lookup(int parent_inode, const char *name, int len) {
+    dentry *d = &dcache.slots[dcache_hash(parent_inode, name, len)];
+    unsigned seq;
+    int found;
+    do {
+        seq = __atomic_load_n(&d->seq, __ATOMIC_ACQUIRE);
+        found = -1;
+        if (__atomic_load_n(&d->valid, __ATOMIC_RELAXED) &&
+            __atomic_load_n(&d->parent_inode, __ATOMIC_RELAXED) == parent_inode) {
+            int i = 0;
+            while (i < len && __atomic_load_n(&d->name[i], __ATOMIC_RELAXED) == name[i]) {
+                i++;
+            }
+            if (i == len && __atomic_load_n(&d->name[i], __ATOMIC_RELAXED) == '\0') {
+                found = __atomic_load_n(&d->inode_index, __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&d->seq, __ATOMIC_RELAXED) != seq);
+
+    __atomic_fetch_add(found >= 0 ? &dcache.hits : &dcache.misses, 1, __ATOMIC_RELAXED);
+    return found;
+}
+
+
+/*****************************************************************/
+// change a slot while readers may copy it: "seq" is odd until the change is visible
+void dcache_write(dentry *d, int valid, int parent_inode, const char *name, int len, int inode_index) {
+    __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&d->valid, valid, __ATOMIC_RELAXED);
+    if (valid) {
+        __atomic_store_n(&d->parent_inode, parent_inode, __ATOMIC_RELAXED);
+        __atomic_store_n(&d->inode_index, inode_index, __ATOMIC_RELAXED);
+        for (int i = 0; i < len; i++) {
+            __atomic_store_n(&d->name[i], name[i], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&d->name[len], '\0', __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/*****************************************************************/
+// remember a name; an older entry with the same slot is replaced
+void dcache_insert(int parent_inode, const char *name, int len, int inode_index) {
+    if (len > MAX_FILE_NAME) return;
+
+    dentry *d = &dcache.slots[dcache_hash(parent_inode, name, len)];
+    pthread_mutex_lock(&dcache.lock);
+    dcache_write(d, 1, parent_inode, name, len, inode_index);
+    pthread_mutex_unlock(&dcache.lock);
+}
+
+
+/*****************************************************************/
+// forget a name after it was removed from its directory
+void dcache_remove(int parent_inode, const char *name) {
+    dentry *d = &dcache.slots[dcache_hash(parent_inode, name, strlen(name))];
+    pthread_mutex_lock(&dcache.lock);
+    if (d->valid && d->parent_inode == parent_inode && !strcmp(d->name, name)) {
+        dcache_write(d, 0, 0, NULL, 0, 0);
+    }
+    pthread_mutex_unlock(&dcache.lock);
+}
+
+
+/*****************************************************************/
+// return the block that keeps the logical block "nr" of an inode
+// return NULL if inode doesn t have this block
+unsigned char *inode_block(int inode_index, int nr) {
+    if (nr < 0 || nr >= inodes[inode_index].crtBLocks) return NULL;
+    return disk_block(bmap(inode_index, nr, 0));
+}
+
+
+/*****************************************************************/
+// allocate a zeroed block at the end of an inode
+// return logical number of the new block or -1 for error
+int append_block(int inode_index) {
+    int nr = inodes[inode_index].crtBLocks;
+    if (nr >= MAX_FILE_BLOCKS) return -1;
+
+    if (bmap(inode_index, nr, 1) == -1) {
+        truncate_blocks(inode_index, nr);
+        return -1;
+    }
+
+    inodes[inode_index].crtBLocks = nr + 1;
+    inodes[inode_index].file_size = (nr + 1) * sb.block_size;
+    return nr;
+}
+
+
+/*****************************************************************/
+// take a free block for an inode from disk and clear it
+// return index or -1 if disk is full
+int alloc_block(int inode_index) {
+    int block = alloc_run(1, block_goal(inode_index));
+    if (block == -1) return -1;
+
+    clear_block(block);
+    bmap_cache[inode_index].goal = block + 1;
+    return block;
+}
+
+
+/*****************************************************************/
+// fill with zeroes a block taken from disk
+void clear_block(int block) {
+    get_zero_block(block);
+    mark_dirty(block);
+    put_block(block);
+}
+
+
+/*****************************************************************/
+// give a block back to disk; with journal, the block stays taken until the next sync,
+// so it can t get new content before the transaction that frees it is committed
+void release_block(int block) {
+    if (!use_mmap && (sb.features & FEATURE_JOURNAL)) {
+        mark_bit(&freed_blocks, block, 1);
+        return;
+    }
+
+    int g = block / sb.blocks_per_group;
+    pthread_mutex_lock(&group_locks[g]);
+    mark_block(block, 0);
+    __atomic_fetch_add(&sb.free_blocks, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&group_locks[g]);
+}
+
+
+/*****************************************************************/
+// give back the blocks freed since the last commit, before the bitmaps are stored;
+// the caller holds the filesystem lock exclusively, so nothing takes them before the commit.
+// their old content is not written anymore
+void release_freed_blocks() {
+    int pos = 0;
+    int block;
+    while ((block = next_bit(&freed_blocks, pos, sb.total_blocks, 1)) != -1) {
+        mark_bit(&freed_blocks, block, 0);
+        clear_dirty(block, block + 1);
+
+        // fsck may have marked it free already
+        int g = block / sb.blocks_per_group;
+        pthread_mutex_lock(&group_locks[g]);
+        if (find_bit_value(bm.block_map, block, BLOCK_MAP_LEN) == 1) {
+            mark_block(block, 0);
+            __atomic_fetch_add(&sb.free_blocks, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&group_locks[g]);
+        pos = block + 1;
+    }
+}
+
+
+/*****************************************************************/
+// find the block that keeps logical block "nr" of an inode, like ext2:
+// 12 direct blocks, then single, double and triple indirect blocks.
+// if "alloc" is 1, missing blocks (data or pointers) are allocated
+// return index of block or -1
+int bmap(int inode_index, int nr, int alloc) {
+    struct inode *in = &inodes[inode_index];
+    if (nr < 0 || nr >= MAX_FILE_BLOCKS) return -1;
+
+    if (sb.features & FEATURE_EXTENTS) {
+        return extent_bmap(inode_index, nr, alloc);
+    }
+
+    if (nr < MAX_DIRECT_BLOCKS) {
+        if (in->direct_blocks[nr] == 0 && alloc) {
+            int block = alloc_block(inode_index);
+            if (block == -1) return -1;
+            in->direct_blocks[nr] = block;
+        }
+        return in->direct_blocks[nr] ? in->direct_blocks[nr] : -1;
+    }
+
+    // the last block of pointers used by this inode may already map "nr"
+    leaf_hint hint;
+    __atomic_load(&bmap_cache[inode_index].hint, &hint, __ATOMIC_RELAXED);
+    int *slot;
+    int slot_block = 0;     // block that keeps "slot", 0 if it s in inode
+    if (hint.leaf != 0 && nr >= hint.base && nr < hint.base + PTRS_PER_BLOCK) {
+        __atomic_fetch_add(&bmap_hits, 1, __ATOMIC_RELAXED);
+        slot_block = hint.leaf;
+        slot = (int *)disk_block(hint.leaf) + (nr - hint.base);
+    } else {
+        __atomic_fetch_add(&bmap_misses, 1, __ATOMIC_RELAXED);
+
+        // find the level of indirection of "nr"
+        long long rest = nr - MAX_DIRECT_BLOCKS;
+        long long span = PTRS_PER_BLOCK;
+        int level = 0;
+        while (rest >= span) {
+            rest -= span;
+            span *= PTRS_PER_BLOCK;
+            level++;
+        }
+
+        // go down from the indirect block of inode to the block that points to data
+        slot = &in->indirect_blocks[level];
+        for (int depth = level; depth >= 0; depth--) {
+            if (*slot == 0) {
+                if (!alloc) return -1;
+                int block = alloc_block(inode_index);
+                if (block == -1) return -1;
+                *slot = block;
+                if (slot_block) mark_meta_dirty(slot_block);
+            }
+            span /= PTRS_PER_BLOCK;
+            int index = rest / span;
+            rest %= span;
+
+            if (depth == 0) {
+                hint = (leaf_hint){nr - index, *slot};
+                __atomic_store(&bmap_cache[inode_index].hint, &hint, __ATOMIC_RELAXED);
+            }
+            slot_block = *slot;
+            slot = (int *)disk_block(*slot) + index;
+        }
+    }
+
+    if (*slot == 0 && alloc) {
+        int block = alloc_block(inode_index);
+        if (block == -1) return -1;
+        *slot = block;
+        mark_meta_dirty(slot_block);
+    }
+    return *slot ? *slot : -1;
+}
+
+
+/*****************************************************************/
+// free all blocks of an inode starting with logical block "keep",
+// and blocks of pointers that don t point to anything anymore
+void truncate_blocks(int inode_index, int keep) {
+    struct inode *in = &inodes[inode_index];
+
+    if (sb.features & FEATURE_EXTENTS) {
+        extent_truncate(inode_index, keep);
+        return;
+    }
+
+    for (int i = keep; i < MAX_DIRECT_BLOCKS; i++) {
+        if (in->direct_blocks[i] != 0) {
+            release_block(in->direct_blocks[i]);
+            in->direct_blocks[i] = 0;
+        }
+    }
+
+    long long first = MAX_DIRECT_BLOCKS;
+    long long span = PTRS_PER_BLOCK;
+    for (int level = 0; level < INDIRECT_LEVELS; level++) {
+        free_tree(&in->indirect_blocks[level], level, first, keep);
+        first += span;
+        span *= PTRS_PER_BLOCK;
+    }
+
+    leaf_hint none = {0, 0};
+    __atomic_store(&bmap_cache[inode_index].hint, &none, __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// free what a block of pointers maps from logical block "keep" on;
+// "first" is the first logical block it maps, "depth" is 0 if it points to data.
+// the block itself is freed if it maps only blocks after "keep"
+void free_tree(int *slot, int depth, long long first, long long keep) {
+    if (*slot == 0) return;
+
+    long long span = 1;     // logical blocks mapped by one pointer
+    for (int i = 0; i < depth; i++) {
+        span *= PTRS_PER_BLOCK;
+    }
+
+    int *ptrs = (int *)disk_block(*slot);
+    for (int i = 0; i < PTRS_PER_BLOCK; i++) {
+        long long child_first = first + i * span;
+        if (child_first + span <= keep || ptrs[i] == 0) continue;
+
+        if (depth == 0) {
+            release_block(ptrs[i]);
+            ptrs[i] = 0;
+            mark_meta_dirty(*slot);
+        } else {
+            free_tree(&ptrs[i], depth - 1, child_first, keep);
+            mark_meta_dirty(*slot);
+        }
+    }
+
+    if (first >= keep) {
+        release_block(*slot);
+        *slot = 0;
+    }
+}
+
+
+/*****************************************************************/
+// find the block of logical block "nr" and how many blocks after it follow on disk
+// return index of block or -1; "run" is at least 1
+int bmap_run(int inode_index, int nr, int *run) {
+    *run = 1;
+    if (!(sb.features & FEATURE_EXTENTS)) {
+        return bmap(inode_index, nr, 0);
+    }
+
+    extent *e = find_extent(inode_index, nr);
+    if (e == NULL) return -1;
+
+    *run = e->logical + e->length - nr;
+    return e->start + (nr - e->logical);
+}
+
+
+/*****************************************************************/
+// find the extent that maps logical block "nr"
+// return the extent or NULL
+extent *find_extent(int inode_index, int nr) {
+    extent_root *root = &inodes[inode_index].extents;
+    if (root->count == 0) return NULL;
+
+    extent *list = root->entries;
+    int count = root->count;
+
+    // choose the node that maps "nr" on every level
+    for (int level = 0; level < root->depth; level++) {
+        int i = extent_search(list, count, nr);
+        extent_leaf *node = (extent_leaf *)disk_block(list[(i == -1) ? 0 : i].start);
+        list = node->entries;
+        count = node->count;
+    }
+
+    int found = extent_search(list, count, nr);
+    if (found == -1 || nr >= list[found].logical + list[found].length) return NULL;
+    return &list[found];
+}
+
+
+/*****************************************************************/
+// entries are sorted, look for the last one of "count" starting before "nr"
+// return its index or -1
+int extent_search(extent *list, int count, int nr) {
+    int low = 0, high = count - 1, found = -1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (list[mid].logical <= nr) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+
+/*****************************************************************/
+// return the extent that maps the end of file or NULL
+extent *last_extent(int inode_index) {
+    extent_root *root = &inodes[inode_index].extents;
+    if (root->count == 0) return NULL;
+
+    extent_leaf *nodes[EXTENT_MAX_DEPTH + 1];
+    int depth = extent_path(inode_index, NULL, nodes);
+    if (depth == 0) return &root->entries[root->count - 1];
+    return &nodes[depth]->entries[nodes[depth]->count - 1];
+}
+
+
+/*****************************************************************/
+// follow the last entries from root down to the last leaf; "blocks" (if not NULL)
+// and "nodes" get the node of every level, from 1 below root to the leaf
+// return depth of the tree
+int extent_path(int inode_index, int *blocks, extent_leaf **nodes) {
+    extent_root *root = &inodes[inode_index].extents;
+    extent *list = root->entries;
+    int count = root->count;
+
+    for (int level = 1; level <= root->depth; level++) {
+        int block = list[count - 1].start;
+        nodes[level] = (extent_leaf *)disk_block(block);
+        if (blocks != NULL) blocks[level] = block;
+        list = nodes[level]->entries;
+        count = nodes[level]->count;
+    }
+    return root->depth;
+}
+
+
+/*****************************************************************/
+// add an extent after the last one, or make the last one longer when the run follows
+// it on disk; the lowest node with room on the way to the last leaf takes the entry,
+// with new nodes below it down to a new leaf
+// return 1 for success
+int add_extent(int inode_index, int logical, int start, int length) {
+    extent_root *root = &inodes[inode_index].extents;
+
+    extent *last = last_extent(inode_index);
+    if (last != NULL && last->logical + last->length == logical && last->start + last->length == start) {
+        last->length += length;
+        dirty_last_leaf(inode_index);
+        return 1;
+    }
+
+    int blocks[EXTENT_MAX_DEPTH + 1];
+    extent_leaf *nodes[EXTENT_MAX_DEPTH + 1];
+    int level;
+    while (1) {
+        int depth = extent_path(inode_index, blocks, nodes);
+        level = depth;
+        while (level > 0 && nodes[level]->count == EXTENTS_PER_LEAF) level--;
+        if (level > 0 || root->count < EXTENTS_IN_INODE) break;
+        if (!extent_grow(inode_index)) return 0;
+    }
+
+    // new nodes from the leaf up, every one with a single entry
+    extent entry = {logical, start, length};
+    int taken[EXTENT_MAX_DEPTH];
+    int count = 0;
+    for (int l = root->depth; l > level; l--) {
+        int block = alloc_block(inode_index);
+        if (block == -1) {
+            while (count > 0) release_block(taken[--count]);
+            return 0;
+        }
+        taken[count++] = block;
+
+        extent_leaf *node = (extent_leaf *)disk_block(block);
+        node->count = 1;
+        node->entries[0] = entry;
+        mark_meta_dirty(block);
+        entry = (extent){logical, block, 0};
+    }
+
+    if (level == 0) {
+        root->entries[root->count++] = entry;
+    } else {
+        nodes[level]->entries[nodes[level]->count++] = entry;
+        mark_meta_dirty(blocks[level]);
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// move the entries of a full root to a new node below it
+// return 1 for success, 0 if the tree can t be deeper or there is no free block
+int extent_grow(int inode_index) {
+    extent_root *root = &inodes[inode_index].extents;
+    if (root->depth == EXTENT_MAX_DEPTH) return 0;
+
+    int block = alloc_block(inode_index);
+    if (block == -1) return 0;
+
+    extent_leaf *node = (extent_leaf *)disk_block(block);
+    memcpy(node->entries, root->entries, sizeof(root->entries));
+    node->count = root->count;
+    mark_meta_dirty(block);
+
+    memset(root->entries, 0, sizeof(root->entries));
+    root->depth++;
+    root->count = 1;
+    root->entries[0] = (extent){node->entries[0].logical, block, 0};
+    return 1;
+}
+
+
+/*****************************************************************/
+// forget the last extent, freeing the nodes it leaves empty
+void remove_last_extent(int inode_index) {
+    extent_root *root = &inodes[inode_index].extents;
+    if (root->count == 0) return;
+
+    int blocks[EXTENT_MAX_DEPTH + 1];
+    extent_leaf *nodes[EXTENT_MAX_DEPTH + 1];
+    for (int level = extent_path(inode_index, blocks, nodes); level > 0; level--) {
+        mark_meta_dirty(blocks[level]);
+        if (--nodes[level]->count > 0) return;
+        release_block(blocks[level]);
+    }
+
+    root->count--;
+    if (root->count == 0) root->depth = 0;
+}
+
+
+/*****************************************************************/
+// map logical blocks [nr, nr + count) at the end of file to as few runs as possible:
+// first grow the last extent in place, then take the longest free runs
+// return 1 for success
+int extent_alloc(int inode_index, int nr, int count) {
+    while (count > 0) {
+        extent *last = last_extent(inode_index);
+        if (last != NULL && last->logical + last->length == nr) {
+            int next = last->start + last->length;
+            while (count > 0 && next < sb.total_blocks && take_block(next)) {
+                clear_block(next++);
+                last->length++;
+                nr++;
+                count--;
+            }
+            dirty_last_leaf(inode_index);
+            if (count == 0) break;
+        }
+
+        // halve the run until one fits
+        int length = count;
+        int start;
+        while ((start = alloc_run(length, block_goal(inode_index))) == -1 && length > 1) {
+            length /= 2;
+        }
+        if (start == -1) return 0;
+        bmap_cache[inode_index].goal = start + length;
+
+        for (int i = 0; i < length; i++) {
+            clear_block(start + i);
+        }
+        if (!add_extent(inode_index, nr, start, length)) {
+            for (int i = 0; i < length; i++) {
+                release_block(start + i);
+            }
+            return 0;
+        }
+        nr += length;
+        count -= length;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// bmap for disks with FEATURE_EXTENTS
+int extent_bmap(int inode_index, int nr, int alloc) {
+    extent *e = find_extent(inode_index, nr);
+    if (e == NULL) {
+        if (!alloc || !extent_alloc(inode_index, nr, 1)) return -1;
+        e = find_extent(inode_index, nr);
+    }
+    return e->start + (nr - e->logical);
+}
+
+
+/*****************************************************************/
+// free all blocks mapped from logical block "keep" on
+void extent_truncate(int inode_index, int keep) {
+    extent *last;
+    while ((last = last_extent(inode_index)) != NULL && last->logical + last->length > keep) {
+        int cut = (keep > last->logical) ? keep : last->logical;
+        for (int i = cut - last->logical; i < last->length; i++) {
+            release_block(last->start + i);
+        }
+        last->length = cut - last->logical;
+        dirty_last_leaf(inode_index);
+
+        if (last->length == 0) {
+            remove_last_extent(inode_index);
+        }
+    }
+}
+
+
+/*****************************************************************/
+// write header and first bucket of a new directory, then add "." and ".."
+// return 1 for success
+int dir_init(int inode_index, int parent_inode) {
+    if (append_block(inode_index) != 0 || append_block(inode_index) != 1) {
+        return 0;
+    }
+
+    directory_header *header = (directory_header *)inode_block(inode_index, 0);
+    header->count = 0;
+    header->global_depth = 0;
+    header->table[0] = 1;
+
+    directory_bucket *bucket = (directory_bucket *)inode_block(inode_index, 1);
+    bucket->local_depth = 0;
+    bucket->count = 0;
+    bucket->overflow = 0;
+    dirty_inode_block(inode_index, 0);
+    dirty_inode_block(inode_index, 1);
+
+    return dir_add_entry(inode_index, ".", inode_index) &&
+           dir_add_entry(inode_index, "..", parent_inode);
+}
+
+
+/*****************************************************************/
+// first bucket of the chain of "hash" in a directory, through the index block of its
+// slot if it has one
+// return logical block or -1 for an error
+int dir_chain(int dir_inode, directory_header *header, unsigned int hash) {
+    int nr = header->table[hash & ((1u << header->global_depth) - 1)];
+    directory_index *index = (directory_index *)inode_block(dir_inode, nr);
+    if (index == NULL) return -1;
+    if (index->local_depth != DIR_INDEX) return nr;
+    return index->table[(hash >> dir_top_bits) & ((1u << index->depth) - 1)];
+}
+
+
+/*****************************************************************/
+// return bits of hash that a table of ints in "bytes" can index
+int table_bits(int bytes) {
+    int bits = 0;
+    while ((int)sizeof(int) << (bits + 1) <= bytes) bits++;
+    return bits;
+}
+
+
+/*****************************************************************/
+// find the inode of the "len" bytes of "name" from directory, comparing them with the
+// entries in the blocks of directory
+// return inode or -1 if the name doesn t exist
+int dir_lookup(int dir_inode, const char *name, int len) {
+    directory_header *header = (directory_header *)inode_block(dir_inode, 0);
+    if (header == NULL) return -1;
+
+    unsigned int hash = name_hash(name, len);
+    int nr = dir_chain(dir_inode, header, hash);
+
+    // look in the bucket and in its overflow chain
+    while (nr > 0) {
+        directory_bucket *bucket = (directory_bucket *)inode_block(dir_inode, nr);
+        if (bucket == NULL) return -1;
+
+        for (int i = 0; i < bucket->count; i++) {
+            const char *filename = bucket->entries[i].filename;
+            if (!memcmp(filename, name, len) && filename[len] == '\0') {
+                return bucket->entries[i].inode_index;
+            }
+        }
+        nr = bucket->overflow;
+    }
+    return -1;
+}
+
+
+/*****************************************************************/
+// add an entry to a directory, touching only the header and the needed buckets
+// return 1 for success, 0 if directory can t grow anymore
+int dir_add_entry(int dir_inode, const char *name, int inode_index) {
+    if (strlen(name) > MAX_FILE_NAME) return 0;
+
+    unsigned int hash = name_hash(name, strlen(name));
+
+    while (1) {
+        directory_header *header = (directory_header *)inode_block(dir_inode, 0);
+        if (header == NULL) return 0;
+
+        // the table that chooses the bucket: the one of header, or of the index block of the slot
+        unsigned int slot = hash & ((1u << header->global_depth) - 1);
+        int *table = header->table;
+        int *depth = &header->global_depth;
+        int table_nr = 0;
+        int shift = 0;
+        int nr = header->table[slot];
+        directory_bucket *bucket = (directory_bucket *)inode_block(dir_inode, nr);
+        if (bucket->local_depth == DIR_INDEX) {
+            directory_index *index = (directory_index *)bucket;
+            table = index->table;
+            depth = &index->depth;
+            table_nr = nr;
+            shift = dir_top_bits;
+            nr = index->table[(hash >> shift) & ((1u << index->depth) - 1)];
+            bucket = (directory_bucket *)inode_block(dir_inode, nr);
+        }
+
+        // use the first bucket from chain with a free slot
+        directory_bucket *crt = bucket;
+        int crt_nr = nr;
+        while (crt->count == DIR_BUCKET_ENTRIES && crt->overflow != 0) {
+            crt_nr = crt->overflow;
+            crt = (directory_bucket *)inode_block(dir_inode, crt_nr);
+        }
+        if (crt->count < DIR_BUCKET_ENTRIES) {
+            crt->entries[crt->count].inode_index = inode_index;
+            strcpy(crt->entries[crt->count].filename, name);
+            crt->count++;
+            header->count++;
+            dirty_inode_block(dir_inode, crt_nr);
+            dirty_inode_block(dir_inode, 0);
+            return 1;
+        }
+
+        // all hash bits are used, so chain a new bucket
+        if (bucket->local_depth == dir_top_bits + dir_index_bits) {
+            int new_nr = append_block(dir_inode);
+            if (new_nr == -1) return 0;
+
+            directory_bucket *added = (directory_bucket *)inode_block(dir_inode, new_nr);
+            added->local_depth = dir_top_bits + dir_index_bits;
+            crt->overflow = new_nr;
+            dirty_inode_block(dir_inode, crt_nr);
+            continue;
+        }
+
+        // all bits of header are used, so the slot gets an index block over the bucket
+        if (table_nr == 0 && bucket->local_depth == dir_top_bits) {
+            int index_nr = append_block(dir_inode);
+            if (index_nr == -1) return 0;
+
+            directory_index *index = (directory_index *)inode_block(dir_inode, index_nr);
+            index->local_depth = DIR_INDEX;
+            index->count = 0;
+            index->depth = 0;
+            index->table[0] = nr;
+            header->table[slot] = index_nr;
+            dirty_inode_block(dir_inode, 0);
+            dirty_inode_block(dir_inode, index_nr);
+            continue;
+        }
+
+        // split the bucket; the table doubles only if the bucket used all its bits
+        int new_nr = append_block(dir_inode);
+        if (new_nr == -1) return 0;
+
+        if (bucket->local_depth == shift + *depth) {
+            int len = 1 << *depth;
+            memcpy(table + len, table, len * sizeof(int));
+            (*depth)++;
+        }
+
+        int bit = 1 << bucket->local_depth;
+        directory_bucket *sibling = (directory_bucket *)inode_block(dir_inode, new_nr);
+        bucket->local_depth++;
+        sibling->local_depth = bucket->local_depth;
+
+        // entries with the new bit set move to sibling
+        int kept = 0;
+        for (int i = 0; i < bucket->count; i++) {
+            const char *filename = bucket->entries[i].filename;
+            if (name_hash(filename, strlen(filename)) & bit) {
+                sibling->entries[sibling->count++] = bucket->entries[i];
+            } else {
+                bucket->entries[kept++] = bucket->entries[i];
+            }
+        }
+        bucket->count = kept;
+
+        // redirect half of the table slots that pointed to the old bucket
+        for (int i = 0; i < (1 << *depth); i++) {
+            if (table[i] == nr && (((unsigned int)i << shift) & bit)) {
+                table[i] = new_nr;
+            }
+        }
+        dirty_inode_block(dir_inode, table_nr);
+        dirty_inode_block(dir_inode, nr);
+        dirty_inode_block(dir_inode, new_nr);
+    }
+}
+
+
+/*****************************************************************/
+// remove a name from directory; the last entry of bucket fills the hole
+// return 1 for success
+int dir_remove_entry(int dir_inode, const char *name) {
+    directory_header *header = (directory_header *)inode_block(dir_inode, 0);
+    if (header == NULL) return 0;
+
+    unsigned int hash = name_hash(name, strlen(name));
+    int nr = dir_chain(dir_inode, header, hash);
+
+    while (nr > 0) {
+        directory_bucket *bucket = (directory_bucket *)inode_block(dir_inode, nr);
+        if (bucket == NULL) return 0;
+
+        for (int i = 0; i < bucket->count; i++) {
+            if (!strcmp(bucket->entries[i].filename, name)) {
+                bucket->count--;
+                bucket->entries[i] = bucket->entries[bucket->count];
+                memset(&bucket->entries[bucket->count], 0, sizeof(directory_entry));
+                header->count--;
+                dirty_inode_block(dir_inode, nr);
+                dirty_inode_block(dir_inode, 0);
+                return 1;
+            }
+        }
+        nr = bucket->overflow;
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// return the number of entries of a directory, "." and ".." included
+int dir_count(int dir_inode) {
+    directory_header *header = (directory_header *)inode_block(dir_inode, 0);
+    if (header == NULL) return 0;
+    return header->count;
+}
+
+
+/*****************************************************************/
+// prepare to walk all entries of a directory
+void dir_iter_start(dir_iter *it, int dir_inode) {
+    it->inode_index = dir_inode;
+    it->block = 1;
+    it->slot = 0;
+
+    // all buckets are read in order, so read-ahead starts right away
+    if (!use_mmap) {
+        pthread_mutex_lock(&ra_locks[dir_inode % RA_LOCKS]);
+        ra_state[dir_inode].next = 1;
+        pthread_mutex_unlock(&ra_locks[dir_inode % RA_LOCKS]);
+    }
+    read_ahead(dir_inode, 1);
+}
+
+
+/*****************************************************************/
+// return the next entry of directory or NULL when there are no more
+directory_entry *dir_iter_next(dir_iter *it) {
+    directory_bucket *bucket;
+    while ((bucket = (directory_bucket *)inode_block(it->inode_index, it->block)) != NULL) {
+        if (it->slot < bucket->count) {
+            return &bucket->entries[it->slot++];
+        }
+        it->block++;
+        it->slot = 0;
+        read_ahead(it->inode_index, it->block);
+    }
+    return NULL;
+}
+
+
+/*****************************************************************/
+// remember that a block must be written at the next sync
+void mark_dirty(int block) {
+    mark_bit(&dirty_blocks, block, 1);
+
+    // new content, its checksum will be new too
+    if (bad_map != NULL) {
+        __atomic_fetch_and(&bad_map[block / BYTE_LEN], ~(1 << (block % BYTE_LEN)), __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************/
+// remember that a metadata block must go through journal at the next sync
+void mark_meta_dirty(int block) {
+    mark_bit(&dirty_blocks, block, 1);
+    mark_bit(&meta_blocks, block, 1);
+}
+
+
+/*****************************************************************/
+// count bits equal to 1 of an allocator map
+int count_set_bits(bitmap_allocator *a) {
+    int count = a->nr_bits;
+    for (int r = 0; r < (a->nr_bits + REGION_BITS - 1) / REGION_BITS; r++) {
+        count -= __atomic_load_n(&a->region_free[r], __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+
+/*****************************************************************/
+// mark dirty the logical block "nr" of an inode
+void dirty_inode_block(int inode_index, int nr) {
+    int block = bmap(inode_index, nr, 0);
+    if (block != -1) mark_meta_dirty(block);
+}
+
+
+/*****************************************************************/
+// mark dirty the leaf that keeps the last extents of an inode
+void dirty_last_leaf(int inode_index) {
+    extent_root *root = &inodes[inode_index].extents;
+    if (root->depth == 0 || root->count == 0) return;
+
+    int blocks[EXTENT_MAX_DEPTH + 1];
+    extent_leaf *nodes[EXTENT_MAX_DEPTH + 1];
+    int depth = extent_path(inode_index, blocks, nodes);
+    mark_meta_dirty(blocks[depth]);
+}
+
+
+/*****************************************************************/
+// copy superblock, bitmaps and inode table to their blocks;
+// only blocks with changed content become dirty
+void store_metadata() {
+    disk_superblock d;
+    pack_superblock(&d);
+    store_blocks(0, &d, sizeof(d));
+    if (sb.features & FEATURE_GROUPS) {
+        store_blocks(sb.gdt_start, groups, sb.group_count * sizeof(group_desc));
+    }
+
+    // every group keeps its slice of bitmaps and inode table
+    for (int g = 0; g < sb.group_count; g++) {
+        int first_block = g * sb.blocks_per_group;
+        int first_inode = g * sb.inodes_per_group;
+        store_blocks(groups[g].block_bitmap, bm.block_map + first_block / BYTE_LEN,
+                     (group_end(g) - first_block) / BYTE_LEN);
+        store_blocks(groups[g].inode_bitmap, bm.inode_map + first_inode / BYTE_LEN,
+                     sb.inodes_per_group / BYTE_LEN);
+        store_inode_table(g);
+    }
+
+    if (sb.features & FEATURE_CHECKSUMS) store_checksums();
+}
+
+
+/*****************************************************************/
+// copy "len" bytes to the blocks starting with "first"
+void store_blocks(int first, void *src, int len) {
+    unsigned char *data = (unsigned char *)src;
+    for (int i = 0; len > 0; i++) {
+        int size = (len < sb.block_size) ? len : sb.block_size;
+        unsigned char *block = get_block(first + i);
+        if (memcmp(block, data, size)) {
+            memmove(block, data, size);
+            mark_meta_dirty(first + i);
+        }
+        put_block(first + i);
+        data += size;
+        len -= size;
+    }
+}
+
+
+/*****************************************************************/
+// write dirty blocks to disk; every run of contiguous dirty blocks is
+// written with one pwritev (or one msync for a mapped disk)
+// return number of written bytes or -1 for error
+long sync_disk() {
+    release_freed_blocks();
+    store_metadata();
+
+    // without journal, every dirty block goes directly to its place
+    if (use_mmap || !(sb.features & FEATURE_JOURNAL)) {
+        long bytes = write_dirty(-1);
+        if (bytes == -1) return -1;
+
+        sync_stats.syncs++;
+        sync_stats.last_bytes = bytes;
+        sync_stats.total_bytes += bytes;
+        return bytes;
+    }
+
+    // data first, so committed metadata never points to old data
+    long bytes = write_dirty(0);
+    if (bytes == -1) return -1;
+
+    int meta_count = count_set_bits(&meta_blocks);
+    if (meta_count > 0) {
+        long written = journal_commit(bytes > 0);
+        if (written == -1) return -1;
+        bytes += written;
+
+        written = write_dirty(1);
+        if (written == -1) return -1;
+        bytes += written;
+        journal.checkpoint_pending = 1;
+    }
+
+    sync_stats.syncs++;
+    sync_stats.last_bytes = bytes;
+    sync_stats.total_bytes += bytes;
+    return bytes;
+}
+
+
+/*****************************************************************/
+// write the cached blocks [first, first + count) with as few requests as possible
+// return 1 for success
+int write_blocks(int first, int count) {
+    return write_runs(&first, &count, 1);
+}
+
+
+/*****************************************************************/
+// write the cached blocks of runs [first[r], first[r] + count[r]) in one batch
+// return 1 for success
+int write_runs(int *first, int *count, int runs) {
+    int total = 0;
+    for (int r = 0; r < runs; r++) {
+        total += count[r];
+    }
+
+    unsigned char **data = malloc(total * sizeof(unsigned char *));
+    io_request *reqs = malloc((total / SYNC_BATCH + runs) * sizeof(io_request));
+    if (data == NULL || reqs == NULL) {
+        free(data);
+        free(reqs);
+        return 0;
+    }
+
+    int n = 0;
+    for (int r = 0, pos = 0; r < runs; pos += count[r++]) {
+        for (int i = 0; i < count[r]; i++) {
+            data[pos + i] = get_block(first[r] + i);
+        }
+        n = add_requests(reqs, n, 1, first[r], data + pos, count[r]);
+    }
+    int written = device_run(reqs, n);
+
+    for (int r = 0; r < runs; r++) {
+        for (int i = 0; i < count[r]; i++) {
+            put_block(first[r] + i);
+        }
+    }
+    free(data);
+    free(reqs);
+    return written;
+}
+
+
+/*****************************************************************/
+// write "count" buffers of a block as the blocks starting with "first"
+// return 1 for success
+int write_vector(int first, unsigned char **data, int count) {
+    io_request *reqs = malloc((count / SYNC_BATCH + 1) * sizeof(io_request));
+    if (reqs == NULL) return 0;
+
+    int written = device_run(reqs, add_requests(reqs, 0, 1, first, data, count));
+    free(reqs);
+    return written;
+}
+
+
+/*****************************************************************/
+// add the requests that read or write "count" buffers as the blocks starting
+// with "first", at most SYNC_BATCH blocks each, after the first "n" of "reqs"
+// return new number of requests
+int add_requests(io_request *reqs, int n, int write, int first, unsigned char **data, int count) {
+    for (int done = 0; done < count; done += SYNC_BATCH) {
+        reqs[n].write = write;
+        reqs[n].first = first + done;
+        reqs[n].count = (count - done < SYNC_BATCH) ? count - done : SYNC_BATCH;
+        reqs[n].data = data + done;
+        n++;
+    }
+    return n;
+}
+
+
+/*****************************************************************/
+// start the block device chosen with --io; one that can t start leaves its place to "sync"
+// return 1 for success
+int device_init() {
+    device = &devices[0];
+    for (int i = 0; i < (int)(sizeof(devices) / sizeof(devices[0])); i++) {
+        if (!strcmp(devices[i].name, device_name)) {
+            device = &devices[i];
+        }
+    }
+    // an unknown name gets "sync" too; fs_statfs tells which device is used
+    if (!device->open()) device = &devices[0];
+    return 1;
+}
+
+
+/*****************************************************************/
+// give a batch of "n" requests to the block device and wait for all of them
+// return 1 if every request transferred all its blocks
+int device_run(io_request *reqs, int n) {
+    if (n == 0) return 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    device->run(reqs, n);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // batches of several threads may end together
+    int complete = 1;
+    long blocks = 0;
+    for (int i = 0; i < n; i++) {
+        blocks += reqs[i].count;
+        if (reqs[i].done != (long)reqs[i].count * sb.block_size) {
+            complete = 0;
+        }
+    }
+    __atomic_fetch_add(&io_stats.blocks, blocks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io_stats.batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io_stats.requests, n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io_stats.nanos, (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec,
+                       __ATOMIC_RELAXED);
+    return complete;
+}
+
+
+/*****************************************************************/
+// read or write the blocks of one request with a single call
+void request_run(io_request *req) {
+    struct iovec iov[SYNC_BATCH];
+    for (int i = 0; i < req->count; i++) {
+        iov[i].iov_base = req->data[i];
+        iov[i].iov_len = sb.block_size;
+    }
+
+    off_t offset = (off_t)req->first * sb.block_size;
+    ssize_t done = req->write ? pwritev(disk_fd, iov, req->count, offset) :
+                                preadv(disk_fd, iov, req->count, offset);
+    req->done = (done > 0) ? done : 0;
+}
+
+
+/*****************************************************************/
+// "sync" device needs nothing more than the disk file
+int sync_open() {
+    return 1;
+}
+
+
+/*****************************************************************/
+// "sync" device keeps nothing open
+void sync_close() {
+}
+
+
+/*****************************************************************/
+// run requests one after another
+void sync_run(io_request *reqs, int n) {
+    for (int i = 0; i < n; i++) {
+        request_run(&reqs[i]);
+    }
+}
+
+
+/*****************************************************************/
+// start the workers of "threads" device
+// return 1 for success
+int pool_open() {
+    pool.stop = 0;
+    pool.next = pool.count = 0;
+    for (pool.started = 0; pool.started < IO_THREADS; pool.started++) {
+        if (pthread_create(&pool.workers[pool.started], NULL, pool_worker, NULL) != 0) break;
+    }
+    return pool.started > 0;
+}
+
+
+/*****************************************************************/
+// wake the workers of "threads" device to end, and wait for them
+void pool_close() {
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.started; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    pool.started = 0;
+}
+
+
+/*****************************************************************/
+// share requests between workers and wait until the last one is done;
+// a single request is run directly, a worker would only add latency.
+// batches of other threads wait for the current one
+void pool_run(io_request *reqs, int n) {
+    if (n == 1) {
+        request_run(reqs);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.batch);
+    pthread_mutex_lock(&pool.lock);
+    pool.reqs = reqs;
+    pool.count = n;
+    pool.next = 0;
+    pool.pending = n;
+    pthread_cond_broadcast(&pool.work);
+    while (pool.pending > 0) {
+        pthread_cond_wait(&pool.finished, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.batch);
+}
+
+
+/*****************************************************************/
+// worker of "threads" device: take requests of the current batch one by one
+void *pool_worker(void *arg) {
+    pthread_mutex_lock(&pool.lock);
+    while (1) {
+        while (pool.next == pool.count && !pool.stop) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.stop) break;
+        io_request *req = &pool.reqs[pool.next++];
+
+        pthread_mutex_unlock(&pool.lock);
+        request_run(req);
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.pending == 0) {
+            pthread_cond_signal(&pool.finished);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+
+/*****************************************************************/
+// create the io_uring of "uring" device and register the cache arena, so
+// the kernel doesn t map the buffers again for every request
+// return 1 for success
+int uring_open() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring.fd == -1) return 0;
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && cq_len > sq_len) {
+        sq_len = cq_len;
+    }
+
+    unsigned char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring.fd, IORING_OFF_SQ_RING);
+    unsigned char *cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) && sq != MAP_FAILED) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring.fd, IORING_OFF_CQ_RING);
+    }
+    size_t sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring.fd, IORING_OFF_SQES);
+
+    // uring_close unmaps what was mapped
+    ring.maps[0] = (sq != MAP_FAILED) ? sq : NULL;
+    ring.map_lens[0] = sq_len;
+    ring.maps[1] = (cq != sq && cq != MAP_FAILED) ? cq : NULL;
+    ring.map_lens[1] = cq_len;
+    ring.maps[2] = (sqes != MAP_FAILED) ? sqes : NULL;
+    ring.map_lens[2] = sqes_len;
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        uring_close();
+        return 0;
+    }
+
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sqes = sqes;
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cq_entries = params.cq_entries;
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // without registration (too big or not allowed), buffers are given as plain addresses
+    struct iovec arena = {bcache.arena, (size_t)bcache.budget * sb.block_size};
+    ring.registered = (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &arena, 1) == 0);
+    return 1;
+}
+
+
+/*****************************************************************/
+// unmap the rings of "uring" device and close it; registered buffers go with it
+void uring_close() {
+    for (int i = 0; i < 3; i++) {
+        if (ring.maps[i] != NULL) munmap(ring.maps[i], ring.map_lens[i]);
+        ring.maps[i] = NULL;
+    }
+    close(ring.fd);
+    ring.fd = -1;
+}
+
+
+/*****************************************************************/
+// submit every block of the requests as its own entry, as many at once as the
+// ring holds, and collect completions until all are done; threads take turns
+void uring_run(io_request *reqs, int n) {
+    pthread_mutex_lock(&ring.lock);
+    uring_batch(reqs, n);
+    pthread_mutex_unlock(&ring.lock);
+}
+
+
+/*****************************************************************/
+// run one batch on the ring, with its lock
+void uring_batch(io_request *reqs, int n) {
+    int total = 0;
+    for (int i = 0; i < n; i++) {
+        reqs[i].done = (long)reqs[i].count * sb.block_size;
+        total += reqs[i].count;
+    }
+
+    size_t arena_len = (size_t)bcache.budget * sb.block_size;
+    int req = 0, block = 0;             // next block to be queued
+    int queued = 0, unsubmitted = 0, in_flight = 0;
+    while (queued < total || unsubmitted > 0 || in_flight > 0) {
+        unsigned tail = *ring.sq_tail;
+        unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        while (queued < total && tail - head < ring.sq_entries &&
+               in_flight + unsubmitted < (int)ring.cq_entries) {
+            io_request *r = &reqs[req];
+            unsigned index = tail & ring.sq_mask;
+            struct io_uring_sqe *sqe = &ring.sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = disk_fd;
+            sqe->off = (unsigned long long)(r->first + block) * sb.block_size;
+            sqe->addr = (unsigned long long)(uintptr_t)r->data[block];
+            sqe->len = sb.block_size;
+            sqe->user_data = (unsigned long long)req * SYNC_BATCH + block;
+            if (ring.registered && r->data[block] >= bcache.arena && r->data[block] < bcache.arena + arena_len) {
+                sqe->opcode = r->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+                sqe->buf_index = 0;
+            } else {
+                sqe->opcode = r->write ? IORING_OP_WRITE : IORING_OP_READ;
+            }
+            ring.sq_array[index] = index;
+
+            tail++;
+            queued++;
+            unsubmitted++;
+            if (++block == r->count) {
+                req++;
+                block = 0;
+            }
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        // one call submits the new entries and waits for at least one completion
+        int submitted = syscall(__NR_io_uring_enter, ring.fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted == -1) {
+            if (errno == EINTR) continue;
+            for (int i = 0; i < n; i++) {
+                reqs[i].done = 0;
+            }
+            return;
+        }
+        unsubmitted -= submitted;
+        in_flight += submitted;
+
+        unsigned cq_head = *ring.cq_head;
+        while (cq_head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[cq_head & ring.cq_mask];
+            io_request *r = &reqs[cqe->user_data / SYNC_BATCH];
+            long valid = (long)(cqe->user_data % SYNC_BATCH) * sb.block_size + (cqe->res > 0 ? cqe->res : 0);
+
+            // a request is counted as done until its first short block
+            if (cqe->res < sb.block_size && valid < r->done) {
+                r->done = valid;
+            }
+            cq_head++;
+            in_flight--;
+        }
+        __atomic_store_n(ring.cq_head, cq_head, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*****************************************************************/
+// write dirty blocks in their place, every run of contiguous blocks at once
+// "meta" chooses blocks: 0 for data, 1 for metadata, -1 for all
+// return number of written bytes or -1 for error
+long write_dirty(int meta) {
+    int *first = NULL, *count = NULL;
+    int runs = 0, len = 0;
+    long bytes = 0;
+    int pos = 0;
+    while (pos < sb.total_blocks) {
+        int start = next_bit(&dirty_blocks, pos, sb.total_blocks, 1);
+        if (start == -1) break;
+        if (meta != -1 && find_bit_value(meta_map, start, BLOCK_MAP_LEN) != meta) {
+            pos = start + 1;
+            continue;
+        }
+
+        int end = start + 1;
+        while (end < sb.total_blocks && find_bit_value(dirty_map, end, BLOCK_MAP_LEN) == 1 &&
+               (meta == -1 || find_bit_value(meta_map, end, BLOCK_MAP_LEN) == meta)) {
+            end++;
+        }
+
+        if (use_mmap) {
+            // msync wants an address aligned to a page
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t from = (size_t)start * sb.block_size / page * page;
+            size_t to = (size_t)end * sb.block_size;
+            if (msync((unsigned char *)disk_buffer + from, to - from, MS_SYNC) == -1) return -1;
+            clear_dirty(start, end);
+        } else {
+            // runs are written together at the end, so the device has them all in flight
+            if (runs == len) {
+                len = len ? 2 * len : SYNC_BATCH;
+                int *more_first = realloc(first, len * sizeof(int));
+                if (more_first) first = more_first;
+                int *more_count = realloc(count, len * sizeof(int));
+                if (more_count) count = more_count;
+                if (!more_first || !more_count) {
+                    free(first);
+                    free(count);
+                    return -1;
+                }
+            }
+            first[runs] = start;
+            count[runs++] = end - start;
+        }
+        bytes += (long)(end - start) * sb.block_size;
+        pos = end;
+    }
+
+    int written = (runs == 0 || write_runs(first, count, runs));
+    for (int r = 0; written && r < runs; r++) {
+        clear_dirty(first[r], first[r] + count[r]);
+    }
+    free(first);
+    free(count);
+    return written ? bytes : -1;
+}
+
+
+/*****************************************************************/
+// blocks [start, end) reached the disk
+void clear_dirty(int start, int end) {
+    for (int i = start; i < end; i++) {
+        mark_bit(&dirty_blocks, i, 0);
+        mark_bit(&meta_blocks, i, 0);
+    }
+}
+
+
+/*****************************************************************/
+// write all dirty metadata to journal as one transaction and flush it
+// "data_written" tells that data blocks were written in place before
+// return number of written bytes or -1 for error
+long journal_commit(int data_written) {
+    int capacity = sb.journal_blocks - 2;
+    int count = count_set_bits(&meta_blocks);
+
+    // data of this transaction and metadata of the last one must reach the disk first
+    if (data_written || journal.checkpoint_pending || journal.data_pending) {
+        if (fdatasync(disk_fd) == -1) return -1;
+        journal.flushes++;
+        journal.checkpoint_pending = 0;
+        journal.data_pending = 0;
+    }
+
+    // too big for journal (fs_write goes in pieces, but fsck or a conversion may get here):
+    // forget the old transaction and write in place, without atomicity, so it s counted
+    if (count > capacity) {
+        memset(disk_block(sb.journal_start), 0, sb.block_size);
+        if (!write_blocks(sb.journal_start, 1) || fdatasync(disk_fd) == -1) return -1;
+        journal.flushes++;
+        journal.overflows++;
+        return sb.block_size;
+    }
+
+    unsigned char **data = malloc((count + 2) * sizeof(unsigned char *));
+    if (data == NULL) return -1;
+
+    journal_header *header = (journal_header *)get_zero_block(sb.journal_start);
+    header->magic = JOURNAL_MAGIC;
+    header->sequence = journal.sequence;
+    header->count = count;
+    data[0] = (unsigned char *)header;
+
+    // dirty metadata blocks are written after header straight from cache, without copies
+    int pos = 0;
+    for (int i = 0; i < count; i++) {
+        int block = next_bit(&meta_blocks, pos, sb.total_blocks, 1);
+        header->blocks[i] = block;
+        data[1 + i] = get_block(block);
+        pos = block + 1;
+    }
+
+    journal_commit_block *commit = (journal_commit_block *)get_zero_block(sb.journal_start + 1 + count);
+    commit->magic = COMMIT_MAGIC;
+    commit->sequence = journal.sequence;
+    commit->checksum = 2166136261u;
+    for (int i = 0; i < count + 1; i++) {
+        commit->checksum = journal_checksum(commit->checksum, data[i]);
+    }
+    data[1 + count] = (unsigned char *)commit;
+
+    // one write and one flush for the whole group of commands
+    int written = write_vector(sb.journal_start, data, count + 2);
+    put_block(sb.journal_start + 1 + count);
+    for (int i = 0; i < count; i++) {
+        put_block(header->blocks[i]);
+    }
+    put_block(sb.journal_start);
+    free(data);
+    if (!written || fdatasync(disk_fd) == -1) return -1;
+
+    journal.flushes++;
+    journal.commits++;
+    journal.sequence++;
+    journal.bytes += (long)(count + 2) * sb.block_size;
+    return (long)(count + 2) * sb.block_size;
+}
+
+
+/*****************************************************************/
+// verify if the dirty metadata could outgrow the journal after one more command
+// return 1 if a commit is needed
+int journal_full() {
+    if (use_mmap || !(sb.features & FEATURE_JOURNAL)) return 0;
+    return count_set_bits(&meta_blocks) > (sb.journal_blocks - 2) / 2;
+}
+
+
+/*****************************************************************/
+// bytes that one piece of fs_write may write: every 1/4 of a block of pointers (or
+// extents) dirties a pointer block and a checksum table, WRITE_PIECE_META more blocks
+// go to bitmaps, descriptors, superblock and inode table. A piece fills at most a
+// quarter of the journal, so a few writers at once still fit before a commit
+int write_piece() {
+    if (use_mmap || !(sb.features & FEATURE_JOURNAL)) return 0x7fffffff;
+    int meta = (sb.journal_blocks - 2) / 4 - WRITE_PIECE_META;
+    if (meta < 2) meta = 2;
+    long long bytes = (long long)meta / 2 * (sb.block_size / 4) * sb.block_size;
+    return (bytes > 0x7fffffff) ? 0x7fffffff : (int)bytes;
+}
+
+
+/*****************************************************************/
+// copy the blocks of the last complete transaction to their places
+void journal_replay() {
+    if (!(sb.features & FEATURE_JOURNAL) || sb.journal_blocks < 2) return;
+
+    journal_header *header = (journal_header *)disk_block(sb.journal_start);
+    journal.sequence = header->sequence + 1;
+    if (header->magic != JOURNAL_MAGIC || header->count <= 0 || header->count > sb.journal_blocks - 2) {
+        return;
+    }
+
+    unsigned int checksum = 2166136261u;
+    for (int i = 0; i < header->count + 1; i++) {
+        checksum = journal_checksum(checksum, get_block(sb.journal_start + i));
+        put_block(sb.journal_start + i);
+    }
+
+    journal_commit_block *commit = (journal_commit_block *)disk_block(sb.journal_start + 1 + header->count);
+    if (commit->magic != COMMIT_MAGIC || commit->sequence != header->sequence ||
+        commit->checksum != checksum) {
+        return;
+    }
+
+    for (int i = 0; i < header->count; i++) {
+        int block = header->blocks[i];
+        if (block < 0 || block >= sb.total_blocks) continue;
+        unsigned char *home = get_block(block);
+        unsigned char *copy = get_block(sb.journal_start + 1 + i);
+        if (memcmp(home, copy, sb.block_size)) {
+            memmove(home, copy, sb.block_size);
+            mark_meta_dirty(block);
+        }
+        put_block(sb.journal_start + 1 + i);
+        put_block(block);
+    }
+
+    // a mapped disk doesn t use journal, so the transaction must not be replayed again later
+    if (use_mmap) {
+        memset(header, 0, sb.block_size);
+        mark_dirty(sb.journal_start);
+    }
+}
+
+
+/*****************************************************************/
+// continue the FNV-1a "hash" of a transaction with one more block
+unsigned int journal_checksum(unsigned int hash, unsigned char *data) {
+    for (int j = 0; j < sb.block_size; j++) {
+        hash ^= data[j];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/*****************************************************************/
+// choose the CRC32C of this processor: the crc32 instruction of SSE4.2, or tables
+void crc32c_init() {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < BYTE_LEN; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+    }
+
+    crc32c_update = crc32c_table;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c_update = crc32c_sse42;
+#endif
+}
+
+
+/*****************************************************************/
+// continue "crc" with "len" bytes, 8 bytes at a time through 8 tables
+uint32_t crc32c_table(uint32_t crc, const unsigned char *data, size_t len) {
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word = le64toh(word) ^ crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+              crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+              crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+              crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+        data += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+
+#if defined(__x86_64__)
+/*****************************************************************/
+// continue "crc" with "len" bytes, 8 bytes for every crc32 instruction
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t len) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+    crc = crc64;
+    while (len-- > 0) {
+        crc = __builtin_ia32_crc32qi(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+
+/*****************************************************************/
+// return the CRC32C of "len" bytes
+uint32_t crc32c(const void *data, size_t len) {
+    return ~crc32c_update(~0u, (const unsigned char *)data, len);
+}
+
+
+/*****************************************************************/
+// verify if block "nr" has a checksum: not the superblock (it has its own),
+// the journal, or the checksum tables
+// return 1 if it has
+int has_checksum(int nr) {
+    if (!(sb.features & FEATURE_CHECKSUMS) || nr <= 0 || nr >= sb.total_blocks) return 0;
+    if (nr >= sb.journal_start && nr < sb.journal_start + sb.journal_blocks) return 0;
+
+    int table = groups[nr / sb.blocks_per_group].inode_table + sb.inode_table_blocks;
+    return nr < table || nr >= table + sb.checksum_blocks;
+}
+
+
+/*****************************************************************/
+// remember the checksum of block "nr", that goes to disk with content "data"
+void checksum_block(int nr, const unsigned char *data) {
+    if (!has_checksum(nr)) return;
+    __atomic_store_n(&checksums[nr], htole32(crc32c(data, sb.block_size)), __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// verify block "nr" just read from disk; a wrong one is counted in stats, and
+// files can t be read through it (-EBADMSG) until it s written again
+void verify_block(int nr, const unsigned char *data) {
+    if (!checksums_ready || !has_checksum(nr)) return;
+
+    __atomic_fetch_add(&csum_stats.verified, 1, __ATOMIC_RELAXED);
+    uint32_t expected = le32toh(__atomic_load_n(&checksums[nr], __ATOMIC_RELAXED));
+    if (crc32c(data, sb.block_size) == expected) return;
+
+    __atomic_fetch_add(&csum_stats.errors, 1, __ATOMIC_RELAXED);
+    if (__atomic_fetch_or(&bad_map[nr / BYTE_LEN], 1 << (nr % BYTE_LEN), __ATOMIC_RELAXED) &
+        (1 << (nr % BYTE_LEN))) {
+        return;
+    }
+    __atomic_fetch_add(&csum_stats.bad_blocks, 1, __ATOMIC_RELAXED);
+    int none = -1;
+    __atomic_compare_exchange_n(&csum_stats.first_bad, &none, nr, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// verify if block "nr" was read with a wrong checksum
+// return 1 if it s bad
+int block_is_bad(int nr) {
+    return bad_map != NULL && find_bit_value(bad_map, nr, BLOCK_MAP_LEN) == 1;
+}
+
+
+/*****************************************************************/
+// read the checksum tables of all groups; from now on, blocks read are verified
+void load_checksums() {
+    for (int g = 0; g < sb.group_count; g++) {
+        int first_block = g * sb.blocks_per_group;
+        load_blocks(groups[g].inode_table + sb.inode_table_blocks, &checksums[first_block],
+                    (group_end(g) - first_block) * sizeof(uint32_t));
+    }
+    checksums_ready = 1;
+}
+
+
+/*****************************************************************/
+// compute the checksums of the blocks that will be written by this sync,
+// then copy the tables to their blocks, that go through journal like all metadata
+void store_checksums() {
+    int pos = 0;
+    while (pos < sb.total_blocks) {
+        int nr = next_bit(&dirty_blocks, pos, sb.total_blocks, 1);
+        if (nr == -1) break;
+        if (has_checksum(nr)) {
+            checksum_block(nr, get_block(nr));
+            put_block(nr);
+        }
+        pos = nr + 1;
+    }
+
+    for (int g = 0; g < sb.group_count; g++) {
+        int first_block = g * sb.blocks_per_group;
+        store_blocks(groups[g].inode_table + sb.inode_table_blocks, &checksums[first_block],
+                     (group_end(g) - first_block) * sizeof(uint32_t));
+    }
+}
+
+
+/*****************************************************************/
+// read the whole disk file with "threads" threads and verify the checksum of
+// every block against the tables; the disk is synced first and stays still meanwhile
+// return 0 for success or a negative error code
+int fs_scrub(int threads, struct fs_scrub *result) {
+    if (!fs_lock(1)) return -ENODEV;
+    if (!(sb.features & FEATURE_CHECKSUMS)) return fs_unlock(-EOPNOTSUPP);
+    if (sync_disk() == -1) return fs_unlock(-EIO);
+
+    scrub_state state = {0, (sb.total_blocks + SCRUB_CHUNK - 1) / SCRUB_CHUNK, 0, 0, -1,
+                         PTHREAD_MUTEX_INITIALIZER};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int started = run_threads(threads, scrub_worker, &state);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->threads = started;
+    result->blocks = state.blocks;
+    result->errors = state.errors;
+    result->first_error = state.first_error;
+    result->bytes = (long long)sb.total_blocks * sb.block_size;
+    result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    result->hardware_crc = (crc32c_update != crc32c_table);
+    return fs_unlock(0);
+}
+
+
+/*****************************************************************/
+// thread of fs_scrub: take chunks of blocks until none is left, read each
+// with one pread and verify its blocks
+void *scrub_worker(void *arg) {
+    scrub_state *state = (scrub_state *)arg;
+    unsigned char *buf = malloc((size_t)SCRUB_CHUNK * sb.block_size);
+    if (buf == NULL) return NULL;
+
+    long blocks = 0, errors = 0;
+    int first_error = -1;
+    int chunk;
+    while ((chunk = __atomic_fetch_add(&state->next_chunk, 1, __ATOMIC_RELAXED)) < state->chunks) {
+        int first = chunk * SCRUB_CHUNK;
+        int count = (sb.total_blocks - first < SCRUB_CHUNK) ? sb.total_blocks - first : SCRUB_CHUNK;
+        ssize_t len = pread(disk_fd, buf, (size_t)count * sb.block_size, (off_t)first * sb.block_size);
+        if (len < 0) len = 0;
+        if (len < (ssize_t)count * sb.block_size) {
+            memset(buf + len, 0, (size_t)count * sb.block_size - len);
+        }
+
+        for (int i = 0; i < count; i++) {
+            int nr = first + i;
+            if (!has_checksum(nr)) continue;
+            blocks++;
+            if (crc32c(buf + (size_t)i * sb.block_size, sb.block_size) != le32toh(checksums[nr])) {
+                errors++;
+                if (first_error == -1 || nr < first_error) first_error = nr;
+            }
+        }
+    }
+    free(buf);
+
+    pthread_mutex_lock(&state->lock);
+    state->blocks += blocks;
+    state->errors += errors;
+    if (first_error != -1 && (state->first_error == -1 || first_error < state->first_error)) {
+        state->first_error = first_error;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+
+/*****************************************************************/
+// run "worker" in "threads" threads (one for every processor if it s 0) until all of
+// them return; the thread of caller is a worker too
+// return the number of threads that ran
+int run_threads(int threads, void *(*worker)(void *), void *arg) {
+    if (threads < 1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > MAX_SCRUB_THREADS) threads = MAX_SCRUB_THREADS;
+
+    pthread_t workers[MAX_SCRUB_THREADS];
+    int started = 1;
+    while (started < threads && pthread_create(&workers[started], NULL, worker, arg) == 0) {
+        started++;
+    }
+    worker(arg);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    return started;
+}
+
+
+/*****************************************************************/
+// verify that bitmaps, counters, inodes and directories agree with each other, with
+// "threads" threads; with "repair", the problems found are repaired and the disk is
+// verified again. The disk is synced first and stays still meanwhile
+// return 0 for success or a negative error code
+int fs_fsck(int threads, int repair, struct fs_fsck *result) {
+    if (!fs_lock(1)) return -ENODEV;
+
+    // an open file could lose its inode
+    for (int i = 0; repair && i < sb.inode_count; i++) {
+        if (open_count[i] > 0) return fs_unlock(-EBUSY);
+    }
+    if (sync_disk() == -1) return fs_unlock(-EIO);
+
+    fsck_state state = {0};
+    state.found = result->found;
+    pthread_mutex_init(&state.lock, NULL);
+    state.owner = malloc(sb.total_blocks * sizeof(int));
+    state.cut = malloc(sb.inode_count * sizeof(int));
+    state.parent = malloc(sb.inode_count * sizeof(int));
+    state.flags = malloc(sb.inode_count);
+    if (!state.owner || !state.cut || !state.parent || !state.flags) {
+        free(state.owner);
+        free(state.cut);
+        free(state.parent);
+        free(state.flags);
+        return fs_unlock(-ENOMEM);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = 0;
+    fsck_check(&state, threads);
+    result->errors = state.errors;
+    result->repaired = 0;
+    if (repair && state.errors > 0) {
+        fsck_repair(&state, threads);
+        put_held_blocks();
+        if (sync_disk() == -1) err = -EIO;
+
+        // what remains is verified from the start
+        state.pass = 1;
+        fsck_check(&state, threads);
+        result->repaired = (result->errors > state.errors) ? result->errors - state.errors : 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->threads = state.threads;
+    result->inodes = state.inodes;
+    result->directories = state.directories;
+    result->blocks = state.blocks;
+    result->remaining = state.errors;
+    result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    free(state.owner);
+    free(state.cut);
+    free(state.parent);
+    free(state.flags);
+    free(state.entries);
+    return fs_unlock(err);
+}
+
+
+/*****************************************************************/
+// find every problem of disk: blocks of inodes in parallel, then the blocks shared
+// by inodes, directories in parallel, then the tree of names and the bitmaps
+void fsck_check(fsck_state *s, int threads) {
+    for (int i = 0; i < sb.total_blocks; i++) {
+        s->owner[i] = -1;
+    }
+    for (int i = 0; i < sb.inode_count; i++) {
+        s->cut[i] = -1;
+        s->parent[i] = inodes[i].parent_inode_index;
+    }
+    memset(s->flags, 0, sb.inode_count);
+    s->entry_count = 0;
+    s->inodes = s->directories = s->blocks = s->errors = 0;
+
+    s->chunks = (sb.inode_count + FSCK_CHUNK - 1) / FSCK_CHUNK;
+    s->next_chunk = 0;
+    s->threads = run_threads(threads, fsck_inode_worker, s);
+
+    // the lowest inode keeps a shared block, the others lose their blocks from the first one
+    for (int i = 0; i < sb.inode_count; i++) {
+        if (!(s->flags[i] & FSCK_SHARED)) continue;
+        int cut = fsck_walk_inode(s, i, FSCK_CHECK, NULL);
+        if (cut == -1) continue;
+        fsck_report(s, "Inodul %d foloseste blocuri ale altor inoduri, de la blocul logic %d.", i, cut);
+        if (s->cut[i] == -1 || cut < s->cut[i]) s->cut[i] = cut;
+    }
+
+    s->next_chunk = 0;
+    run_threads(threads, fsck_dir_worker, s);
+    put_held_blocks();
+
+    fsck_graph(s);
+    fsck_maps(s);
+}
+
+
+/*****************************************************************/
+// count a problem and describe it to the caller of fs_fsck, if not too many
+// were described; threads give their problems one at a time
+void fsck_report(fsck_state *s, const char *format, ...) {
+    if (__atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED) >= FS_FSCK_REPORTS ||
+        s->quiet || s->found == NULL) {
+        return;
+    }
+
+    char message[FSCK_MESSAGE_LEN];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    pthread_mutex_lock(&s->lock);
+    s->found(s->pass, message);
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/*****************************************************************/
+// remember an entry to be repaired
+void fsck_add_entry(fsck_state *s, int dir, int inode_index, int kind, const char *name) {
+    pthread_mutex_lock(&s->lock);
+    if (s->entry_count == s->entry_len) {
+        int len = s->entry_len ? 2 * s->entry_len : 16;
+        fsck_entry *bigger = realloc(s->entries, len * sizeof(fsck_entry));
+        if (bigger == NULL) {
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+        s->entries = bigger;
+        s->entry_len = len;
+    }
+    fsck_entry *e = &s->entries[s->entry_count++];
+    e->dir = dir;
+    e->inode = inode_index;
+    e->kind = kind;
+    strcpy(e->name, name);
+    pthread_mutex_unlock(&s->lock);
+}
+
+
+/*****************************************************************/
+// thread of the pass over inodes: take chunks of inodes until none is left
+void *fsck_inode_worker(void *arg) {
+    fsck_state *s = (fsck_state *)arg;
+    long count = 0, directories = 0, blocks = 0;
+    int chunk;
+    while ((chunk = __atomic_fetch_add(&s->next_chunk, 1, __ATOMIC_RELAXED)) < s->chunks) {
+        int end = (chunk + 1) * FSCK_CHUNK;
+        if (end > sb.inode_count) end = sb.inode_count;
+        for (int i = chunk * FSCK_CHUNK; i < end; i++) {
+            if (!inode_in_use(i)) continue;
+            count++;
+            directories += (inodes[i].file_type == 1);
+            fsck_inode(s, i, &blocks);
+        }
+    }
+
+    __atomic_fetch_add(&s->inodes, count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->directories, directories, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->blocks, blocks, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+
+/*****************************************************************/
+// verify the fields of an inode in use and take its blocks
+void fsck_inode(fsck_state *s, int inode_index, long *blocks) {
+    struct inode *in = &inodes[inode_index];
+    if (in->file_type != 0 && in->file_type != 1) {
+        fsck_report(s, "Inodul %d are tipul necunoscut %d.", inode_index, in->file_type);
+        __atomic_fetch_or(&s->flags[inode_index], FSCK_BAD_TYPE, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (is_inline(inode_index)) {
+        if (in->file_size < 0 || in->file_size > INLINE_DATA_LEN) {
+            fsck_report(s, "Inodul %d are dimensiunea %d in inod.", inode_index, in->file_size);
+            __atomic_fetch_or(&s->flags[inode_index], FSCK_BAD_SIZE, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    int cut = fsck_walk_inode(s, inode_index, FSCK_CLAIM, blocks);
+    if (cut != -1) {
+        fsck_report(s, "Inodul %d are blocuri gresite de la blocul logic %d.", inode_index, cut);
+        s->cut[inode_index] = cut;
+    }
+
+    // a directory fills its blocks, a file needs all of them for its size
+    long long room = (long long)in->crtBLocks * sb.block_size;
+    int size_ok = (in->file_type == 1) ? (in->file_size == room) :
+                  (in->file_size >= 0 && in->file_size <= room &&
+                   ((long long)in->file_size + sb.block_size - 1) / sb.block_size == in->crtBLocks);
+    if (!size_ok) {
+        fsck_report(s, "Inodul %d are dimensiunea %d pentru %d blocuri.", inode_index, in->file_size,
+                    in->crtBLocks);
+        __atomic_fetch_or(&s->flags[inode_index], FSCK_BAD_SIZE, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************/
+// walk the blocks of an inode with "mode"; with FSCK_CLAIM, "blocks" counts them
+// return the first logical block where the mapping is wrong, or -1 if it s whole:
+// a block out of disk or in metadata, a missing one, or one after the end of file
+int fsck_walk_inode(fsck_state *s, int inode_index, int mode, long *blocks) {
+    struct inode *in = &inodes[inode_index];
+    fsck_walk w = {s, inode_index, mode, in->crtBLocks, -1, 0};
+
+    if (sb.features & FEATURE_EXTENTS) {
+        extent_root *root = &in->extents;
+        long long next = 0;     // logical block expected from the next extent
+        if (root->depth < 0 || root->depth > EXTENT_MAX_DEPTH || root->count < 0 ||
+            root->count > EXTENTS_IN_INODE) {
+            fsck_bad(&w, 0);
+        } else if (!fsck_walk_node(&w, root->entries, root->count, root->depth, &next)) {
+            fsck_bad(&w, next);
+        }
+        if (next < w.blocks) fsck_bad(&w, next);
+    } else {
+        for (int i = 0; i < MAX_DIRECT_BLOCKS; i++) {
+            fsck_walk_pointer(&w, in->direct_blocks[i], i);
+        }
+        long long first = MAX_DIRECT_BLOCKS;
+        long long span = PTRS_PER_BLOCK;
+        for (int level = 0; level < INDIRECT_LEVELS; level++) {
+            fsck_walk_tree(&w, in->indirect_blocks[level], level, first);
+            first += span;
+            span *= PTRS_PER_BLOCK;
+        }
+    }
+
+    if (blocks != NULL) *blocks += w.used;
+    return w.cut;
+}
+
+
+/*****************************************************************/
+// walk "count" entries of a node of the tree of extents, "depth" levels above the leaves
+// return 1 if they are whole
+int fsck_walk_node(fsck_walk *w, extent *list, int count, int depth, long long *next) {
+    for (int i = 0; i < count; i++) {
+        if (depth == 0) {
+            if (!fsck_walk_extent(w, &list[i], next)) return 0;
+            continue;
+        }
+
+        int block = list[i].start;
+        if (list[i].logical != *next || *next >= w->blocks || !fsck_use(w, block)) return 0;
+        extent_leaf *node = (extent_leaf *)get_block(block);
+        int whole = !block_is_bad(block) && node->count > 0 && node->count <= EXTENTS_PER_LEAF &&
+                    fsck_walk_node(w, node->entries, node->count, depth - 1, next);
+        put_block(block);
+        if (!whole) return 0;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// verify the pointer to the data of logical block "nr"
+void fsck_walk_pointer(fsck_walk *w, int block, long long nr) {
+    if (nr >= w->blocks) {
+        if (block != 0) fsck_bad(w, w->blocks);
+        return;
+    }
+    if (block == 0 || !fsck_use(w, block)) fsck_bad(w, nr);
+}
+
+
+/*****************************************************************/
+// verify a block of pointers that maps logical blocks from "first" on;
+// "depth" is 0 if it points to data
+void fsck_walk_tree(fsck_walk *w, int block, int depth, long long first) {
+    if (first >= w->blocks) {
+        if (block != 0) fsck_bad(w, w->blocks);
+        return;
+    }
+    if (block == 0 || !fsck_use(w, block)) {
+        fsck_bad(w, first);
+        return;
+    }
+
+    int *ptrs = (int *)get_block(block);
+    if (block_is_bad(block)) {
+        put_block(block);
+        fsck_bad(w, first);
+        return;
+    }
+
+    long long span = 1;     // logical blocks mapped by one pointer
+    for (int i = 0; i < depth; i++) {
+        span *= PTRS_PER_BLOCK;
+    }
+    for (int i = 0; i < PTRS_PER_BLOCK; i++) {
+        if (depth == 0) {
+            fsck_walk_pointer(w, ptrs[i], first + i);
+        } else {
+            fsck_walk_tree(w, ptrs[i], depth - 1, first + i * span);
+        }
+    }
+    put_block(block);
+}
+
+
+/*****************************************************************/
+// verify an extent that should start with logical block "*next"
+// return 1 if it s whole, then "*next" is the block after it
+int fsck_walk_extent(fsck_walk *w, extent *e, long long *next) {
+    if (e->logical != *next || e->length <= 0) {
+        fsck_bad(w, *next);
+        return 0;
+    }
+    for (long long i = 0; i < e->length; i++) {
+        if (*next + i >= w->blocks) {
+            fsck_bad(w, w->blocks);
+            return 0;
+        }
+        long long block = (long long)e->start + i;
+        if (block <= 0 || block >= sb.total_blocks || !fsck_use(w, (int)block)) {
+            fsck_bad(w, *next + i);
+            return 0;
+        }
+    }
+    *next += e->length;
+    return 1;
+}
+
+
+/*****************************************************************/
+// remember that the mapping of inode is wrong from logical block "nr"
+void fsck_bad(fsck_walk *w, long long nr) {
+    if (nr > w->blocks) nr = w->blocks;
+    if (w->cut == -1 || nr < w->cut) w->cut = (int)nr;
+}
+
+
+/*****************************************************************/
+// verify that an inode may use a block for its mapping: inside disk, not metadata,
+// and, depending on mode, take it or verify it s its own. Two inodes that take
+// the same block are both marked, the lowest one keeps it
+// return 1 if the block can be used
+int fsck_use(fsck_walk *w, int block) {
+    if (block <= 0 || block >= sb.total_blocks || block_is_meta(block)) return 0;
+
+    int *owner = &w->state->owner[block];
+    int inode_index = w->inode_index;
+    if (w->mode == FSCK_CHECK) return __atomic_load_n(owner, __ATOMIC_RELAXED) == inode_index;
+    if (w->mode == FSCK_CLAIM_FREE) {
+        int none = -1;
+        if (!__atomic_compare_exchange_n(owner, &none, inode_index, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return none == inode_index;
+        }
+        w->used++;
+        return 1;
+    }
+
+    w->used++;
+    int old = __atomic_load_n(owner, __ATOMIC_RELAXED);
+    while (1) {
+        if (old == -1 || old > inode_index) {
+            if (!__atomic_compare_exchange_n(owner, &old, inode_index, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                continue;
+            }
+            if (old == -1) return 1;
+            __atomic_fetch_or(&w->state->flags[old], FSCK_SHARED, __ATOMIC_RELAXED);
+        }
+        if (old != inode_index) __atomic_fetch_or(&w->state->flags[inode_index], FSCK_SHARED, __ATOMIC_RELAXED);
+        return 1;
+    }
+}
+
+
+/*****************************************************************/
+// verify if block "nr" keeps metadata: superblock, group descriptors, journal,
+// or bitmaps, inode table and checksums at the start of a group
+// return 1 if it does
+int block_is_meta(int nr) {
+    return nr < group_data_start(nr / sb.blocks_per_group);
+}
+
+
+/*****************************************************************/
+// thread of the pass over directories: take chunks of inodes until none is left
+void *fsck_dir_worker(void *arg) {
+    fsck_state *s = (fsck_state *)arg;
+    int chunk;
+    while ((chunk = __atomic_fetch_add(&s->next_chunk, 1, __ATOMIC_RELAXED)) < s->chunks) {
+        int end = (chunk + 1) * FSCK_CHUNK;
+        if (end > sb.inode_count) end = sb.inode_count;
+        for (int i = chunk * FSCK_CHUNK; i < end; i++) {
+            if (!inode_in_use(i) || inodes[i].file_type != 1) continue;
+            fsck_dir(s, i);
+
+            // blocks of pointers read by bmap are let go after every directory
+            put_held_blocks();
+        }
+    }
+    return NULL;
+}
+
+
+/*****************************************************************/
+// verify a directory: its hash table and chains of buckets, "." and "..",
+// the count of entries, and give every other entry to fsck_dir_entry
+void fsck_dir(fsck_state *s, int dir) {
+    int count = (s->cut[dir] != -1) ? s->cut[dir] : inodes[dir].crtBLocks;
+    if (count < 2) {
+        fsck_report(s, "Directorul %d nu are antet sau galeti.", dir);
+        __atomic_fetch_or(&s->flags[dir], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+        return;
+    }
+
+    int *head_of = calloc(count, sizeof(int));      // chain of every bucket, by its first one
+    if (head_of == NULL) return;
+
+    directory_header *header = malloc(sb.block_size);
+    if (header == NULL) {
+        free(head_of);
+        return;
+    }
+    int header_block = bmap(dir, 0, 0);
+    memcpy(header, get_block(header_block), sb.block_size);
+    put_block(header_block);
+    int whole = fsck_dir_chains(dir, count, head_of);
+    int table_ok = whole;
+
+    int entries = 0, dots = 0, dotdots = 0, dots_ok = 1;
+    int parent = (dir == ROOT_INODE_INDEX) ? ROOT_INODE_INDEX : inodes[dir].parent_inode_index;
+    for (int nr = 1; nr < count; nr++) {
+        int block = bmap(dir, nr, 0);
+        if (block == -1) continue;
+        directory_bucket *bucket = (directory_bucket *)get_block(block);
+        int n = fsck_bucket_count(bucket, dir, table_ok ? header : NULL, head_of[nr]);
+        if (n != bucket->count) whole = 0;
+
+        for (int i = 0; i < n; i++) {
+            directory_entry *e = &bucket->entries[i];
+            if (!valid_name(e->filename)) {
+                whole = 0;
+                continue;
+            }
+            entries++;
+
+            // a name must be in the chain chosen by its hash
+            unsigned int hash = name_hash(e->filename, strlen(e->filename));
+            if (whole && fsck_dir_head(dir, header, hash) != head_of[nr]) whole = 0;
+
+            if (!strcmp(e->filename, ".")) {
+                dots++;
+                dots_ok &= (e->inode_index == dir);
+            } else if (!strcmp(e->filename, "..")) {
+                dotdots++;
+                dots_ok &= (e->inode_index == parent);
+            } else {
+                fsck_dir_entry(s, dir, e);
+            }
+        }
+        put_block(block);
+    }
+    free(head_of);
+    int header_count = header->count;
+    free(header);
+
+    if (!whole) {
+        fsck_report(s, "Directorul %d are tabela de dispersie sau galetile stricate.", dir);
+        __atomic_fetch_or(&s->flags[dir], FSCK_BAD_DIR, __ATOMIC_RELAXED);
+    }
+    if (dots != 1 || dotdots != 1 || !dots_ok) {
+        fsck_report(s, "Directorul %d are intrarile \".\" si \"..\" gresite.", dir);
+        __atomic_fetch_or(&s->flags[dir], FSCK_BAD_DOTS, __ATOMIC_RELAXED);
+    }
+    if (whole && header_count != entries) {
+        fsck_report(s, "Directorul %d are %d intrari in antet, dar %d in galeti.", dir, header_count, entries);
+        __atomic_fetch_or(&s->flags[dir], FSCK_BAD_COUNT, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*****************************************************************/
+// first bucket of the chain of "hash" in a directory whose tables were verified
+// by fsck_dir_chains
+int fsck_dir_head(int dir, directory_header *header, unsigned int hash) {
+    int nr = header->table[hash & ((1u << header->global_depth) - 1)];
+    int block = bmap(dir, nr, 0);
+    directory_index *index = (directory_index *)get_block(block);
+    if (index->local_depth == DIR_INDEX) {
+        nr = index->table[(hash >> dir_top_bits) & ((1u << index->depth) - 1)];
+    }
+    put_block(block);
+    return nr;
+}
+
+
+/*****************************************************************/
+// number of entries to trust in a bucket of "dir"; when its count is broken, keep the entries
+// up to the first one that is invalid, repeated or (with a good "header") in another chain
+int fsck_bucket_count(directory_bucket *bucket, int dir, directory_header *header, int head) {
+    if (bucket->count >= 0 && bucket->count <= (int)DIR_BUCKET_ENTRIES) return bucket->count;
+
+    int n = 0;
+    for (; n < (int)DIR_BUCKET_ENTRIES; n++) {
+        char *name = bucket->entries[n].filename;
+        if (!valid_name(name)) break;
+        if (header != NULL && fsck_dir_head(dir, header, name_hash(name, strlen(name))) != head) break;
+        int i = 0;
+        while (i < n && strcmp(bucket->entries[i].filename, name)) i++;
+        if (i < n) break;
+    }
+    return n;
+}
+
+
+/*****************************************************************/
+// follow the chain of every slot of the hash tables of a directory with "count" blocks;
+// "head_of" gets the first bucket of the chain of every bucket, -1 for an index block
+// return 1 if every bucket is in exactly one chain
+int fsck_dir_chains(int dir, int count, int *head_of) {
+    int header_block = bmap(dir, 0, 0);
+    directory_header *header = (directory_header *)get_block(header_block);
+    int depth = header->global_depth;
+    int whole = (depth >= 0 && depth <= dir_top_bits);
+
+    for (int slot = 0; whole && slot < (1 << depth); slot++) {
+        int head = header->table[slot];
+        if (head < 1 || head >= count) {
+            whole = 0;
+            break;
+        }
+        int block = bmap(dir, head, 0);
+        directory_index *index = (directory_index *)get_block(block);
+        if (index->local_depth != DIR_INDEX) {
+            whole = fsck_dir_chain(dir, count, head, depth, head_of);
+            put_block(block);
+            continue;
+        }
+
+        // an index block is kept by a single slot, when all bits of header are used
+        whole = (depth == dir_top_bits && head_of[head] == 0 &&
+                 index->count == 0 && index->depth >= 0 && index->depth <= dir_index_bits);
+        if (whole) head_of[head] = -1;
+        for (int i = 0; whole && i < (1 << index->depth); i++) {
+            whole = fsck_dir_chain(dir, count, index->table[i], dir_top_bits + index->depth, head_of);
+        }
+        put_block(block);
+    }
+    put_block(header_block);
+
+    for (int nr = 1; whole && nr < count; nr++) {
+        if (head_of[nr] == 0) whole = 0;
+    }
+    return whole;
+}
+
+
+/*****************************************************************/
+// follow the chain that starts at bucket "head", chosen by "depth" bits of hash
+// return 0 if it leaves the directory, meets another chain or a bucket has a wrong depth
+int fsck_dir_chain(int dir, int count, int head, int depth, int *head_of) {
+    if (head < 1 || head >= count) return 0;
+    if (head_of[head] == head) return 1;     // shared by slots with the same suffix
+    if (head_of[head] != 0) return 0;
+
+    int nr = head;
+    while (nr != 0) {
+        if (nr < 1 || nr >= count || head_of[nr] != 0) return 0;
+        head_of[nr] = head;
+
+        int block = bmap(dir, nr, 0);
+        directory_bucket *bucket = (directory_bucket *)get_block(block);
+        int ok = bucket->local_depth >= 0 &&
+                 bucket->local_depth <= (nr == head ? depth : dir_top_bits + dir_index_bits);
+        int next = bucket->overflow;
+        put_block(block);
+        if (!ok) return 0;
+        nr = next;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// verify the inode named by an entry of "dir"; the first name of an inode in the
+// directory it knows as parent is kept, the other names are decided by fsck_graph
+void fsck_dir_entry(fsck_state *s, int dir, directory_entry *e) {
+    int child = e->inode_index;
+    if (child < 0 || child >= sb.inode_count || child == dir || child == ROOT_INODE_INDEX) {
+        fsck_report(s, "Intrarea %s din directorul %d are inodul gresit %d.", e->filename, dir, child);
+        fsck_add_entry(s, dir, child, ENTRY_DANGLING, e->filename);
+        return;
+    }
+
+    if (!inode_in_use(child) || (s->flags[child] & FSCK_BAD_TYPE)) {
+        int type = inodes[child].file_type;
+        // a file that says it lives here lost only its bit
+        if (!inode_in_use(child) && inodes[child].parent_inode_index == dir && type == 0) {
+            fsck_report(s, "Inodul %d, numit %s in directorul %d, este liber in harta inodurilor.",
+                        child, e->filename, dir);
+            fsck_add_entry(s, dir, child, ENTRY_REVIVE, e->filename);
+            return;
+        }
+        fsck_report(s, "Intrarea %s din directorul %d indica inodul nefolosit %d.", e->filename, dir, child);
+        fsck_add_entry(s, dir, child, ENTRY_DANGLING, e->filename);
+        return;
+    }
+
+    if (inodes[child].parent_inode_index == dir &&
+        !(__atomic_fetch_or(&s->flags[child], FSCK_NAMED, __ATOMIC_RELAXED) & FSCK_NAMED)) {
+        return;
+    }
+    fsck_add_entry(s, dir, child, ENTRY_EXTRA, e->filename);
+}
+
+
+/*****************************************************************/
+// verify if a name of entry ends inside its field, isn t empty and has no '/'
+// return 1 if it s valid
+int valid_name(const char *name) {
+    const char *end = memchr(name, '\0', MAX_FILE_NAME + 1);
+    return end != NULL && end != name && memchr(name, '/', end - name) == NULL;
+}
+
+
+/*****************************************************************/
+// decide the names of inodes with more than one, or none where their parent says;
+// then every inode in use must be reached from root by its parents
+void fsck_graph(fsck_state *s) {
+    if (!inode_in_use(ROOT_INODE_INDEX) || inodes[ROOT_INODE_INDEX].file_type != 1) {
+        fsck_report(s, "Directorul radacina lipseste.");
+        s->flags[ROOT_INODE_INDEX] |= FSCK_BAD_DIR;
+    } else if (inodes[ROOT_INODE_INDEX].parent_inode_index != ROOT_INODE_INDEX) {
+        fsck_report(s, "Directorul radacina are parintele %d.", inodes[ROOT_INODE_INDEX].parent_inode_index);
+    }
+    s->parent[ROOT_INODE_INDEX] = ROOT_INODE_INDEX;
+
+    // threads found the entries in any order; an inode without the name its parent
+    // says keeps the first one found in another directory
+    if (s->entry_count > 0) qsort(s->entries, s->entry_count, sizeof(fsck_entry), compare_fsck_entry);
+    for (int i = 0; i < s->entry_count; i++) {
+        fsck_entry *e = &s->entries[i];
+        if (e->kind == ENTRY_REVIVE) {
+            if (!(s->flags[e->inode] & FSCK_NAMED)) {
+                s->flags[e->inode] |= FSCK_NAMED;
+                continue;
+            }
+            e->kind = ENTRY_EXTRA;
+        }
+        if (e->kind != ENTRY_EXTRA) continue;
+
+        if (s->flags[e->inode] & FSCK_NAMED) {
+            fsck_report(s, "Inodul %d are un nume in plus: %s din directorul %d.", e->inode, e->name, e->dir);
+            continue;
+        }
+        fsck_report(s, "Inodul %d are parintele %d, dar numele lui este in directorul %d.", e->inode,
+                    inodes[e->inode].parent_inode_index, e->dir);
+        e->kind = ENTRY_ADOPT;
+        s->flags[e->inode] |= FSCK_NAMED;
+        s->parent[e->inode] = e->dir;
+    }
+
+    // climb from every inode until root, an inode already decided, one without
+    // name or one met again on the way up (a cycle of directories)
+    unsigned char *reach = calloc(sb.inode_count, 1);     // 1 on the way, 2 reached, 3 lost
+    int *path = malloc(sb.inode_count * sizeof(int));
+    if (reach == NULL || path == NULL) {
+        free(reach);
+        free(path);
+        return;
+    }
+    for (int i = 0; i < sb.inode_count; i++) {
+        if (!inode_in_use(i) || (s->flags[i] & FSCK_BAD_TYPE) || reach[i] != 0) continue;
+
+        int depth = 0, x = i, result;
+        while (1) {
+            if (x == ROOT_INODE_INDEX) {
+                result = 2;
+                break;
+            }
+            if (reach[x] >= 2) {
+                result = reach[x];
+                break;
+            }
+            if (reach[x] == 1) {
+                fsck_report(s, "Directorul %d face parte dintr-un ciclu de directoare.", x);
+                fsck_add_entry(s, s->parent[x], x, ENTRY_LOST, "");
+                result = 3;
+                break;
+            }
+            if (!(s->flags[x] & FSCK_NAMED)) {
+                fsck_report(s, "Inodul %d nu are nume in niciun director.", x);
+                fsck_add_entry(s, -1, x, ENTRY_LOST, "");
+                result = 3;
+                break;
+            }
+            reach[x] = 1;
+            path[depth++] = x;
+            x = s->parent[x];
+        }
+        while (depth > 0) {
+            reach[path[--depth]] = result;
+        }
+    }
+    free(reach);
+    free(path);
+}
+
+
+/*****************************************************************/
+// order entries by directory, then by name
+int compare_fsck_entry(const void *a, const void *b) {
+    const fsck_entry *x = (const fsck_entry *)a, *y = (const fsck_entry *)b;
+    if (x->dir != y->dir) return (x->dir < y->dir) ? -1 : 1;
+    int names = strcmp(x->name, y->name);
+    if (names != 0) return names;
+    return (x->inode < y->inode) ? -1 : (x->inode > y->inode);
+}
+
+
+/*****************************************************************/
+// compare the bitmap of blocks with the blocks used by metadata and inodes,
+// and the free counters of groups and superblock with the bitmaps
+void fsck_maps(fsck_state *s) {
+    int missing = 0, leaked = 0, first_missing = -1, first_leaked = -1;
+    for (int i = 0; i < sb.total_blocks; i++) {
+        int used = (s->owner[i] != -1) || block_is_meta(i);
+        int marked = find_bit_value(bm.block_map, i, BLOCK_MAP_LEN);
+        if (used && !marked) {
+            if (missing++ == 0) first_missing = i;
+        } else if (!used && marked) {
+            if (leaked++ == 0) first_leaked = i;
+        }
+    }
+    if (missing > 0) {
+        fsck_report(s, "%d blocuri folosite sunt libere in harta blocurilor, primul este %d.",
+                    missing, first_missing);
+    }
+    if (leaked > 0) {
+        fsck_report(s, "%d blocuri sunt ocupate in harta blocurilor, dar nu sunt folosite, primul este %d.",
+                    leaked, first_leaked);
+    }
+
+    int free_blocks = 0, free_inodes = 0;
+    for (int g = 0; g < sb.group_count; g++) {
+        int blocks = 0, nodes = 0;
+        for (int i = g * sb.blocks_per_group; i < group_end(g); i++) {
+            blocks += (find_bit_value(bm.block_map, i, BLOCK_MAP_LEN) == 0);
+        }
+        for (int i = g * sb.inodes_per_group; i < (g + 1) * sb.inodes_per_group; i++) {
+            nodes += (find_bit_value(bm.inode_map, i, INODE_MAP_LEN) == 0);
+        }
+        if (groups[g].free_blocks != blocks) {
+            fsck_report(s, "Grupul %d are %d blocuri libere, harta are %d.", g, groups[g].free_blocks, blocks);
+        }
+        if (groups[g].free_inodes != nodes) {
+            fsck_report(s, "Grupul %d are %d inoduri libere, harta are %d.", g, groups[g].free_inodes, nodes);
+        }
+        free_blocks += blocks;
+        free_inodes += nodes;
+    }
+    if (sb.free_blocks != free_blocks) {
+        fsck_report(s, "Superblocul are %d blocuri libere, harta are %d.", sb.free_blocks, free_blocks);
+    }
+    if (sb.free_nodes != free_inodes) {
+        fsck_report(s, "Superblocul are %d inoduri libere, harta are %d.", sb.free_nodes, free_inodes);
+    }
+}
+
+
+/*****************************************************************/
+// repair what fsck_check found: inodes first, so every block in use is known before
+// rebuilt directories take new ones, then names, and at last the bitmaps
+void fsck_repair(fsck_state *s, int threads) {
+    struct inode *root = &inodes[ROOT_INODE_INDEX];
+    if (!inode_in_use(ROOT_INODE_INDEX) || root->file_type != 1) {
+        if (inode_in_use(ROOT_INODE_INDEX) && !is_inline(ROOT_INODE_INDEX)) fsck_detach(s, ROOT_INODE_INDEX, 0);
+        memset(root, 0, sizeof(*root));
+        root->file_type = 1;
+        set_bit_to_value(bm.inode_map, ROOT_INODE_INDEX, INODE_MAP_LEN, 1);
+    }
+    root->parent_inode_index = ROOT_INODE_INDEX;
+
+    // an inode of unknown type is dropped, its blocks become free with the bitmap
+    for (int i = 0; i < sb.inode_count; i++) {
+        if (!inode_in_use(i)) continue;
+        if (s->flags[i] & FSCK_BAD_TYPE) {
+            memset(&inodes[i], 0, sizeof(struct inode));
+            set_bit_to_value(bm.inode_map, i, INODE_MAP_LEN, 0);
+            continue;
+        }
+        if (s->cut[i] != -1) fsck_detach(s, i, s->cut[i]);
+        if (s->cut[i] != -1 || (s->flags[i] & FSCK_BAD_SIZE)) fsck_fix_size(s, i);
+    }
+    for (int i = 0; i < s->entry_count; i++) {
+        if (s->entries[i].kind == ENTRY_REVIVE) fsck_revive(s, s->entries[i].inode);
+    }
+
+    // blocks of inodes can t be taken while directories are rebuilt
+    fsck_set_map(s, 0);
+    fsck_count_free();
+
+    for (int i = 0; i < sb.inode_count; i++) {
+        if (!inode_in_use(i) || inodes[i].file_type != 1) continue;
+        if (s->flags[i] & FSCK_BAD_DIR) {
+            fsck_rebuild_dir(s, i);
+            continue;
+        }
+        if (s->flags[i] & FSCK_BAD_DOTS) fsck_fix_dots(i, s->parent[i]);
+        if (s->flags[i] & FSCK_BAD_COUNT) fsck_fix_count(i);
+    }
+
+    for (int i = 0; i < s->entry_count; i++) {
+        fsck_entry *e = &s->entries[i];
+        switch (e->kind) {
+            case ENTRY_DANGLING:
+            case ENTRY_EXTRA:
+                dir_remove_entry(e->dir, e->name);
+                break;
+            case ENTRY_ADOPT:
+                inodes[e->inode].parent_inode_index = e->dir;
+                if (inodes[e->inode].file_type == 1) fsck_fix_dots(e->inode, e->dir);
+                break;
+            case ENTRY_LOST:
+                fsck_reconnect(s, e);
+                break;
+            default:        // revived before
+                break;
+        }
+    }
+    put_held_blocks();
+
+    // names and mappings remembered before are not valid anymore
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        dcache.slots[i].valid = 0;
+    }
+    memset(inode_names, 0, (size_t)sb.inode_count * (MAX_FILE_NAME + 1));
+    memset(bmap_cache, 0, sb.inode_count * sizeof(struct bmap_cache));
+    if (!inode_in_use(crtInode) || inodes[crtInode].file_type != 1) crtInode = ROOT_INODE_INDEX;
+
+    // the bitmap of blocks is made again from the blocks that inodes use now
+    for (int i = 0; i < sb.total_blocks; i++) {
+        s->owner[i] = -1;
+    }
+    s->quiet = 1;
+    s->next_chunk = 0;
+    run_threads(threads, fsck_inode_worker, s);
+    s->quiet = 0;
+    fsck_set_map(s, 1);
+    fsck_count_free();
+}
+
+
+/*****************************************************************/
+// drop the mapping of an inode from logical block "keep" on, without freeing
+// blocks: the ones nobody uses anymore become free when the bitmap is made again
+void fsck_detach(fsck_state *s, int inode_index, int keep) {
+    struct inode *in = &inodes[inode_index];
+
+    if (sb.features & FEATURE_EXTENTS) {
+        extent_root *root = &in->extents;
+        if (root->depth < 0 || root->depth > EXTENT_MAX_DEPTH || root->count < 0 ||
+            root->count > EXTENTS_IN_INODE) {
+            memset(root, 0, sizeof(*root));
+        }
+
+        // extents before "keep" are whole, the one that crosses it is shortened
+        long long next = 0;
+        root->count = fsck_detach_node(root->entries, root->count, root->depth, &next, keep);
+        if (root->count == 0) root->depth = 0;
+    } else {
+        for (int i = keep; i < MAX_DIRECT_BLOCKS; i++) {
+            in->direct_blocks[i] = 0;
+        }
+        long long first = MAX_DIRECT_BLOCKS;
+        long long span = PTRS_PER_BLOCK;
+        for (int level = 0; level < INDIRECT_LEVELS; level++) {
+            fsck_detach_tree(s, inode_index, &in->indirect_blocks[level], level, first, keep);
+            first += span;
+            span *= PTRS_PER_BLOCK;
+        }
+    }
+
+    if (in->crtBLocks > keep) in->crtBLocks = keep;
+    if (keep == 0) memset(in->inline_data, 0, INLINE_DATA_LEN);
+    bmap_cache[inode_index] = (struct bmap_cache){{0, 0}, 0, 0};
+}
+
+
+/*****************************************************************/
+// keep the entries of a node of the tree of extents ("depth" levels above the leaves)
+// that map blocks before "keep"; "next" is the first logical block of the node
+// return number of entries kept
+int fsck_detach_node(extent *list, int count, int depth, long long *next, int keep) {
+    int kept = 0;
+    while (kept < count && *next < keep) {
+        extent *e = &list[kept];
+        if (depth == 0) {
+            if (*next + e->length > keep) e->length = keep - *next;
+            *next += e->length;
+            kept++;
+            continue;
+        }
+
+        extent_leaf *node = (extent_leaf *)get_block(e->start);
+        int below = node->count;
+        if (below < 0) below = 0;
+        if (below > EXTENTS_PER_LEAF) below = EXTENTS_PER_LEAF;
+        node->count = fsck_detach_node(node->entries, below, depth - 1, next, keep);
+        mark_meta_dirty(e->start);
+        put_block(e->start);
+        if (node->count == 0) break;
+        kept++;
+    }
+    return kept;
+}
+
+
+/*****************************************************************/
+// drop what a block of pointers maps from logical block "keep" on; "first" is the
+// first logical block it maps, "depth" is 0 if it points to data
+void fsck_detach_tree(fsck_state *s, int inode_index, int *slot, int depth, long long first, int keep) {
+    if (*slot == 0) return;
+
+    fsck_walk w = {s, inode_index, FSCK_CHECK, 0, -1, 0};
+    if (first >= keep || !fsck_use(&w, *slot)) {
+        *slot = 0;
+        return;
+    }
+
+    long long span = 1;
+    for (int i = 0; i < depth; i++) {
+        span *= PTRS_PER_BLOCK;
+    }
+    int *ptrs = (int *)get_block(*slot);
+    for (int i = 0; i < PTRS_PER_BLOCK; i++) {
+        long long child_first = first + i * span;
+        if (child_first + span <= keep) continue;
+        if (depth == 0 || child_first >= keep) {
+            ptrs[i] = 0;
+        } else {
+            fsck_detach_tree(s, inode_index, &ptrs[i], depth - 1, child_first, keep);
+        }
+    }
+    mark_meta_dirty(*slot);
+    put_block(*slot);
+}
+
+
+/*****************************************************************/
+// make the size of an inode agree with its blocks; blocks after the size of a file are dropped
+void fsck_fix_size(fsck_state *s, int inode_index) {
+    struct inode *in = &inodes[inode_index];
+    long long room = (long long)in->crtBLocks * sb.block_size;
+
+    if (is_inline(inode_index)) {
+        if (in->file_size < 0) in->file_size = 0;
+        if (in->file_size > INLINE_DATA_LEN) in->file_size = INLINE_DATA_LEN;
+        return;
+    }
+    if (in->file_type == 1) {
+        in->file_size = room;
+        return;
+    }
+
+    if (in->file_size < 0) in->file_size = 0;
+    if (in->file_size > room) in->file_size = room;
+    int needed = ((long long)in->file_size + sb.block_size - 1) / sb.block_size;
+    if (needed < in->crtBLocks) fsck_detach(s, inode_index, needed);
+}
+
+
+/*****************************************************************/
+// take back a file that lost only its bit in the bitmap of inodes, with the
+// blocks that nobody else uses
+void fsck_revive(fsck_state *s, int inode_index) {
+    set_bit_to_value(bm.inode_map, inode_index, INODE_MAP_LEN, 1);
+    if (is_inline(inode_index)) {
+        fsck_fix_size(s, inode_index);
+        return;
+    }
+
+    int cut = fsck_walk_inode(s, inode_index, FSCK_CLAIM_FREE, NULL);
+    if (cut != -1) fsck_detach(s, inode_index, cut);
+    fsck_fix_size(s, inode_index);
+}
+
+
+/*****************************************************************/
+// make a directory again from the names found in its buckets; a name found twice
+// gets the number of its inode instead
+void fsck_rebuild_dir(fsck_state *s, int dir) {
+    int len = 0, size = 16;
+    directory_entry *found = malloc(size * sizeof(directory_entry));
+    if (found == NULL) return;
+
+    for (int nr = 1; nr < inodes[dir].crtBLocks; nr++) {
+        int block = bmap(dir, nr, 0);
+        if (block == -1) continue;
+        directory_bucket *bucket = (directory_bucket *)get_block(block);
+        int n = fsck_bucket_count(bucket, dir, NULL, 0);
+        for (int i = 0; i < n; i++) {
+            directory_entry *e = &bucket->entries[i];
+            if (!valid_name(e->filename) || !strcmp(e->filename, ".") || !strcmp(e->filename, "..")) continue;
+            if (len == size) {
+                size *= 2;
+                directory_entry *bigger = realloc(found, size * sizeof(directory_entry));
+                if (bigger == NULL) break;
+                found = bigger;
+            }
+            found[len++] = *e;
+        }
+        put_block(block);
+    }
+
+    fsck_detach(s, dir, 0);
+    inodes[dir].file_size = 0;
+    if (dir_init(dir, s->parent[dir])) {
+        for (int i = 0; i < len; i++) {
+            if (dir_lookup(dir, found[i].filename, strlen(found[i].filename)) != -1) {
+                snprintf(found[i].filename, sizeof(found[i].filename), "#%d", found[i].inode_index);
+            }
+            dir_add_entry(dir, found[i].filename, found[i].inode_index);
+        }
+    }
+    free(found);
+}
+
+
+/*****************************************************************/
+// write again "." and ".." of a directory
+void fsck_fix_dots(int dir, int parent) {
+    while (dir_remove_entry(dir, "."));
+    while (dir_remove_entry(dir, ".."));
+    dir_add_entry(dir, ".", dir);
+    dir_add_entry(dir, "..", parent);
+}
+
+
+/*****************************************************************/
+// count again the entries of a directory in its header
+void fsck_fix_count(int dir) {
+    int count = 0;
+    for (int nr = 1; nr < inodes[dir].crtBLocks; nr++) {
+        directory_bucket *bucket = (directory_bucket *)inode_block(dir, nr);
+        if (bucket != NULL) count += bucket->count;
+    }
+    directory_header *header = (directory_header *)inode_block(dir, 0);
+    header->count = count;
+    dirty_inode_block(dir, 0);
+}
+
+
+/*****************************************************************/
+// give an inode that can t be reached from root a name in /lost+found, like e2fsck;
+// a directory of a cycle loses first its name in the cycle
+void fsck_reconnect(fsck_state *s, fsck_entry *e) {
+    int inode_index = e->inode;
+    if (e->dir != -1) {
+        dir_iter it;
+        directory_entry *entry;
+        char name[MAX_FILE_NAME + 1] = "";
+        dir_iter_start(&it, e->dir);
+        while ((entry = dir_iter_next(&it)) != NULL) {
+            if (entry->inode_index == inode_index && strcmp(entry->filename, ".") && strcmp(entry->filename, "..")) {
+                strcpy(name, entry->filename);
+                break;
+            }
+        }
+        if (name[0] != '\0') dir_remove_entry(e->dir, name);
+    }
+
+    int lost = dir_lookup(ROOT_INODE_INDEX, "lost+found", strlen("lost+found"));
+    if (lost == -1) {
+        if (create_dir(ROOT_INODE_INDEX, "lost+found") < 0) return;
+        lost = dir_lookup(ROOT_INODE_INDEX, "lost+found", strlen("lost+found"));
+    }
+    if (lost == -1 || inodes[lost].file_type != 1) return;
+
+    char name[MAX_FILE_NAME + 1];
+    snprintf(name, sizeof(name), "#%d", inode_index);
+    if (!dir_add_entry(lost, name, inode_index)) return;
+    inodes[inode_index].parent_inode_index = lost;
+    s->parent[inode_index] = lost;
+    if (inodes[inode_index].file_type == 1) fsck_fix_dots(inode_index, lost);
+}
+
+
+/*****************************************************************/
+// mark in the bitmap the blocks of metadata and those used by inodes; with "exact",
+// the other blocks are marked free
+void fsck_set_map(fsck_state *s, int exact) {
+    for (int i = 0; i < sb.total_blocks; i++) {
+        int used = (s->owner[i] != -1) || block_is_meta(i);
+        if (used || exact) set_bit_to_value(bm.block_map, i, BLOCK_MAP_LEN, used);
+    }
+}
+
+
+/*****************************************************************/
+// count free blocks and inodes again after the bitmaps were changed by fsck
+void fsck_count_free() {
+    allocator_init(&block_alloc);
+    allocator_init(&inode_alloc);
+    groups_count_free();
+
+    int free_blocks = 0, free_inodes = 0;
+    for (int g = 0; g < sb.group_count; g++) {
+        free_blocks += groups[g].free_blocks;
+        free_inodes += groups[g].free_inodes;
+    }
+    sb.free_blocks = free_blocks;
+    sb.free_nodes = free_inodes;
+}
+
+
+/*****************************************************************/
+// background thread that syncs the disk every "flush_interval" seconds, until unmount
+void *flusher(void *arg) {
+    pthread_mutex_lock(&flush.lock);
+    while (!flush.stop) {
+        struct timespec wake_at;
+        clock_gettime(CLOCK_REALTIME, &wake_at);
+        wake_at.tv_sec += flush_interval;
+        if (pthread_cond_timedwait(&flush.wake, &flush.lock, &wake_at) == 0) continue;
+        pthread_mutex_unlock(&flush.lock);
+
+        // a sync takes the disk alone, after the calls in progress
+        pthread_rwlock_wrlock(&fs_rwlock);
+        if (mounted) {
+            sync_disk();
+            put_held_blocks();
+        }
+        pthread_rwlock_unlock(&fs_rwlock);
+        pthread_mutex_lock(&flush.lock);
+    }
+    pthread_mutex_unlock(&flush.lock);
+    return NULL;
+}
+
+/*****************************************************************/
+// take the disk for one call of the API, shared with other calls or alone if "exclusive"
+// return 1 if a disk is mounted, else nothing is taken
+int fs_lock(int exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&fs_rwlock);
+    } else {
+        pthread_rwlock_rdlock(&fs_rwlock);
+    }
+    if (!mounted) {
+        pthread_rwlock_unlock(&fs_rwlock);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*****************************************************************/
+// end a call of the API: let the cache replace the blocks used by this one
+// and commit before the next call could overflow the journal
+// return "result", the result of the call
+int fs_unlock(int result) {
+    put_held_blocks();
+    int full = journal_full();
+    pthread_rwlock_unlock(&fs_rwlock);
+
+    // other calls may commit first
+    if (full) {
+        pthread_rwlock_wrlock(&fs_rwlock);
+        if (mounted && journal_full()) {
+            sync_disk();
+            put_held_blocks();
+        }
+        pthread_rwlock_unlock(&fs_rwlock);
+    }
+    return result;
+}
+
+
+/*****************************************************************/
+// lock an inode with READ_LOCK, shared with other readers, or WRITE_LOCK, alone
+void lock_inode(int inode_index, int mode) {
+    if (mode == WRITE_LOCK) {
+        pthread_rwlock_wrlock(&inode_locks[inode_index]);
+    } else {
+        pthread_rwlock_rdlock(&inode_locks[inode_index]);
+    }
+}
+
+
+/*****************************************************************/
+// unlock an inode locked with lock_inode
+void unlock_inode(int inode_index) {
+    pthread_rwlock_unlock(&inode_locks[inode_index]);
+}
+
+
+/*****************************************************************/
+// verify that an inode belongs to a file or directory; a removed one
+// may be found by a thread that walked its path before
+// return 1 if it s used
+int inode_in_use(int inode_index) {
+    return find_bit_value(bm.inode_map, inode_index, INODE_MAP_LEN) == 1;
+}
+
+
+/*****************************************************************/
+// type of an inode, read without its lock while paths are walked
+int inode_type(int inode_index) {
+    return __atomic_load_n(&inodes[inode_index].file_type, __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// find the inode of "path" and lock it with "mode"; the directory of its last name
+// is locked first with "dir_mode" and stays locked only if "parent" is given, so the
+// name can t change until the caller unlocks it. "parent" is -1 when no directory
+// stays locked: a path without names, or that ends with "." or ".."
+// return inode, -2 if only the last name doesn t exist (its directory stays locked
+// if "parent" is given), or -1 if path is wrong
+int lock_path(const char *path, int dir_mode, int mode, int *parent, char **name) {
+    int dir;
+    int inode = find_inode_of_path((unsigned char *)path, cwd_inode(),
+                                   &dir, (unsigned char **)name, dir_mode);
+    if (parent != NULL) *parent = -1;
+    if (inode == -1) return -1;
+
+    if (inode == -2) {
+        if (parent != NULL) {
+            *parent = dir;
+        } else {
+            unlock_inode(dir);
+        }
+        return -2;
+    }
+
+    // the directory itself or its parent can t be locked after the directory
+    if (dir == -1 || inode == dir || inode == inodes[dir].parent_inode_index) {
+        if (dir != -1) unlock_inode(dir);
+        lock_inode(inode, mode);
+        if (!inode_in_use(inode)) {
+            unlock_inode(inode);
+            return -1;
+        }
+        return inode;
+    }
+
+    // a parent before its child
+    lock_inode(inode, mode);
+    if (parent != NULL) {
+        *parent = dir;
+    } else {
+        unlock_inode(dir);
+    }
+    return inode;
+}
+
+
+/*****************************************************************/
+// fill options with the values used when nothing is chosen
+void fs_default_options(fs_options *opts) {
+    opts->block_size = DEFAULT_BLOCK_SIZE;
+    opts->blocks = DEFAULT_NR_BLOCKS;
+    opts->inodes = DEFAULT_INODES;
+    opts->group_blocks = 0;
+    opts->extents = 0;
+    opts->journal = 1;
+    opts->inline_data = 1;
+    opts->checksums = 0;
+    opts->mmap = 0;
+    opts->cache_kb = DEFAULT_CACHE_KB;
+    opts->flush_interval = FLUSH_INTERVAL;
+    opts->io = "sync";
+    opts->fatal = NULL;
+}
+
+
+/*****************************************************************/
+// use options for the next mount; NULL chooses the default ones
+void set_options(const fs_options *opts) {
+    fs_options defaults;
+    if (opts == NULL) {
+        fs_default_options(&defaults);
+        opts = &defaults;
+    }
+
+    mkfs_block_size = opts->block_size;
+    mkfs_blocks = opts->blocks;
+    mkfs_inodes = opts->inodes;
+    mkfs_group_blocks = opts->group_blocks;
+    mkfs_features = (opts->extents ? FEATURE_EXTENTS : 0) | (opts->journal ? FEATURE_JOURNAL : 0) |
+                    (opts->inline_data ? FEATURE_INLINE_DATA : 0) | (opts->checksums ? FEATURE_CHECKSUMS : 0);
+    use_mmap = opts->mmap;
+    cache_kb = opts->cache_kb;
+    flush_interval = opts->flush_interval;
+    device_name = opts->io;
+    fatal_handler = opts->fatal;
+}
+
+
+/*****************************************************************/
+// create a new empty disk in "image", over the old one, and mount it
+// return 0 for success or a negative error code
+int fs_mkfs(const char *image, const fs_options *opts) {
+    if (mounted) return -EBUSY;
+
+    set_options(opts);
+    int err = layout_superblock(mkfs_block_size, mkfs_blocks, mkfs_inodes, mkfs_features, mkfs_group_blocks);
+    if (err < 0) return err;
+    if (unlink(image) == -1 && errno != ENOENT) return -errno;
+
+    err = fs_mount(image, opts);
+    if (err < 0) return err;
+    return (fs_sync() < 0) ? -EIO : 0;
+}
+
+
+/*****************************************************************/
+// open the disk from "image", or create it if it doesn t exist, and start
+// the background syncs
+// return 0 for success or a negative error code
+int fs_mount(const char *image, const fs_options *opts) {
+    pthread_rwlock_wrlock(&fs_rwlock);
+    if (mounted) {
+        pthread_rwlock_unlock(&fs_rwlock);
+        return -EBUSY;
+    }
+
+    set_options(opts);
+    disk_name = image;
+    disk_converted = 0;
+    int err = filesystem_init();
+    put_held_blocks();
+    if (err < 0) {
+        close_disk();
+        pthread_rwlock_unlock(&fs_rwlock);
+        return err;
+    }
+
+    for (int fd = 0; fd < MAX_OPEN_FILES; fd++) {
+        pthread_mutex_init(&files[fd].lock, NULL);
+        files[fd].inode_index = -1;
+    }
+    crtInode = ROOT_INODE_INDEX;
+    mounted = 1;
+    pthread_rwlock_unlock(&fs_rwlock);
+
+    // write modified blocks in background from time to time
+    flush.stop = 0;
+    flush.running = (flush_interval > 0 && pthread_create(&flush.thread, NULL, flusher, NULL) == 0);
+    return 0;
+}
+
+
+/*****************************************************************/
+// stop the background syncs, save everything and close the disk
+// return 0 for success or a negative error code
+int fs_unmount() {
+    if (!fs_lock(1)) return -ENODEV;
+
+    long bytes = sync_disk();
+    put_held_blocks();
+    free_held_blocks();
+    mounted = 0;
+    pthread_rwlock_unlock(&fs_rwlock);
+
+    // a flusher that woke up meanwhile finds the disk unmounted
+    pthread_mutex_lock(&flush.lock);
+    flush.stop = 1;
+    pthread_cond_signal(&flush.wake);
+    pthread_mutex_unlock(&flush.lock);
+    if (flush.running) {
+        pthread_join(flush.thread, NULL);
+        flush.running = 0;
+    }
+    close_disk();
+    return (bytes == -1) ? -EIO : 0;
+}
+
+
+/*****************************************************************/
+// write modified blocks to disk
+// return number of written bytes or a negative error code
+long fs_sync() {
+    if (!fs_lock(1)) return -ENODEV;
+
+    long bytes = sync_disk();
+    fs_unlock(0);
+    return (bytes == -1) ? -EIO : bytes;
+}
+
+
+/*****************************************************************/
+// describe the geometry of the mounted disk and its free space
+// return 0 for success or a negative error code
+int fs_statfs(struct fs_info *info) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    info->block_size = sb.block_size;
+    info->total_blocks = sb.total_blocks;
+    info->inode_count = sb.inode_count;
+    info->group_count = sb.group_count;
+    info->data_blocks_start = sb.data_blocks_start;
+    info->mapped = use_mmap;
+    info->io = use_mmap ? NULL : device->name;
+    info->converted = disk_converted;
+    info->bad_blocks = __atomic_load_n(&csum_stats.bad_blocks, __ATOMIC_RELAXED);
+    info->free_blocks = __atomic_load_n(&sb.free_blocks, __ATOMIC_RELAXED);
+    info->free_inodes = 0;
+    for (int g = 0; g < sb.group_count; g++) {
+        info->free_inodes += __atomic_load_n(&groups[g].free_inodes, __ATOMIC_RELAXED);
+    }
+    return fs_unlock(0);
+}
+
+
+/*****************************************************************/
+// copy the counters of caches, journal and devices in "stats", and the free blocks
+// and inodes of the first "len" groups in "group" (fs_statfs tells how many there are)
+// return 0 for success or a negative error code
+int fs_stats(struct fs_stats *stats, struct fs_group *group, int len) {
+    if (!fs_lock(1)) return -ENODEV;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->dcache_hits = dcache.hits;
+    stats->dcache_misses = dcache.misses;
+    stats->bmap_hits = bmap_hits;
+    stats->bmap_misses = bmap_misses;
+    stats->syncs = sync_stats.syncs;
+    stats->last_sync_bytes = sync_stats.last_bytes;
+    stats->sync_bytes = sync_stats.total_bytes;
+
+    if (sb.features & FEATURE_JOURNAL) {
+        stats->journal_blocks = sb.journal_blocks;
+        stats->commits = journal.commits;
+        stats->flushes = journal.flushes;
+        stats->journal_bytes = journal.bytes;
+        stats->overflows = journal.overflows;
+    }
+    stats->first_bad = -1;
+    if (sb.features & FEATURE_CHECKSUMS) {
+        stats->checksums = 1;
+        stats->hardware_crc = (crc32c_update != crc32c_table);
+        stats->verified = csum_stats.verified;
+        stats->checksum_errors = csum_stats.errors;
+        stats->bad_blocks = csum_stats.bad_blocks;
+        stats->first_bad = csum_stats.first_bad;
+    }
+
+    if (!use_mmap) {
+        stats->cached = 1;
+        stats->cache_hits = bcache.hits;
+        stats->cache_misses = bcache.misses;
+        stats->evictions = bcache.evictions;
+        stats->writebacks = bcache.writebacks;
+        stats->cache_blocks = bcache.count;
+        stats->cache_budget = bcache.budget;
+        stats->ahead_read = ahead.read;
+        stats->ahead_used = ahead.used;
+        stats->ahead_wasted = ahead.wasted;
+        stats->ahead_window = ahead.max_window;
+        stats->behind_batches = ahead.batches;
+        stats->behind_blocks = ahead.written;
+        stats->io = device->name;
+        stats->registered = ring.registered;
+        stats->io_batches = io_stats.batches;
+        stats->io_requests = io_stats.requests;
+        stats->io_blocks = io_stats.blocks;
+        stats->io_nanos = io_stats.nanos;
+    }
+
+    for (int g = 0; g < sb.group_count && g < len; g++) {
+        group[g].free_blocks = groups[g].free_blocks;
+        group[g].free_inodes = groups[g].free_inodes;
+    }
+    return fs_unlock(0);
+}
+
+
+/*****************************************************************/
+// error of a path that wasn t found; "name" is its last name
+// return a negative error code
+int lookup_error(const char *name) {
+    if (name != NULL && strlen(name) > MAX_FILE_NAME) return -ENAMETOOLONG;
+    return -ENOENT;
+}
+
+
+/*****************************************************************/
+// open the file or directory of "path" with FS_O_* "flags"
+// return a descriptor or a negative error code
+int fs_open(const char *path, int flags) {
+    if ((flags & FS_O_ACCMODE) == FS_O_ACCMODE) return -EINVAL;
+    if (!fs_lock(0)) return -ENODEV;
+
+    // a new name changes the directory, a truncated file changes too
+    int writes = (flags & FS_O_ACCMODE) != FS_O_RDONLY;
+    int mode = (writes && (flags & FS_O_TRUNC)) ? WRITE_LOCK : READ_LOCK;
+    int parent_inode;
+    char *name = NULL;      // find_inode_of_path replaces it
+    int inode = lock_path(path, (flags & FS_O_CREAT) ? WRITE_LOCK : READ_LOCK, mode, &parent_inode, &name);
+    if (inode == -2 && (flags & FS_O_CREAT)) {
+        inode = create_file(parent_inode, name);
+        if (inode >= 0) lock_inode(inode, mode);
+    } else if (inode >= 0 && (flags & FS_O_CREAT) && (flags & FS_O_EXCL)) {
+        unlock_inode(inode);
+        inode = -EEXIST;
+    } else if (inode < 0) {
+        inode = lookup_error(name);
+    }
+    if (parent_inode != -1) unlock_inode(parent_inode);
+    free(name);
+    if (inode < 0) return fs_unlock(inode);
+
+    int fd = open_inode(inode, flags);
+    unlock_inode(inode);
+    return fs_unlock(fd);
+}
+
+
+/*****************************************************************/
+// give a descriptor to an inode locked by fs_open
+// return the descriptor or a negative error code
+int open_inode(int inode, int flags) {
+    int writes = (flags & FS_O_ACCMODE) != FS_O_RDONLY;
+    if (inodes[inode].file_type == 1 && writes) return -EISDIR;
+
+    dir_iter dir;
+    if (inodes[inode].file_type == 1) {
+        dir_iter_start(&dir, inode);
+    }
+
+    // a descriptor is seen by fs_read and the others only after it s filled
+    pthread_mutex_lock(&files_lock);
+    int fd = 0;
+    while (fd < MAX_OPEN_FILES && files[fd].inode_index != -1) {
+        fd++;
+    }
+    if (fd < MAX_OPEN_FILES) {
+        files[fd].flags = flags;
+        files[fd].offset = 0;
+        files[fd].dir = dir;
+        __atomic_store_n(&files[fd].inode_index, inode, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&files_lock);
+    if (fd == MAX_OPEN_FILES) return -EMFILE;
+
+    if (inodes[inode].file_type == 0 && writes && (flags & FS_O_TRUNC) &&
+        !update_memory(NULL, 0, inode)) {
+        pthread_mutex_lock(&files_lock);
+        __atomic_store_n(&files[fd].inode_index, -1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&files_lock);
+        return -EIO;
+    }
+    __atomic_fetch_add(&open_count[inode], 1, __ATOMIC_RELAXED);
+    return fd;
+}
+
+
+/*****************************************************************/
+// take descriptor "fd" for one call, other calls with it wait
+// return its open file, or NULL if it isn t open
+open_file *fd_get(int fd) {
+    if (fd < 0 || fd >= MAX_OPEN_FILES) return NULL;
+
+    open_file *file = &files[fd];
+    pthread_mutex_lock(&file->lock);
+    if (__atomic_load_n(&file->inode_index, __ATOMIC_ACQUIRE) == -1) {
+        pthread_mutex_unlock(&file->lock);
+        return NULL;
+    }
+    return file;
+}
+
+
+/*****************************************************************/
+// end the use of a descriptor taken with fd_get
+void fd_put(open_file *file) {
+    pthread_mutex_unlock(&file->lock);
+}
+
+
+/*****************************************************************/
+// free a descriptor
+// return 0 for success or a negative error code
+int fs_close(int fd) {
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    __atomic_fetch_sub(&open_count[file->inode_index], 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&files_lock);
+    __atomic_store_n(&file->inode_index, -1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&files_lock);
+    fd_put(file);
+    return fs_unlock(0);
+}
+
+
+/*****************************************************************/
+// copy at most "len" bytes from the offset of descriptor and move it after them
+// return number of copied bytes, 0 at end of file, or a negative error code
+int fs_read(int fd, void *buf, int len) {
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    int inode = file->inode_index;
+    int copied;
+    if ((file->flags & FS_O_ACCMODE) == FS_O_WRONLY) {
+        copied = -EBADF;
+    } else if (len < 0) {
+        copied = -EINVAL;
+    } else if (inode_type(inode) == 1) {
+        copied = -EISDIR;
+    } else {
+        // readers of a file share its lock
+        lock_inode(inode, READ_LOCK);
+        copied = read_data(inode, file->offset, buf, len);
+        unlock_inode(inode);
+        if (copied == -1) copied = -EBADMSG;
+        if (copied > 0) {
+            file->offset += copied;
+        }
+    }
+    fd_put(file);
+    return fs_unlock(copied);
+}
+
+
+/*****************************************************************/
+// write "len" bytes at the offset of descriptor (at the end with FS_O_APPEND)
+// and move it after them
+// return number of written bytes or a negative error code
+int fs_write(int fd, const void *buf, int len) {
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    int err = 0;
+    if ((file->flags & FS_O_ACCMODE) == FS_O_RDONLY) {
+        err = -EBADF;
+    } else if (len < 0) {
+        err = -EINVAL;
+    }
+    if (err < 0) {
+        fd_put(file);
+        return fs_unlock(err);
+    }
+
+    // a long write goes in pieces and fs_unlock may commit after each of them,
+    // so the journal never gets more than it can hold
+    int inode = file->inode_index;
+    int written = 0;
+    while (1) {
+        lock_inode(inode, WRITE_LOCK);
+        int result = write_file(file, (const char *)buf + written, len - written);
+        int left = result >= 0 && (written + result < len || file->offset > inodes[inode].file_size);
+        unlock_inode(inode);
+        fd_put(file);
+        if (result < 0) return fs_unlock((written > 0) ? written : result);
+        written += result;
+        if (!left) return fs_unlock(written);
+
+        // the descriptor may be closed (or given to another file) between pieces
+        fs_unlock(0);
+        if (!fs_lock(0)) return written;
+        file = fd_get(fd);
+        if (file == NULL || file->inode_index != inode) {
+            if (file != NULL) fd_put(file);
+            return fs_unlock(written);
+        }
+    }
+}
+
+
+/*****************************************************************/
+// write one piece of "len" bytes for fs_write, with the lock of inode: at most
+// write_piece() bytes of data, or of the hole before them
+// return number of written bytes (0 while the hole is filled) or a negative error code
+int write_file(open_file *file, const void *buf, int len) {
+    int inode = file->inode_index;
+    int piece = write_piece();
+    if (file->flags & FS_O_APPEND) {
+        file->offset = inodes[inode].file_size;
+    }
+    if ((long long)file->offset + len > MAX_CONTENT_IN_FILE) return -EFBIG;
+
+    // a hole after the end of file is filled with zeroes, new blocks keep old data
+    if (file->offset > inodes[inode].file_size) {
+        int end = (file->offset - inodes[inode].file_size > piece) ?
+                  inodes[inode].file_size + piece : file->offset;
+        unsigned char *zeroes = calloc(1, sb.block_size);
+        if (zeroes == NULL) return -ENOMEM;
+        while (inodes[inode].file_size < end) {
+            int size = end - inodes[inode].file_size;
+            if (size > sb.block_size) size = sb.block_size;
+            if (append_data(inode, zeroes, size) == -1) {
+                free(zeroes);
+                return -ENOSPC;
+            }
+        }
+        free(zeroes);
+        if (inodes[inode].file_size < file->offset) return 0;
+    }
+
+    if (len > piece) len = piece;
+    if (write_data(inode, file->offset, (void *)buf, len) == -1) return -ENOSPC;
+    file->offset += len;
+    return len;
+}
+
+
+/*****************************************************************/
+// move the offset of descriptor to "offset" from the start (SEEK_SET), from the
+// current offset (SEEK_CUR) or from the end of file (SEEK_END); a directory can
+// only go back to its first entry
+// return the new offset or a negative error code
+int fs_lseek(int fd, int offset, int whence) {
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    int inode = file->inode_index;
+    int result;
+    lock_inode(inode, READ_LOCK);
+    if (inodes[inode].file_type == 1) {
+        result = (offset != 0 || whence != SEEK_SET) ? -EINVAL : 0;
+        if (result == 0) dir_iter_start(&file->dir, inode);
+    } else {
+        long long pos = offset;
+        if (whence == SEEK_CUR) {
+            pos += file->offset;
+        } else if (whence == SEEK_END) {
+            pos += inodes[inode].file_size;
+        } else if (whence != SEEK_SET) {
+            pos = -1;
+        }
+        if (pos < 0 || pos > MAX_CONTENT_IN_FILE || pos > 0x7fffffff) {
+            result = -EINVAL;
+        } else {
+            file->offset = pos;
+            result = file->offset;
+        }
+    }
+    unlock_inode(inode);
+    fd_put(file);
+    return fs_unlock(result);
+}
+
+
+/*****************************************************************/
+// give the next entry of a directory opened with fs_open
+// return 1 for an entry, 0 after the last one, or a negative error code
+int fs_readdir(int fd, struct fs_dirent *entry) {
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    int inode = file->inode_index;
+    int result = 0;
+    lock_inode(inode, READ_LOCK);
+    if (inodes[inode].file_type != 1) {
+        result = -ENOTDIR;
+    } else {
+        directory_entry *found = dir_iter_next(&file->dir);
+        if (found != NULL) {
+            entry->inode = found->inode_index;
+            strcpy(entry->name, found->filename);
+            result = 1;
+        }
+    }
+    unlock_inode(inode);
+    fd_put(file);
+    return fs_unlock(result);
+}
+
+
+/*****************************************************************/
+// describe the file or directory of "path"
+// return 0 for success or a negative error code
+int fs_stat(const char *path, struct fs_stat *st) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    int inode = lock_path(path, READ_LOCK, READ_LOCK, NULL, NULL);
+    if (inode < 0) return fs_unlock(-ENOENT);
+
+    st->inode = inode;
+    st->type = inodes[inode].file_type;
+    st->size = inodes[inode].file_size;
+    st->blocks = inodes[inode].crtBLocks;
+    unlock_inode(inode);
+    return fs_unlock(0);
+}
+
+
+/*****************************************************************/
+// create the directory of "path"
+// return 0 for success or a negative error code
+int fs_mkdir(const char *path) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    int parent_inode;
+    char *name = NULL;      // find_inode_of_path replaces it
+    int inode = lock_path(path, WRITE_LOCK, READ_LOCK, &parent_inode, &name);
+    int err;
+    if (inode == -2) {
+        err = create_dir(parent_inode, name);
+    } else if (inode >= 0) {
+        unlock_inode(inode);
+        err = -EEXIST;
+    } else {
+        err = lookup_error(name);
+    }
+    if (parent_inode != -1) unlock_inode(parent_inode);
+    free(name);
+    return fs_unlock(err);
+}
+
+
+/*****************************************************************/
+// remove the empty directory of "path"; its parent and then the directory
+// are locked, so nothing is added in it meanwhile
+// return 0 for success or a negative error code
+int fs_rmdir(const char *path) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    int parent_inode;
+    char *name = NULL;      // find_inode_of_path replaces it
+    int inode = lock_path(path, WRITE_LOCK, WRITE_LOCK, &parent_inode, &name);
+    int err;
+    if (inode < 0) {
+        err = lookup_error(name);
+    } else if (inodes[inode].file_type == 0) {
+        err = -ENOTDIR;
+    } else if (name != NULL && (!strcmp(name, ".") || !strcmp(name, ".."))) {
+        // they are not the real name of the directory
+        err = -EINVAL;
+    } else if (inode == ROOT_INODE_INDEX || inode == __atomic_load_n(&crtInode, __ATOMIC_RELAXED) ||
+               __atomic_load_n(&open_count[inode], __ATOMIC_RELAXED) > 0) {
+        err = -EBUSY;
+    } else if (dir_count(inode) > 2) {
+        err = -ENOTEMPTY;
+    } else {
+        err = remove_dir(inode, name);
+    }
+    if (inode >= 0) unlock_inode(inode);
+    if (parent_inode != -1) unlock_inode(parent_inode);
+    free(name);
+    return fs_unlock(err);
+}
+
+
+/*****************************************************************/
+// remove the file of "path"
+// return 0 for success or a negative error code
+int fs_unlink(const char *path) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    int parent_inode;
+    char *name = NULL;      // find_inode_of_path replaces it
+    int inode = lock_path(path, WRITE_LOCK, WRITE_LOCK, &parent_inode, &name);
+    int err;
+    if (inode < 0) {
+        err = lookup_error(name);
+    } else if (inodes[inode].file_type == 1) {
+        err = -EISDIR;
+    } else if (__atomic_load_n(&open_count[inode], __ATOMIC_RELAXED) > 0) {
+        err = -EBUSY;
+    } else {
+        err = remove_file(inode, name);
+    }
+    if (inode >= 0) unlock_inode(inode);
+    if (parent_inode != -1) unlock_inode(parent_inode);
+    free(name);
+    return fs_unlock(err);
+}
+
+
+/*****************************************************************/
+// change the directory where relative paths start
+// return 0 for success or a negative error code
+int fs_chdir(const char *path) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    int inode = lock_path(path, READ_LOCK, READ_LOCK, NULL, NULL);
+    if (inode < 0) return fs_unlock(-ENOENT);
+
+    int is_dir = (inodes[inode].file_type == 1);
+    if (is_dir) {
+        __atomic_store_n(&crtInode, inode, __ATOMIC_RELAXED);
+    }
+    unlock_inode(inode);
+    return fs_unlock(is_dir ? 0 : -ENOTDIR);
+}
+
+
+/*****************************************************************/
+// make the directory opened as "fd" the current directory of the calling thread
+// only, or give it back the common one when "fd" is -1; "fd" must stay open while
+// the thread uses relative paths
+// return 0 for success or a negative error code
+int fs_fchdir(int fd) {
+    if (fd == -1) {
+        thread_cwd = -1;
+        return 0;
+    }
+    if (!fs_lock(0)) return -ENODEV;
+    open_file *file = fd_get(fd);
+    if (file == NULL) return fs_unlock(-EBADF);
+
+    int is_dir = (inode_type(file->inode_index) == 1);
+    if (is_dir) {
+        thread_cwd = file->inode_index;
+    }
+    fd_put(file);
+    return fs_unlock(is_dir ? 0 : -ENOTDIR);
+}
+
+
+/*****************************************************************/
+// current directory of the calling thread
+int cwd_inode() {
+    return (thread_cwd != -1) ? thread_cwd : __atomic_load_n(&crtInode, __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************/
+// copy the path of the current directory, ended by '/', in "buf" of "len" bytes
+// return length of path or a negative error code
+int fs_getcwd(char *buf, int len) {
+    if (!fs_lock(0)) return -ENODEV;
+
+    char *path = malloc(1);     // find_path_of_inode replaces it
+    if (path == NULL || !find_path_of_inode(cwd_inode(), (unsigned char **)&path)) {
+        free(path);
+        return fs_unlock(-ENOMEM);
+    }
+
+    int path_len = strlen(path);
+    if (path_len + 1 > len) {
+        free(path);
+        return fs_unlock(-ERANGE);
+    }
+    memcpy(buf, path, path_len + 1);
+    free(path);
+    return fs_unlock(path_len);
+}
+
+
+/*****************************************************************/
+// create an empty file "filename" in a directory locked for writing
+// return its inode or a negative error code
+int create_file(int directory_inode, const char *filename) {
+    if (strlen(filename) > MAX_FILE_NAME) return -ENAMETOOLONG;
+
+    // a file stays in the group of its directory
+    int new_inode = alloc_inode(directory_inode, 0);
+    if (new_inode == -1) return -ENOSPC;
+
+    // set inode
+    inodes[new_inode].parent_inode_index = directory_inode;
+    __atomic_store_n(&inodes[new_inode].file_type, 0, __ATOMIC_RELAXED);
+    inodes[new_inode].file_size = 0;
+    inodes[new_inode].crtBLocks = 0;
+    memset(inodes[new_inode].inline_data, 0, INLINE_DATA_LEN);
+    strcpy(inode_names[new_inode], filename);
+
+    if (!dir_add_entry(directory_inode, filename, new_inode)) {
+        free_inode(new_inode);
+        return -ENOSPC;
+    }
+    dcache_insert(directory_inode, filename, strlen(filename), new_inode);
+    return new_inode;
+}
+
+
+/*****************************************************************/
+// create the directory "dir_name" in "parent_inode", locked for writing
+// return 0 for success or a negative error code
+int create_dir(int parent_inode, const char *dir_name) {
+    if (strlen(dir_name) > MAX_FILE_NAME) return -ENAMETOOLONG;
+
+    // find inode for director, directories are spread in groups
+    int new_inode = alloc_inode(parent_inode, 1);
+    if (new_inode == -1) return -ENOSPC;
+
+    // set new inode; it s locked after its parent, like in every call
+    lock_inode(new_inode, WRITE_LOCK);
+    __atomic_store_n(&inodes[new_inode].file_type, 1, __ATOMIC_RELAXED);
+    inodes[new_inode].parent_inode_index = parent_inode;
+    inodes[new_inode].crtBLocks = 0;
+    strcpy(inode_names[new_inode], dir_name);
+
+    // create new directory with default "." and ".." entries, then update parent directory
+    if (!dir_init(new_inode, parent_inode) || !dir_add_entry(parent_inode, dir_name, new_inode)) {
+        update_memory(NULL, 0, new_inode);
+        free_inode(new_inode);
+        unlock_inode(new_inode);
+        return -ENOSPC;
+    }
+
+    dcache_insert(parent_inode, dir_name, strlen(dir_name), new_inode);
+    dcache_insert(new_inode, ".", 1, new_inode);
+    dcache_insert(new_inode, "..", 2, parent_inode);
+    unlock_inode(new_inode);
+    return 0;
+}
+
+
+/*****************************************************************/
+// remove the empty directory "inode", known in its parent as "dir_name";
+// both are locked for writing
+// return 0 for success or a negative error code
+int remove_dir(int inode, const char *dir_name) {
+    // modify parent directory
+    int parent_inode = inodes[inode].parent_inode_index;
+    if (!dir_remove_entry(parent_inode, dir_name)) return -EIO;
+    dcache_remove(parent_inode, dir_name);
+
+    // reset blocks and inode
+    update_memory(NULL, 0, inode);
+    free_inode(inode);
+
+    // forget names that pointed through this directory
+    dcache_remove(inode, ".");
+    dcache_remove(inode, "..");
+    return 0;
+}
+
+
+/*****************************************************************/
+// remove the file "inode", known in its directory as "filename";
+// both are locked for writing
+// return 0 for success or a negative error code
+int remove_file(int inode, const char *filename) {
+    // update parent directory
+    int parent_inode = inodes[inode].parent_inode_index;
+    if (!dir_remove_entry(parent_inode, filename)) return -EIO;
+    dcache_remove(parent_inode, filename);
+
+    // delete content of file
+    if (!update_memory(NULL, 0, inode)) return -EIO;
+
+    // reset inode
+    free_inode(inode);
+    return 0;
+}
+
+
+/*****************************************************************/
+// message of an error code returned by the API
+const char *fs_strerror(int err) {
+    switch (-err) {
+        case 0:             return "Succes.";
+        case ENOENT:        return "Calea este incorecta.";
+        case EEXIST:        return "Numele exista deja.";
+        case ENOTDIR:       return "Nu este un director.";
+        case EISDIR:        return "Este director.";
+        case ENOTEMPTY:     return "Directorul nu este gol.";
+        case ENOSPC:        return "Nu mai exista memorie libera pe disc!";
+        case ENAMETOOLONG:  return "Numele este prea lung.";
+        case EFBIG:         return "Fisierul este plin.";
+        case EBADF:         return "Descriptor invalid.";
+        case EMFILE:        return "Prea multe fisiere deschise.";
+        case EBUSY:         return "Este folosit.";
+        case EINVAL:        return "Argumente incorecte.";
+        case EIO:           return "Eroare la salvarea datelor.";
+        case ENOMEM:        return "Memorie insuficienta.";
+        case ENODEV:        return "Discul nu este montat.";
+        case EUCLEAN:       return "Superblocul discului este invalid.";
+        case EOPNOTSUPP:    return "Formatul discului nu este suportat.";
+        case EBADMSG:       return "Datele de pe disc sunt corupte.";
+        case ERANGE:        return "Rezultatul nu incape.";
+        case FS_EBLOCKSIZE: return "Dimensiunea blocului trebuie sa fie o putere a lui 2 intre 1024 si 65536.";
+        case FS_EBLOCKS:    return "Numarul de blocuri trebuie sa fie un multiplu pozitiv de 8.";
+        case FS_EINODES:    return "Numarul de inoduri trebuie sa fie un multiplu de 8 mai mare decat 2.";
+        case FS_EGROUP:     return "Blocurile unui grup trebuie sa fie un multiplu de 8, cel mult de 8 ori dimensiunea blocului.";
+        case FS_ESMALL:     return "Prea putine blocuri: metadatele nu lasa loc pentru cel putin 16 blocuri de date.";
+        default:            return "Eroare.";
+    }
+}
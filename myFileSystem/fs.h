@@ -0,0 +1,174 @@
+#ifndef FS_H
+#define FS_H
+
+/* embeddable filesystem: a process mounts one disk file and works with it through
+paths and file descriptors, like with the system calls. Every function returns 0
+(or a count) for success and a negative error code (-ENOENT, -ENOSPC...) otherwise;
+fs_strerror gives its message. Threads can share the disk: calls lock only the
+inodes they use, so calls on different files and directories run at the same time */
+
+#include <errno.h>
+#include <stdio.h>
+
+#define FS_NAME_MAX 30          // longest name of a file or directory
+
+#define FS_O_RDONLY 0
+#define FS_O_WRONLY 1
+#define FS_O_RDWR 2
+#define FS_O_ACCMODE 3
+#define FS_O_CREAT 4            // create a file if it doesn t exist
+#define FS_O_EXCL 8             // with FS_O_CREAT, fail if it exists
+#define FS_O_TRUNC 16           // drop the old content of file
+#define FS_O_APPEND 32          // every write goes at the end of file
+
+// errors of fs_mkfs for a geometry that can t be used, beyond the ones of errno
+#define FS_EBLOCKSIZE 1001      // block size isn t a power of 2 between 1024 and 65536
+#define FS_EBLOCKS 1002         // blocks aren t a positive multiple of 8
+#define FS_EINODES 1003         // inodes aren t a multiple of 8 greater than 2
+#define FS_EGROUP 1004          // blocks of a group aren t a multiple of 8 fitting one bitmap block
+#define FS_ESMALL 1005          // metadata leaves no room for data
+
+#define FS_TYPE_FILE 0
+#define FS_TYPE_DIR 1
+
+typedef struct {
+    int block_size;         // geometry of a new disk
+    int blocks;
+    int inodes;
+    int group_blocks;       // 0 for the bits of one block
+    int extents;            // 1 to map files by runs of blocks
+    int journal;            // 1 to keep a journal of metadata
+    int inline_data;        // 1 to keep the content of small files in their inodes
+    int checksums;          // 1 to keep a CRC32C of every block
+    int mmap;               // 1 to map the disk file instead of caching its blocks
+    int cache_kb;           // memory for cached blocks
+    int flush_interval;     // seconds between background syncs, 0 to disable
+    char *io;               // block device: "sync", "threads" or "uring"
+    void (*fatal)(int);     // told about an error no call can return (no memory for the cache),
+                            // before the process exits; NULL to exit quietly
+} fs_options;
+
+struct fs_stat {
+    int inode;
+    int type;               // FS_TYPE_FILE or FS_TYPE_DIR
+    int size;               // bytes of content
+    int blocks;             // data blocks used
+};
+
+struct fs_dirent {
+    int inode;
+    char name[FS_NAME_MAX + 1];
+};
+
+struct fs_scrub {
+    int threads;
+    long blocks;            // blocks with a checksum, verified
+    long errors;            // blocks with a wrong checksum
+    int first_error;        // first bad block, -1 if none
+    long long bytes;        // read from the disk file
+    double seconds;
+    int hardware_crc;       // 1 if the crc32 instruction was used
+};
+
+#define FS_FSCK_REPORTS 100     // problems described by fs_fsck in every pass, the others are only counted
+
+struct fs_fsck {
+    void (*found)(int, const char *);   // set by the caller: told about every problem described,
+                                        // with the pass (0 before the repair, 1 after it); may be NULL
+    int threads;
+    long inodes;            // in use, verified
+    long directories;
+    long blocks;            // used by inodes, for data and for their mapping
+    long errors;            // problems found
+    long repaired;
+    long remaining;         // problems found after the repair, or the ones found without it
+    double seconds;
+};
+
+struct fs_info {
+    int block_size;
+    int total_blocks;
+    int inode_count;
+    int group_count;
+    int data_blocks_start;
+    int free_blocks;
+    int free_inodes;
+    int mapped;             // 1 if the disk file is mapped, 0 if its blocks are cached
+    const char *io;         // block device of a cached disk
+    int converted;          // 1 if the mount wrote an older disk in the format of this build
+    long bad_blocks;        // blocks read with a wrong checksum since the mount
+};
+
+struct fs_stats {
+    long dcache_hits;       // names found in the dentry cache
+    long dcache_misses;
+    long bmap_hits;         // logical blocks found in the cache of indirect blocks
+    long bmap_misses;
+    long syncs;
+    long last_sync_bytes;   // written by the last sync
+    long sync_bytes;
+    int journal_blocks;     // 0 without journal
+    long commits;
+    long flushes;           // fdatasync calls
+    long journal_bytes;     // written to the journal
+    long overflows;         // syncs too big for the journal, written in place
+    int checksums;          // 1 if blocks have a CRC32C
+    int hardware_crc;       // 1 if the crc32 instruction is used
+    long verified;          // blocks read and verified
+    long checksum_errors;   // reads of a bad block
+    long bad_blocks;        // different blocks found bad
+    int first_bad;          // first block found bad, -1 if none
+    int cached;             // 1 if blocks are cached, 0 for a mapped disk; the rest is only for a cache
+    long cache_hits;
+    long cache_misses;
+    long evictions;
+    long writebacks;        // dirty blocks written when they left the cache
+    int cache_blocks;       // slots in use
+    int cache_budget;
+    long ahead_read;        // blocks read ahead
+    long ahead_used;
+    long ahead_wasted;      // replaced before being used
+    int ahead_window;       // largest window allowed now
+    long behind_batches;    // runs of dirty data written behind a growing file
+    long behind_blocks;
+    const char *io;         // block device
+    int registered;         // 1 if the buffers of cache are registered with io_uring
+    long io_batches;
+    long io_requests;
+    long io_blocks;
+    long io_nanos;          // spent waiting for batches
+};
+
+struct fs_group {
+    int free_blocks;
+    int free_inodes;
+};
+
+void fs_default_options(fs_options *);
+int fs_mkfs(const char *, const fs_options *);
+int fs_mount(const char *, const fs_options *);
+int fs_unmount();
+long fs_sync();
+int fs_statfs(struct fs_info *);
+int fs_stats(struct fs_stats *, struct fs_group *, int);
+int fs_scrub(int, struct fs_scrub *);
+int fs_fsck(int, int, struct fs_fsck *);
+
+int fs_open(const char *, int);
+int fs_close(int);
+int fs_read(int, void *, int);
+int fs_write(int, const void *, int);
+int fs_lseek(int, int, int);
+int fs_readdir(int, struct fs_dirent *);
+
+int fs_stat(const char *, struct fs_stat *);
+int fs_mkdir(const char *);
+int fs_rmdir(const char *);
+int fs_unlink(const char *);
+int fs_chdir(const char *);
+int fs_fchdir(int);
+int fs_getcwd(char *, int);
+
+const char *fs_strerror(int);
+
+#endif
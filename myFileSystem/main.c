@@ -1,68 +1,41 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+#include "fs.h"
 
 /************************** Defining Constants for file system *******************/
 
-#define NR_BLOCKS 1024          // should be divisible with 8 (byte length)
-#define BLOCK_SIZE 1024
-#define MAX_DIRECT_BLOCKS 12    // maximum blocks for file content
-#define MAX_CONTENT_IN_FILE MAX_DIRECT_BLOCKS * BLOCK_SIZE
-#define MAX_INODES 256          // should be divisible with 8 (byte length)
-#define BYTE_LEN 8
-#define MAX_FILE_NAME 30
-#define MAX_FILES_IN_DIRECTORY 30
-#define BLOCK_MAP_LEN NR_BLOCKS / BYTE_LEN
-#define INODE_MAP_LEN MAX_INODES / BYTE_LEN
-#define ROOT_INODE_INDEX 2
 #define LINESIZE 256
 #define FILESYSTEM_NAME "filesystem.bin"    // represents "disk"
-
-struct superblock {
-    int total_blocks;
-    int block_size;
-    int inode_count;
-    int free_blocks;    // number of the blocks that are free of writing
-    int free_nodes;     // number of the nodes that are free of writing
-
-    int inode_bitmap_start;     // position for starting reading from disk
-    int block_bitmap_start;
-    int inode_table_start;
-    int data_blocks_start;
-} sb;
-
-struct bitmap{
-    unsigned char block_map[BLOCK_MAP_LEN];
-    unsigned char inode_map[INODE_MAP_LEN];
-} bm;
-
-struct inode {
-    int file_size;                         // content size of memorised file
-    int file_type;                         // 0 for file, 1 for directory
-    int direct_blocks[MAX_DIRECT_BLOCKS];  // maximum nr of memory blocks that can be allocated for one file/directory
-    int crtBLocks;
-    int parent_inode_index;                // the inode of directory where s located current file/directory
-} inodes[MAX_INODES] = {0};
-
-typedef struct {
-    int inode_index;
-    char filename[MAX_FILE_NAME];
-} directory_entry;      // an instance that represents a file/directory in current directory
-
-typedef struct {
-    directory_entry entries[MAX_FILES_IN_DIRECTORY];
-    int count;      // current number of files/directories
-} directory;
-
-unsigned char disk_buffer[NR_BLOCKS][BLOCK_SIZE] = {0};   // for easy access
-
-int crtInode;
-unsigned char *path;
+#define READ_CHUNK 4096         // bytes read by cat at once
+#define BATCH_BUFFER (1 << 20)  // bytes of input and output buffered in batch mode
+
+// what is shown: a message is printed only if its level reaches the one of output
+#define SHOW_DONE 0             // messages of success
+#define SHOW_DATA 1             // content asked for by cat, ls, pwd, stats
+#define SHOW_ERROR 2            // messages of errors
+#define SHOW_STATUS 3           // none of them, only the code of every command
+
+// current directory, shown before every command, as a stack of names: "path" keeps
+// them, each followed by '/', and "name_start" where each one begins, so cd changes
+// only the names it touches instead of asking the whole path again
+struct {
+    char *path;
+    int len;
+    int size;
+    int *name_start;
+    int depth;
+    int max_depth;
+} cwd;
+int output_level = SHOW_DONE;   // SHOW_DATA with --quiet, SHOW_STATUS with --status
+int running = 1;        // 0 after exit
+long fsck_shown[2];     // problems described by the running fsck, before and after its repair
 
 /************************** functions *******************/
 
-/* COMMAND ------------------------>  ACTION 
+/* COMMAND ------------------------>  ACTION
 - mkdir <path/directory_name>         create new directory
 - touch <path/file_name>              create new file
 - echo <content> >/>> <path_to_file>  add content to a file
@@ -72,722 +45,744 @@ unsigned char *path;
 - ls <path_to_directory>              list entries of directory
 - pwd                                 show path until current directory
 - cat <path_to_file>                  show content of file
+- stats                               show cache counters
+- scrub [threads]                     verify the checksums of all blocks
+- fsck [-r] [threads]                 verify bitmaps, inodes and directories, -r repairs them
 */
 
-void execute_command(char **, int);
-void create_dir_cmd(unsigned char *);
-void list_cmd(int, char**);
-void change_dir_cmd(unsigned char*);
-void make_file_cmd(unsigned char*);
-void rm_file_cmd(unsigned char*);
-void rm_dir_cmd(unsigned char*);
-void pwd_cmd();
-void cat_cmd(unsigned char*);
-void exit_cmd();
-
-int file_is_empty(char*);
-int superblock_init();
-int filesystem_init();
-int set_bit_to_value(unsigned char*, int, int, int);
-int find_bit_value(unsigned char*, int, int);
-int find_free_block();
-int extract_data(void *, int);
-int find_free_inode();
-int update_memory(void*, int, int);
+typedef struct {
+    const char *name;
+    int (*run)(int, char **);   // return 0 or a negative error code
+    int min_args;               // with the name of command
+    int max_args;               // -1 for any number
+} command;
+
+int execute_command(char **, int);
+int compare_command(const void *, const void *);
+int create_dir_cmd(int, char **);
+int list_cmd(int, char **);
+int change_dir_cmd(int, char **);
+int make_file_cmd(int, char **);
+int rm_file_cmd(int, char **);
+int rm_dir_cmd(int, char **);
+int echo_cmd(int, char **);
+int pwd_cmd(int, char **);
+int cat_cmd(int, char **);
+int exit_cmd(int, char **);
+int sync_cmd(int, char **);
+int stats_cmd(int, char **);
+int scrub_cmd(int, char **);
+int fsck_cmd(int, char **);
+void fsck_found(int, const char *);
+int mkfs_cmd(fs_options *);
+void mount_notes(const fs_options *);
+void fatal_message(int);
+void run_batch(FILE *);
+void report(int, const char *, ...);
+int visible(int);
 void parse(char *, int*, char **);
 void print_path();
-int find_inode_of_path(unsigned char *, int, int* ,unsigned char **);
-int find_path_of_inode (int, unsigned char **);
-int add_word_to_file(unsigned char *, int, int);
+int init_path();
+void update_path(char *);
+int push_name(const char *);
+const char *last_name(char *);
+
+// sorted by name, for bsearch
+command commands[] = {
+    {"cat", cat_cmd, 2, 2},
+    {"cd", change_dir_cmd, 2, 2},
+    {"echo", echo_cmd, 1, -1},
+    {"exit", exit_cmd, 1, -1},
+    {"fsck", fsck_cmd, 1, 3},
+    {"ls", list_cmd, 1, 2},
+    {"mkdir", create_dir_cmd, 1, -1},
+    {"pwd", pwd_cmd, 1, 1},
+    {"rm", rm_file_cmd, 2, 2},
+    {"rmdir", rm_dir_cmd, 2, 2},
+    {"scrub", scrub_cmd, 1, 2},
+    {"stats", stats_cmd, 1, -1},
+    {"sync", sync_cmd, 1, -1},
+    {"touch", make_file_cmd, 1, -1},
+};
 
 
 /*****************************************************************/
 
-int main() {
-    printf("Salut! Acesta este sistemul tau de fisiere!\n\n");
+int main(int args, char *options[]) {
+    // "./main mkfs [options]" only creates a new disk
+    int mkfs = (args > 1 && !strcmp(options[1], "mkfs"));
+
+    // --extents, --no-journal, --no-inline, --checksums and geometry are used only when a new disk is created
+    fs_options opts;
+    fs_default_options(&opts);
+    opts.fatal = fatal_message;
+    char *batch = NULL;
+    for (int i = 1 + mkfs; i < args; i++) {
+        if (!strcmp(options[i], "--block-size") && i + 1 < args) {
+            opts.block_size = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--blocks") && i + 1 < args) {
+            opts.blocks = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--inodes") && i + 1 < args) {
+            opts.inodes = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--group-blocks") && i + 1 < args) {
+            opts.group_blocks = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--extents")) {
+            opts.extents = 1;
+        } else if (!strcmp(options[i], "--mmap")) {
+            opts.mmap = 1;
+        } else if (!strcmp(options[i], "--no-journal")) {
+            opts.journal = 0;
+        } else if (!strcmp(options[i], "--no-inline")) {
+            opts.inline_data = 0;
+        } else if (!strcmp(options[i], "--checksums")) {
+            opts.checksums = 1;
+        } else if (!strcmp(options[i], "--cache") && i + 1 < args) {
+            opts.cache_kb = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--io") && i + 1 < args) {
+            opts.io = options[++i];
+        } else if (!strcmp(options[i], "--flush") && i + 1 < args) {
+            opts.flush_interval = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--batch") && i + 1 < args) {
+            batch = options[++i];
+        } else if (!strcmp(options[i], "--quiet")) {
+            output_level = SHOW_DATA;
+        } else if (!strcmp(options[i], "--status")) {
+            output_level = SHOW_STATUS;
+        } else {
+            printf("Optiune necunoscuta: %s\n", options[i]);
+        }
+    }
 
-    filesystem_init();
+    if (mkfs) {
+        return mkfs_cmd(&opts);
+    }
 
-    // will store stdin 
-    char in[LINESIZE];
-    char *argv[LINESIZE];
-    int argc;
+    // a script is opened before the disk, a wrong name doesn t touch it
+    FILE *script = NULL;
+    if (batch != NULL) {
+        script = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+        if (script == NULL) {
+            perror(batch);
+            return 1;
+        }
+    } else {
+        printf("Salut! Acesta este sistemul tau de fisiere!\n\n");
+    }
+
+    int err = fs_mount(FILESYSTEM_NAME, &opts);
+    if (err < 0) {
+        printf("Discul nu a putut fi deschis: %s\n", fs_strerror(err));
+        return 1;
+    }
+    mount_notes(&opts);
 
     // we start from root
-    path = malloc(1);
-    path[0] = '/';
-    crtInode = ROOT_INODE_INDEX;
+    if (!init_path()) return 1;
 
-    print_path();
-    while (fgets(in, sizeof(in), stdin)) {
-        // clear rest of stdin after line size
-        if (!strchr(in, '\n')) {
-            while (getchar() != '\n');
-        }
+    if (script != NULL) {
+        run_batch(script);
+    } else {
+        // will store stdin
+        char in[LINESIZE];
+        char *argv[LINESIZE];
+        int argc;
 
-        // switch '\n' with '\0' from command
-        in[strcspn(in, "\n")] = '\0';
+        print_path();
+        while (running && fgets(in, sizeof(in), stdin)) {
+            // clear rest of stdin after line size
+            if (!strchr(in, '\n')) {
+                int c;
+                while ((c = getchar()) != '\n' && c != EOF);
+            }
 
-        // break down the arguments
-        parse(in, &argc, argv);
+            // switch '\n' with '\0' from command
+            in[strcspn(in, "\n")] = '\0';
 
-        execute_command(argv, argc);
+            // break down the arguments
+            parse(in, &argc, argv);
 
-        find_path_of_inode(crtInode, &path);
-        print_path();
+            execute_command(argv, argc);
+            if (!running) break;
+            print_path();
+        }
     }
+
+    // exit and save filesystem
+    fflush(stdout);
+    err = fs_unmount();
+    if (err < 0) {
+        printf("%s\n", fs_strerror(err));
+        return 1;
+    }
+    return 0;
 }
 
 /*****************************************************************/
-// just filtrate commands from input
-void execute_command(char **argv, int argc) {
-    // make directory command
-    if (!strcmp(argv[0], "mkdir")) {
-        for (int i = 1; i < argc; i++)
-            create_dir_cmd(argv[i]);
-    }
-    // list command
-    else if (!strcmp(argv[0], "ls")) {
-        list_cmd(argc, argv);
-    }
-    // change directory command
-    else if (!strcmp(argv[0], "cd")) {
-        if (argc == 2)
-            change_dir_cmd(argv[1]);
-        else 
-            printf("Argumente incorecte.\n");
-    }
-    // create file command
-    else if (!strcmp(argv[0], "touch")) {
-        for (int i = 1; i < argc; i++)
-            make_file_cmd(argv[i]);
-    }
-    // remove file command
-    else if (!strcmp(argv[0], "rm")) {
-        if (argc == 2) {
-            rm_file_cmd(argv[1]);
-        } else {
-            printf("Argumente incorecte.\n");
-        }
-    }
-    // remove directory command
-    else if (!strcmp(argv[0], "rmdir")) {
-        if (argc == 2) {
-            rm_dir_cmd(argv[1]);
-        } else {
-            printf("Argumente incorecte.\n");
-        }
-    }
-    // write content to file command
-    else if (!strcmp(argv[0], "echo")) {
-        int delete = 1;
-        int sign_position = 0;
-        for (int i = 1; i < argc; i++) {
-            if (!strcmp(argv[i], ">")) {
-                delete = 1;
-                sign_position = i;
-            } else if (!strcmp(argv[i], ">>")) {
-                delete = 0;
-                sign_position = i;
-            }
-        }
+// run the commands of "script" without prompt, with the output in a large buffer,
+// and show how many commands were run per second
+void run_batch(FILE *script) {
+    char in[LINESIZE];
+    char *argv[LINESIZE];
+    int argc;
+    long count = 0, failed = 0;
 
-        // verify if there s more paths after '>'/'>>'
-        if (argc != (sign_position + 2)) {
-            printf("Argumente incorecte.\n");
-            return;
-        }
+    setvbuf(script, NULL, _IOFBF, BATCH_BUFFER);
+    setvbuf(stdout, NULL, _IOFBF, BATCH_BUFFER);
 
-        int file_inode = find_inode_of_path(argv[sign_position + 1], crtInode, NULL, NULL);
-        if (file_inode < 0) {
-            printf("Fisierul nu exista.\n");
-            return;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (running && fgets(in, sizeof(in), script)) {
+        if (!strchr(in, '\n')) {
+            int c;
+            while ((c = getc(script)) != '\n' && c != EOF);
         }
+        in[strcspn(in, "\n")] = '\0';
 
-        // add space between words
-        unsigned char space[] = " ";
-
-        // add every word
-        for (int i = 1; i < sign_position; i++) {
-            if (!add_word_to_file(argv[i], file_inode, delete)) {
-                return;
-            }
-            add_word_to_file(space, file_inode, 0);
+        parse(in, &argc, argv);
+        if (argc == 0) continue;
 
-            // next words from phrase won t delete last one s
-            delete = 0;
-        }
-        printf("Continutul a fost adaugat.\n");
-    }
-    // show path until now command
-    else if (!strcmp(argv[0], "pwd")) {
-        if (argc == 1) {
-            pwd_cmd();
-        } else {
-            printf("Argumente incorecte.\n");
+        int err = execute_command(argv, argc);
+        if (output_level == SHOW_STATUS) {
+            printf("%d\n", err);
         }
+        failed += (err < 0);
+        count++;
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    else if (!strcmp(argv[0], "cat")) {
-        if (argc == 2) {
-            cat_cmd(argv[1]);
-        } else {
-            printf("Argumente incorecte.\n");
-        }
-    }
-    // exit and save
-    else if (!strcmp(argv[0], "exit")) {
-        exit_cmd();
-    }
-    // unknown command
-    else {
-        printf("Comanda necunoscuta.\n");
-    }
+    if (script != stdin) fclose(script);
+    fflush(stdout);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%ld comenzi (%ld esuate) in %.3f s: %.0f comenzi/s\n",
+            count, failed, seconds, seconds > 0 ? count / seconds : 0);
 }
 
 /*****************************************************************/
-// display the path to the current directory
-void pwd_cmd() {
-    unsigned char *path = malloc(1);
-    find_path_of_inode(crtInode, &path);
-    printf("-->%s\n", path);
+// find the command in the table and verify its number of arguments
+// return 0 or a negative error code
+int execute_command(char **argv, int argc) {
+    if (argc == 0) {
+        report(SHOW_ERROR, "Comanda necunoscuta.\n");
+        return -EINVAL;
+    }
+
+    command key = {argv[0]};
+    command *cmd = bsearch(&key, commands, sizeof(commands) / sizeof(commands[0]),
+                           sizeof(command), compare_command);
+    if (cmd == NULL) {
+        report(SHOW_ERROR, "Comanda necunoscuta.\n");
+        return -EINVAL;
+    }
+    if (argc < cmd->min_args || (cmd->max_args != -1 && argc > cmd->max_args)) {
+        report(SHOW_ERROR, "Argumente incorecte.\n");
+        return -EINVAL;
+    }
+    return cmd->run(argc, argv);
 }
 
 /*****************************************************************/
-// exit and save filesystem
-void exit_cmd() {
-    // save to buffer
-    memmove(disk_buffer[0], &sb, sizeof(struct superblock));
-    memmove(*(disk_buffer + sb.inode_bitmap_start), bm.inode_map, INODE_MAP_LEN);
-    memmove(*(disk_buffer + sb.block_bitmap_start), bm.block_map, BLOCK_MAP_LEN);
-    memmove(*(disk_buffer + sb.inode_table_start), inodes, sizeof(inodes));
-
-    // save to "disk"
-    FILE *f = fopen("filesystem.bin", "wb");
-    if (f == NULL) {
-        printf("Eroare la salvarea datelor.\n");
-    }
-    for (int i = 0; i < NR_BLOCKS; i++) {
-        fwrite(disk_buffer[i], BLOCK_SIZE, 1, f);
-    }
+int compare_command(const void *a, const void *b) {
+    return strcmp(((const command *)a)->name, ((const command *)b)->name);
+}
 
-    fclose(f);
+/*****************************************************************/
+// print a message of "level" if the output shows it
+void report(int level, const char *format, ...) {
+    if (!visible(level)) return;
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
 
-    exit(0);
+/*****************************************************************/
+// return 1 if messages of "level" are shown
+int visible(int level) {
+    return level >= output_level && output_level != SHOW_STATUS;
 }
 
+/*****************************************************************/
+// display the path to the current directory
+int pwd_cmd(int argc, char **argv) {
+    report(SHOW_DATA, "-->%s\n", cwd.path);
+    return 0;
+}
 
 /*****************************************************************/
-// display the content of a file
-void cat_cmd (unsigned char* path) {
-    int file_inode = find_inode_of_path(path, crtInode, NULL, NULL);
-    if (file_inode < 0) {
-        printf("Nu exista fisierul.\n");
-        return;
-    }
+// stop reading commands, the disk is saved by main
+int exit_cmd(int argc, char **argv) {
+    running = 0;
+    return 0;
+}
 
-    if (inodes[file_inode].file_type == 1) {
-        printf("Este director.\n");
-        return;
-    }
 
-    if (inodes[file_inode].file_size != 0) {
-        unsigned char file[inodes[file_inode].file_size];
-        extract_data(file, file_inode);
-        printf("%s\n", file);
-    }
+/*****************************************************************/
+// write modified blocks to disk
+int sync_cmd(int argc, char **argv) {
+    long bytes = fs_sync();
+    if (bytes < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(bytes));
+        return bytes;
+    }
+    report(SHOW_DONE, "Au fost scrisi %ld octeti.\n", bytes);
+    return 0;
 }
 
-/*****************************************************************/
-// remove directory if it s empty
-void rm_dir_cmd(unsigned char *path) {
-    // just to not be NULL
-    unsigned char* dir_name = malloc(1);
-    int inode = find_inode_of_path(path, crtInode, NULL, &dir_name);
-    // verify if inode is valid
-    if (inode < 0 || inode > MAX_INODES || inode == ROOT_INODE_INDEX || inode == crtInode) {
-        printf("Calea este incorecta.\n");
-        return;
-    }
 
-    // verify if it s directory or file
-    if (inodes[inode].file_type == 0) {
-        printf("Nu este un director.\n");
-        return;
+/*****************************************************************/
+// show counters
+int stats_cmd(int argc, char **argv) {
+    if (!visible(SHOW_DATA)) return 0;
+
+    struct fs_info info;
+    struct fs_stats st;
+    int err = fs_statfs(&info);
+    struct fs_group *groups = (err < 0) ? NULL : malloc(info.group_count * sizeof(struct fs_group));
+    if (err == 0 && groups == NULL) err = -ENOMEM;
+    if (err == 0) err = fs_stats(&st, groups, info.group_count);
+    if (err < 0) {
+        free(groups);
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
+    }
+
+    long lookups = st.dcache_hits + st.dcache_misses;
+    printf("Cache dentry: %ld gasiri, %ld ratari", st.dcache_hits, st.dcache_misses);
+    if (lookups > 0) {
+        printf(" (%.1f%%)", 100.0 * st.dcache_hits / lookups);
+    }
+    printf("\n");
+
+    lookups = st.bmap_hits + st.bmap_misses;
+    printf("Cache blocuri indirecte: %ld gasiri, %ld ratari", st.bmap_hits, st.bmap_misses);
+    if (lookups > 0) {
+        printf(" (%.1f%%)", 100.0 * st.bmap_hits / lookups);
+    }
+    printf("\n");
+
+    printf("Sincronizari: %ld, ultima %ld octeti, in total %ld octeti", st.syncs,
+           st.last_sync_bytes, st.sync_bytes);
+    if (st.syncs > 0) {
+        printf(" (%ld octeti/sincronizare)", st.sync_bytes / st.syncs);
+    }
+    printf("\n");
+
+    if (st.journal_blocks > 0) {
+        printf("Jurnal de %d blocuri: %ld tranzactii, %ld fdatasync, %ld octeti", st.journal_blocks,
+               st.commits, st.flushes, st.journal_bytes);
+        if (st.overflows > 0) {
+            printf(", %ld sincronizari prea mari scrise pe loc", st.overflows);
+        }
+        printf("\n");
     }
-
-    // find parent directory
-    int parent_inode = inodes[inode].parent_inode_index;
-    directory parent;
-    if (!extract_data(&parent, parent_inode)) {
-        printf("Eroare la extragerea datelor.\n");
-        return;
+    if (st.checksums) {
+        printf("Sume de control (crc32c %s): %ld blocuri verificate, %ld gresite",
+               st.hardware_crc ? "sse4.2" : "tabel", st.verified, st.checksum_errors);
+        if (st.bad_blocks > 0) {
+            printf(" (%ld blocuri diferite, primul este %d)", st.bad_blocks, st.first_bad);
+        }
+        printf("\n");
     }
 
-    // extract directory data
-    directory dir;
-    if (!extract_data(&dir, inode)) {
-        printf("Eroare la extragerea datelor.\n");
-        return;
+    if (st.cached) {
+        lookups = st.cache_hits + st.cache_misses;
+        printf("Cache blocuri: %ld gasiri, %ld ratari", st.cache_hits, st.cache_misses);
+        if (lookups > 0) {
+            printf(" (%.1f%%)", 100.0 * st.cache_hits / lookups);
+        }
+        printf(", %ld evacuari, %ld scrieri inapoi, %d/%d blocuri in memorie\n", st.evictions,
+               st.writebacks, st.cache_blocks, st.cache_budget);
+        printf("Citire in avans: %ld blocuri, %ld folosite, %ld irosite, fereastra maxima %d\n",
+               st.ahead_read, st.ahead_used, st.ahead_wasted, st.ahead_window);
+        printf("Scriere in urma: %ld loturi, %ld blocuri\n", st.behind_batches, st.behind_blocks);
+
+        printf("Dispozitiv %s%s: %ld loturi, %ld cereri, %ld blocuri", st.io,
+               st.registered ? " (buffere inregistrate)" : "", st.io_batches, st.io_requests,
+               st.io_blocks);
+        if (st.io_nanos > 0) {
+            printf(", %.0f cereri/s, %.1f us/lot", st.io_requests * 1e9 / st.io_nanos,
+                   st.io_nanos / 1e3 / st.io_batches);
+        }
+        printf("\n");
     }
 
-    // verify if directory is empty 
-    if (dir.count > 2) {
-        printf("Directorul nu este gol.\n");
-        return;
+    for (int g = 0; g < info.group_count; g++) {
+        printf("Grupul %d: %d blocuri libere, %d inoduri libere\n", g, groups[g].free_blocks,
+               groups[g].free_inodes);
     }
+    free(groups);
+    return 0;
+}
 
-    // reset blocks
-    dir.count = 0;
-    update_memory(&dir, sizeof(directory), inode);
-
-    // reset inode
-    set_bit_to_value(bm.inode_map, inode, sizeof(bm.inode_map), 0);
-
-    // modify parent directory
-    for (int i = 0; i < parent.count; i++) {
-        if (parent.entries[i].inode_index == inode) {
-            for (int j = i; j < parent.count - 1; j++) {
-                memmove(&parent.entries[j], &parent.entries[j + 1], sizeof(directory_entry));
-            }
-            break;
-        }
-    }
-    parent.count--;
-    update_memory(&parent, sizeof(directory), parent_inode);
 
-    printf("Directorul %s a fost sters.\n", dir_name);
+/*****************************************************************/
+// verify the whole disk against its checksums, with the threads given or one for every processor
+int scrub_cmd(int argc, char **argv) {
+    struct fs_scrub result;
+    int err = fs_scrub(argc == 2 ? atoi(argv[1]) : 0, &result);
+    if (err < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
+    }
+
+    report(SHOW_DATA, "Verificate %ld blocuri (%.1f MiB) cu %d fire in %.3f s: %.2f GB/s, crc32c %s.\n",
+           result.blocks, result.bytes / 1048576.0, result.threads, result.seconds,
+           result.seconds > 0 ? result.bytes / result.seconds / 1e9 : 0.0,
+           result.hardware_crc ? "sse4.2" : "tabel");
+    if (result.errors > 0) {
+        report(SHOW_ERROR, "%ld blocuri au suma de control gresita, primul este %d.\n",
+               result.errors, result.first_error);
+        return -EBADMSG;
+    }
+    return 0;
 }
 
 
 /*****************************************************************/
-// remove the file from specified path
-void rm_file_cmd (unsigned char *path) {
-    // just to not be NULL
-    unsigned char *filename = malloc(1);
-    int inode = find_inode_of_path(path, crtInode, NULL, &filename);
-
-    // verify if inode is valid
-    if (inode == -1 || inodes[inode].file_type == 1) {
-        printf("Calea este incorecta.\n");
-        return;
+// verify the consistency of disk, and repair it with "-r"
+int fsck_cmd(int argc, char **argv) {
+    int repair = 0, threads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r")) {
+            repair = 1;
+        } else {
+            threads = atoi(argv[i]);
+        }
     }
 
-    // extract data about parent directory
-    int parent_inode = inodes[inode].parent_inode_index;
-    directory dir;
-    if(!extract_data(&dir, parent_inode)) {
-        printf("Eroare la extragerea datelor.\n");
-        return;
+    struct fs_fsck result;
+    result.found = fsck_found;
+    fsck_shown[0] = fsck_shown[1] = 0;
+    int err = fs_fsck(threads, repair, &result);
+    if (err < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
     }
 
-    // update directory
-    for (int i = 0; i < dir.count; i++) {
-        if (dir.entries[i].inode_index == inode) {
-            for (int j = i; j < dir.count - 1; j++) {
-                memmove(&dir.entries[j], &dir.entries[j + 1], sizeof(directory_entry));
-            }
-            break;
-        }
+    long hidden = (result.errors - fsck_shown[0]) + (repair ? result.remaining - fsck_shown[1] : 0);
+    if (hidden > 0) {
+        report(SHOW_DATA, "... si inca %ld probleme.\n", hidden);
     }
-    dir.count--;
 
-    // verify the update of memory
-    if (!update_memory(&dir, sizeof(directory), parent_inode)) {
-        printf("Eroare.\n");
-        return;
+    report(SHOW_DATA, "Verificate %ld inoduri (%ld directoare) si %ld blocuri cu %d fire in %.3f s.\n",
+           result.inodes, result.directories, result.blocks, result.threads, result.seconds);
+    if (result.errors == 0) {
+        report(SHOW_DATA, "Discul nu are erori.\n");
+        return 0;
     }
-
-    // resize the file
-    int old_size = inodes[inode].file_size;
-    inodes[inode].file_size = 0;
-
-    // delete file from memory and verify
-    if(!update_memory(bm.block_map, sizeof(bm.block_map), inode)) {
-        printf("Nu s a putut sterge fisierul.\n");
-        inodes[inode].file_size = old_size;
-        return;
+    if (repair) {
+        report(SHOW_DATA, "%ld probleme gasite, %ld reparate.\n", result.errors, result.repaired);
+    } else {
+        report(SHOW_DATA, "%ld probleme gasite, pot fi reparate cu \"fsck -r\".\n", result.errors);
     }
-
-    // reset inode
-    set_bit_to_value(bm.inode_map, inode, sizeof(bm.inode_map), 0);
-
-    // success message
-    printf("Fisierul %s a fost sters.\n", filename);
+    if (result.remaining > 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(-EBADMSG));
+        return -EBADMSG;
+    }
+    return 0;
 }
 
 
 /*****************************************************************/
-// create a file with specified name
-void make_file_cmd(unsigned char *path) {
-    int new_inode = find_free_inode();
-    if (new_inode == -1) {
-        printf("Nu mai exista spatiu.\n");
-        return;
+// show a problem found by fsck, the ones found after a repair under their own line
+void fsck_found(int pass, const char *message) {
+    if (pass == 1 && fsck_shown[1] == 0) {
+        report(SHOW_DATA, "Discul a fost reparat, se verifica din nou.\n");
     }
+    fsck_shown[pass]++;
+    report(SHOW_DATA, "%s\n", message);
+}
 
-    int directory_inode = 0;
-    // just to not be NULL
-    unsigned char *filename = malloc(1);
-
-    // if returns -2, we know that just last directory from path doesn t exist
-    if (find_inode_of_path(path, crtInode, &directory_inode, &filename) != -2) {
-        printf("Calea este invalida.\n");
-        return;
-    }
 
-    // set inode
-    inodes[new_inode].parent_inode_index = directory_inode;
-    inodes[new_inode].file_type = 0;
-    inodes[new_inode].crtBLocks = 0;
-    set_bit_to_value(bm.inode_map, new_inode, sizeof(bm.inode_map), 1);
+/*****************************************************************/
+// create a new empty disk with the geometry given by options
+// return exit code of program
+int mkfs_cmd(fs_options *opts) {
+    int err = fs_mkfs(FILESYSTEM_NAME, opts);
+    if (err < 0) {
+        printf("Eroare la crearea discului: %s\n", fs_strerror(err));
+        return 1;
+    }
+
+    struct fs_info info;
+    fs_statfs(&info);
+    printf("Disc creat: %d blocuri de %d octeti in %d grupuri, %d inoduri, datele incep la blocul %d.\n",
+           info.total_blocks, info.block_size, info.group_count, info.inode_count, info.data_blocks_start);
+    return (fs_unmount() < 0);
+}
 
 
-    directory dir;
-    if (!extract_data(&dir, directory_inode)) {
-        printf("Eroare la extragerea datelor!\n");
-        set_bit_to_value(bm.inode_map, new_inode, sizeof(bm.inode_map), 0);
-        return;
+/*****************************************************************/
+// write the words before '>' or '>>' to the file after it; content is kept
+// with a '\0' at the end, which the content added by '>>' overwrites
+int echo_cmd(int argc, char **argv) {
+    int delete = 1;
+    int sign_position = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], ">")) {
+            delete = 1;
+            sign_position = i;
+        } else if (!strcmp(argv[i], ">>")) {
+            delete = 0;
+            sign_position = i;
+        }
     }
 
-    dir.entries[dir.count].inode_index = new_inode;
-    strcpy(dir.entries[dir.count].filename, filename);
-    dir.count++;
-
-
-    if (!update_memory(&dir, sizeof(dir), directory_inode)) {
-        set_bit_to_value(bm.inode_map, new_inode, sizeof(bm.inode_map), 0);
-        return;
+    // verify if there s more paths after '>'/'>>'
+    if (argc != (sign_position + 2)) {
+        report(SHOW_ERROR, "Argumente incorecte.\n");
+        return -EINVAL;
     }
 
-    printf("Fisierul %s a fost creat cu succes.\n", filename);
-}
-
-/*****************************************************************/
-// Change current directory to the specified directory name
-void change_dir_cmd(unsigned char *path) {
-    // initialize current directory
-    directory dir;
-    if(!extract_data(&dir, crtInode)) {
-        printf("Eroare la extragerea datelor.\n");
-        return;
+    // without words, the file is only verified
+    int flags = FS_O_WRONLY;
+    if (sign_position > 1 && delete) {
+        flags |= FS_O_TRUNC;
     }
-
-    int new_inode = find_inode_of_path(path, crtInode, NULL, NULL);
-    if (new_inode == -1) {
-        printf("Nu a fost gasit directorul.\n");
-        return;
+    int fd = fs_open(argv[sign_position + 1], flags);
+    if (fd < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(fd));
+        return fd;
     }
 
-    if (inodes[new_inode].file_type == 0) {
-        printf("Nu a fost gasit directorul.\n");
-        return;
-    }
+    // join the words, each followed by a space, and write them at once
+    if (sign_position > 1) {
+        char content[LINESIZE + 1];
+        int len = 0;
+        for (int i = 1; i < sign_position; i++) {
+            int word_len = strlen(argv[i]);
+            memcpy(content + len, argv[i], word_len);
+            len += word_len;
+            content[len++] = ' ';
+        }
+        content[len] = '\0';
 
-    // change current inode to the new directory
-    crtInode = new_inode;
+        int err = fs_lseek(fd, 0, SEEK_END);
+        if (err > 0) {
+            err = fs_lseek(fd, -1, SEEK_END);
+        }
+        if (err >= 0) {
+            err = fs_write(fd, content, len + 1);
+        }
+        if (err < 0) {
+            report(SHOW_ERROR, "%s\n", fs_strerror(err));
+            fs_close(fd);
+            return err;
+        }
+    }
+    fs_close(fd);
+    report(SHOW_DONE, "Continutul a fost adaugat.\n");
+    return 0;
 }
 
 
 /*****************************************************************/
-// this function create a directory with a specified name
-void create_dir_cmd(unsigned char *path) {
-    // to not be NULL
-    unsigned char *dir_name = malloc(1);
-
-    int parent_inode = 0;
-    if (find_inode_of_path(path, crtInode, &parent_inode, &dir_name) != -2) {
-        printf("Eroare.\n");
-        return;
-    }
-
-    // extract data and make necessary verifications
-    directory parent_dir;
-    if (!extract_data(&parent_dir, parent_inode)) {
-        printf("Eroare la extragerea datelor!\n");
-        return;
-    };
-
-    if (parent_dir.count >= MAX_FILES_IN_DIRECTORY) {
-        printf("Acest director este plin!\n");
-        return;
+// display the content of a file
+int cat_cmd(int argc, char **argv) {
+    int fd = fs_open(argv[1], FS_O_RDONLY);
+    if (fd < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(fd));
+        return fd;
     }
 
-    if (strlen(dir_name) > MAX_FILE_NAME) {
-        printf("Numele directorului este prea lung.\n");
-        return;
+    // stream the content, until the '\0' that ends it
+    char buf[READ_CHUNK];
+    int len, shown = 0;
+    int show = visible(SHOW_DATA);
+    while ((len = fs_read(fd, buf, sizeof(buf))) > 0) {
+        char *end = memchr(buf, '\0', len);
+        if (show) fwrite(buf, 1, end ? end - buf : len, stdout);
+        shown = 1;
+        if (end) break;
     }
+    fs_close(fd);
 
-    for (int i = 0; i < parent_dir.count; i++) {
-        if (!strcmp(parent_dir.entries[i].filename, dir_name)) {
-            printf("Nu pot exista doua directoare cu acelasi nume.\n");
-            return;
-        }
+    if (len < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(len));
+        return len;
     }
-
-    // find inode for director
-    int new_inode = find_free_inode();
-    if (new_inode == -1) return;
-
-    // set new inode
-    set_bit_to_value(bm.inode_map, new_inode, sizeof(bm.inode_map), 1);
-    inodes[new_inode].file_type = 1;
-    inodes[new_inode].parent_inode_index = parent_inode;
-    inodes[new_inode].crtBLocks = 0;
-
-    // create new directory
-    directory new_dir = {0};
-    new_dir.count = 2;
-
-    // add default "." entry
-    memcpy(new_dir.entries[0].filename, ".", 1);
-    new_dir.entries[0].inode_index = new_inode;
-
-    // add default ".." entry
-    memcpy(new_dir.entries[1].filename, "..", 2);
-    new_dir.entries[1].inode_index = parent_inode;
-
-    if (!update_memory(&new_dir, sizeof(new_dir), new_inode)) {
-        set_bit_to_value(bm.inode_map, new_inode, sizeof(bm.inode_map), 0);
-        return;
+    if (shown) {
+        report(SHOW_DATA, "\n");
     }
+    return 0;
+}
 
-    // update parent directory and new directory entry
-    parent_dir.entries[parent_dir.count].inode_index = new_inode;
-    strcpy(parent_dir.entries[parent_dir.count++].filename, dir_name);
+/*****************************************************************/
+// remove directory if it s empty
+int rm_dir_cmd(int argc, char **argv) {
+    int err = fs_rmdir(argv[1]);
+    if (err < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
+    }
+    report(SHOW_DONE, "Directorul %s a fost sters.\n", last_name(argv[1]));
+    return 0;
+}
 
-    update_memory(&parent_dir, sizeof(parent_dir), parent_inode);
 
-    printf("Directorul %s a fost creat cu succes.\n", dir_name);
+/*****************************************************************/
+// remove the file from specified path
+int rm_file_cmd(int argc, char **argv) {
+    int err = fs_unlink(argv[1]);
+    if (err < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
+    }
+    report(SHOW_DONE, "Fisierul %s a fost sters.\n", last_name(argv[1]));
+    return 0;
 }
 
 
 /*****************************************************************/
-// this function shows all entries of a directory
-void list_cmd(int args, char *argv[]) {
-    // will store necessary inode
-    int neededInode;
-    if (args == 1) {
-        neededInode = crtInode;
-    } else if (args == 2) {
-        // there s a path
-        neededInode = find_inode_of_path(argv[1], crtInode, NULL, NULL);
-        if (neededInode < 0) {
-            printf("Calea %s nu este corecta.\n", argv[1]);
-            return;
-        }
-    } else {
-        printf("Argumente incorecte.\n");
-        return;
-    }
-
-    // will print all entries from directory
-    int file_type = inodes[neededInode].file_type;
-    if (file_type == 1) {
-        directory dir;
-        extract_data(&dir, neededInode);
-        for (int i = 0; i < dir.count; i++) {
-            printf("%s\n", dir.entries[i].filename);
+// create files with specified names
+// return 0 or the error of the first file that failed
+int make_file_cmd(int argc, char **argv) {
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        int fd = fs_open(argv[i], FS_O_WRONLY | FS_O_CREAT | FS_O_EXCL);
+        if (fd < 0) {
+            report(SHOW_ERROR, "%s\n", fs_strerror(fd));
+            if (status == 0) status = fd;
+            continue;
         }
+        fs_close(fd);
+        report(SHOW_DONE, "Fisierul %s a fost creat cu succes.\n", last_name(argv[i]));
     }
+    return status;
 }
 
+/*****************************************************************/
+// Change current directory to the specified directory name
+int change_dir_cmd(int argc, char **argv) {
+    int err = fs_chdir(argv[1]);
+    if (err < 0) {
+        report(SHOW_ERROR, "%s\n", fs_strerror(err));
+        return err;
+    }
+    update_path(argv[1]);
+    return 0;
+}
 
 
 /*****************************************************************/
-// initiates filesystem: (default initialization & create root) / read disk
-int filesystem_init() {
-    if (superblock_init()) {
-        memmove(bm.inode_map, disk_buffer[sb.inode_bitmap_start], INODE_MAP_LEN);
-        memmove(bm.block_map, disk_buffer[sb.block_bitmap_start], BLOCK_MAP_LEN);
-        memmove(inodes, *(disk_buffer + sb.inode_table_start), sizeof(inodes));
-    } else {
-        // reset bitmap of blocks
-        memset(bm.block_map, 0, sizeof(bm.block_map));
-        // all this blocks are occupied by superblock, bitmaps, inode table
-        for (int i = 0; i < sb.data_blocks_start; i++) {
-            set_bit_to_value(bm.block_map, i, BLOCK_MAP_LEN, 1);
+// this function create directories with specified names
+// return 0 or the error of the first directory that failed
+int create_dir_cmd(int argc, char **argv) {
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        int err = fs_mkdir(argv[i]);
+        if (err < 0) {
+            report(SHOW_ERROR, "%s\n", fs_strerror(err));
+            if (status == 0) status = err;
+            continue;
         }
-
-        // reset bitmap of inodes
-        memset(bm.inode_map, 0, sizeof(bm.inode_map));
-
-        // create root directory
-        directory root = {0};
-        root.count = 2;
-
-        char s1[] = ".";
-        char s2[] = "..";
-        // add default "." entry
-        memcpy(root.entries[0].filename, s1, strlen(s1));
-        root.entries[0].inode_index = ROOT_INODE_INDEX;
-
-        // add default ".." entry
-        memcpy(root.entries[1].filename, s2, strlen(s2));
-        root.entries[1].inode_index = ROOT_INODE_INDEX;
-
-        inodes[ROOT_INODE_INDEX].file_type = 1;
-        inodes[ROOT_INODE_INDEX].parent_inode_index = ROOT_INODE_INDEX;
-        set_bit_to_value(bm.inode_map, ROOT_INODE_INDEX, sizeof(bm.inode_map), 1);
-        //printf("bit: %d", find_bit_value(bm.inode_map, ROOT_INODE_INDEX, sizeof(bm.inode_map)));
-
-        update_memory(&root, sizeof(root), ROOT_INODE_INDEX);
+        report(SHOW_DONE, "Directorul %s a fost creat cu succes.\n", last_name(argv[i]));
     }
-    return 1;
+    return status;
 }
 
 
 /*****************************************************************/
-// this function copies data from "disk" to "buffer" and initiates suberblock
-// return 1 for success
-int superblock_init() {
-    FILE *f = fopen(FILESYSTEM_NAME, "rb");
-    int is_disk = 1;
-    if (f != NULL && !file_is_empty(FILESYSTEM_NAME)) {      // if disk doesn t contain data, default initialization 
-        for (int i = 0; i < NR_BLOCKS; i++) {
-            fread(disk_buffer[i], BLOCK_SIZE, 1, f);
-        }
-        memmove(&sb, disk_buffer[0], sizeof(sb));       // read all superblock from first block of memory
-        fclose(f);
-    } else {
-        is_disk = 0;
-        sb.total_blocks = NR_BLOCKS;
-        sb.block_size = BLOCK_SIZE;
-        sb.inode_count = MAX_INODES;
-        sb.free_blocks = NR_BLOCKS - 1;
-        sb.free_nodes = MAX_INODES - 1;
-        sb.inode_bitmap_start = 1;
-        sb.block_bitmap_start = 2;
-        sb.inode_table_start = 3;
-        sb.data_blocks_start = 3 + ceil(MAX_INODES * sizeof(struct inode) / BLOCK_SIZE);   // find nr of blocks after inode table
-    }
-
-    return is_disk;
+// this function shows all entries of a directory
+int list_cmd(int argc, char **argv) {
+    // without a path, the current directory
+    const char *dir = (argc == 2) ? argv[1] : ".";
+    int fd = fs_open(dir, FS_O_RDONLY);
+    if (fd < 0) {
+        report(SHOW_ERROR, "Calea %s nu este corecta.\n", dir);
+        return fd;
+    }
+
+    // will print all entries from directory, nothing for a file
+    struct fs_dirent entry;
+    while (fs_readdir(fd, &entry) == 1) {
+        report(SHOW_DATA, "%s\n", entry.name);
+    }
+    fs_close(fd);
+    return 0;
 }
 
 
-
 /*****************************************************************/
-// find the full path from the current inode to the root
-int find_path_of_inode(int crt_inode, unsigned char **str) {
-    if (str == NULL) return 0; // for safety
-
-    int length = 256;       // reasonable length 
-    unsigned char *path = malloc(length);
-    if (path == NULL) return 0;
-    path[0] = '\0';
-
-    int parent_inode;
-
-    // move accross inodes until meeting root
-    while (crt_inode != ROOT_INODE_INDEX) {
-        parent_inode = inodes[crt_inode].parent_inode_index;
-        directory dir;
-        extract_data(&dir, parent_inode);
-
-        // find the directory entry corresponding to the current inode
-        for (int i = 0; i < dir.count; i++) {
-            if (crt_inode == dir.entries[i].inode_index) {
-                int name_len = strlen(dir.entries[i].filename);
-                int path_len = strlen(path);
-
-                // ensure there is enough space in the path buffer
-                while (length < strlen(path) +  strlen(dir.entries[i].filename) + 2) {
-                    length *= 2;
-                    char *temp = realloc(path, length);
-                    if (temp == NULL) {
-                        free(path);
-                        return 0;
-                    }
-                    path = temp;
-                }
-
-                // add directory name to path
-                memmove(path + name_len + 1, path, path_len + 1);
-                path[name_len] = '/';
-                memmove(path, dir.entries[i].filename, name_len);
-                break;
-            }
-        }
+// start the stack of names at root
+// return 1 for success
+int init_path() {
+    cwd.size = LINESIZE;
+    cwd.path = malloc(cwd.size);
+    cwd.max_depth = 16;
+    cwd.name_start = malloc(cwd.max_depth * sizeof(int));
+    if (cwd.path == NULL || cwd.name_start == NULL) return 0;
+
+    strcpy(cwd.path, "/");
+    cwd.len = 1;
+    return 1;
+}
 
-        crt_inode = parent_inode;
-    }
 
-    // ensure there is enough space for '/'
-    while (length < strlen(path) + 1) {
-        length++;
-        char *temp = realloc(path, length);
-        if (temp == NULL) {
-            return 0;
+/*****************************************************************/
+// follow "target", a path that cd entered, on the stack of names: ".." takes the
+// last name out and "." changes nothing
+void update_path(char *target) {
+    if (target[0] == '/') {
+        cwd.len = 1;
+        cwd.depth = 0;
+    }
+
+    char *save;
+    for (char *name = strtok_r(target, "/", &save); name; name = strtok_r(NULL, "/", &save)) {
+        if (!strcmp(name, "..")) {
+            if (cwd.depth > 0) cwd.len = cwd.name_start[--cwd.depth];
+        } else if (strcmp(name, ".") && !push_name(name)) {
+            break;
         }
-        path = temp;
     }
+    cwd.path[cwd.len] = '\0';
+}
 
-    // add '/' to path
-    memmove(path + 1, path, strlen(path) + 1);
-    path[0] = '/';
 
-    free(*str);
-    *str = strdup(path);
-    free(path);
+/*****************************************************************/
+// add "name" and its '/' at the end of path
+// return 1 for success
+int push_name(const char *name) {
+    int len = strlen(name);
+    if (cwd.len + len + 2 > cwd.size) {
+        char *bigger = realloc(cwd.path, 2 * cwd.size + len);
+        if (bigger == NULL) return 0;
+        cwd.path = bigger;
+        cwd.size = 2 * cwd.size + len;
+    }
+    if (cwd.depth == cwd.max_depth) {
+        int *more = realloc(cwd.name_start, 2 * cwd.max_depth * sizeof(int));
+        if (more == NULL) return 0;
+        cwd.name_start = more;
+        cwd.max_depth *= 2;
+    }
+
+    cwd.name_start[cwd.depth++] = cwd.len;
+    memcpy(cwd.path + cwd.len, name, len);
+    cwd.len += len;
+    cwd.path[cwd.len++] = '/';
     return 1;
 }
 
 
 /*****************************************************************/
 void print_path() {
-    printf("%s> ", path);
+    printf("%s> ", cwd.path);
 }
 
 
 /*****************************************************************/
-// add any characters to a file
-int add_word_to_file(unsigned char *content, int file_inode, int delete) {
-    //verify inode
-    if (find_bit_value(bm.inode_map, file_inode, sizeof(bm.inode_map)) == 0) {
-        printf("Eroare.\n");
-        return 0;
-    } else if (inodes[file_inode].file_type == 1) {
-        printf("Nu este fisier.\n");
-        return 0;
-    }
-
-    if (strlen(content) + inodes[file_inode].file_size > MAX_CONTENT_IN_FILE) {
-        printf("Fisierul este plin.\n");
-        return 0;
-    }
-
-    // if user wants to delete the old content of file
-    if (delete == 1) {
-        update_memory(NULL, 0, file_inode);
-    }
-
-    int file_size = inodes[file_inode].file_size;
-    int content_size = strlen(content);
-
-    // for adding '\0'
-    if (file_size == 0) file_size++;
-
-
-    unsigned char *file = calloc(content_size + file_size, 1);
-    if (!file) {
-        printf("Eroare la alocarea memorie!\n");
-        return 0;
-    }
-    
-    file[content_size + file_size] = '\0';
-
-
-    // extract old file content
-    extract_data(file, file_inode);
-
-    // add new content
-    strncpy(file + file_size - 1, content, content_size);
-
-    update_memory(file, content_size + file_size, file_inode);
-
-    return 1;
-} 
+// the last name of a path, without the '/' after it
+const char *last_name(char *path) {
+    int len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+    char *slash = strrchr(path, '/');
+    return (slash && slash[1]) ? slash + 1 : path;
+}
 
 
 /*****************************************************************/
@@ -802,7 +797,7 @@ void parse(char *in, int *argc, char *argv[]) {
 
         argv[count++] = in;         // point to word
         in = strpbrk(in, space);
-        if (in == NULL) break;      
+        if (in == NULL) break;
 
         *in = '\0';
         in++;
@@ -811,255 +806,28 @@ void parse(char *in, int *argc, char *argv[]) {
     *argc = count;
 }
 
-/*****************************************************************/
-// verify if a file (disk) contains data from a precedent writing
-// return 1 if file is empty
-int file_is_empty(char *filename) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) {
-        return 0;
-    }
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-
-    fclose(f);
-    return (size == 0);
-}
-
 
 /*****************************************************************/
-// set a specific bit to 0 or 1
-// return 1 for success, 0 error
-int set_bit_to_value(unsigned char *arr, int nr_bit, int arr_len_in_bytes, int value) {
-    // verify if bit can be set
-    if ((nr_bit < 0 || nr_bit >= arr_len_in_bytes * BYTE_LEN)|| 
-    (value != 0 && value != 1)) {
-        return 0;
-    }
+// tell when the disk was opened otherwise than the options asked
+void mount_notes(const fs_options *opts) {
+    struct fs_info info;
+    if (fs_statfs(&info) < 0) return;
 
-    int pos = nr_bit / BYTE_LEN;        // find position of byte
-    nr_bit = nr_bit % BYTE_LEN;         // find position of bit within byte
-    switch (value) {
-        case 1:
-            arr[pos] |= (1 << nr_bit);  // set to 1
-        break;
-        case 0:
-            arr[pos] &= ~(1 << nr_bit); // set to 0
-        break;
+    if (info.converted) {
+        printf("Discul a fost convertit la formatul acestui program.\n");
     }
-    return 1;
-}
-
-
-/*****************************************************************/
-// extract data from the blocks specified by inode and put them in the array
-int extract_data(void *array, int inode_index) {
-    // see if inode is valid
-    if (find_bit_value(bm.inode_map, inode_index, sizeof(bm.inode_map)) == -1) {
-        return 0;
+    if (opts->mmap && !info.mapped) {
+        printf("Discul nu a putut fi mapat, va fi citit in memorie.\n");
     }
-
-    // cast array
-    unsigned char* arr = (unsigned char*)array;
-
-    int size = inodes[inode_index].file_size;
-    int crtBlocks = inodes[inode_index].crtBLocks;
-
-    // extract data and modify given array
-    for (int i = 0; i < crtBlocks; i++) {
-        int copy_size = (size < BLOCK_SIZE) ? size : BLOCK_SIZE;
-        memmove(arr, disk_buffer[inodes[inode_index].direct_blocks[i]], copy_size);
-        arr += copy_size;
-        size -= copy_size;
-    }
-
-    return 1;
-}
-
-/*****************************************************************/
-// find value of a specific bit from an array
-// return 0/1, or -1 for error
-int find_bit_value(unsigned char* arr, int pos, int size) {
-    // position should be valid
-    if (pos < 0 || pos >= size * BYTE_LEN) return -1;
-
-    int index = pos / BYTE_LEN;
-    int offset = pos % BYTE_LEN;
-    if ((arr[index] & (1 << offset)) == 0) {
-        return 0;
-    }
-    return 1;
-}
-
-
-/*****************************************************************/
-
-/* if size of a file/directory is modified, update disk, bitmap of blocks and inode fields that manage memory.
-Can be used to delete blocks, add  blocks, but another changes as delete inode, add inode,
-update bm of inodes etc, should be changed manually */
-int update_memory(void *a, int size, int inode_index) {
-    unsigned char *arr = (unsigned char *)a;
-    // calculate all blocks that we need
-    int requiredBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-
-    if (requiredBlocks > MAX_DIRECT_BLOCKS) {
-        printf("Memoria alocata individual a atins maximul!\n");
-        return 0;
-    }
-
-    if (!find_bit_value(bm.inode_map, inode_index, sizeof(bm.inode_map))) {
-        printf("Noul inode e folosit.\n");
-        return 0;
-    }
-    int usedBlocks = inodes[inode_index].crtBLocks;
-
-    if (sb.free_blocks < requiredBlocks - usedBlocks) {
-        printf("Nu mai exista memorie libera pe disc!\n");
-        return 0;
-    }
-
-    // update data to the old blocks
-    for (int i = 0; i < requiredBlocks && i < usedBlocks; i++) {
-        memmove(disk_buffer[inodes[inode_index].direct_blocks[i]], arr + BLOCK_SIZE * i, BLOCK_SIZE);
+    if (!info.mapped && strcmp(info.io, opts->io)) {
+        printf("Dispozitivul %s nu poate fi folosit, se foloseste %s.\n", opts->io, info.io);
     }
-
-    // if necessary, allocate new blocks
-    for (int i = usedBlocks; i < requiredBlocks; i++) {
-        // looking for free block
-        int free_block = find_free_block();
-
-        // write data to the newly allocated block
-        memmove(disk_buffer[free_block], arr + BLOCK_SIZE * i, BLOCK_SIZE);
-        set_bit_to_value(bm.block_map, free_block, sizeof(bm.block_map), 1);
-        sb.free_blocks--;
-        inodes[inode_index].direct_blocks[i] = free_block;
-    }
-
-    // if necessary, delete blocks
-    for (int i = requiredBlocks; i < usedBlocks; i++) {
-        memset(disk_buffer[inodes[inode_index].direct_blocks[i]], 0, BLOCK_SIZE);
-        set_bit_to_value(bm.block_map, inodes[inode_index].direct_blocks[i], sizeof(bm.block_map), 0);
-        sb.free_blocks++;
-    }
-
-    inodes[inode_index].crtBLocks = requiredBlocks;
-    inodes[inode_index].file_size = size;
-
-    return 1;
-
 }
 
 
 /*****************************************************************/
-// find index of free block
-// return index or -1 for error
-int find_free_block() {
-    // there s no free blocks anymore
-    if (sb.free_blocks == 0) return -1;
-
-    // find free block
-    for (int i = 0; i < NR_BLOCKS; i++) {
-        if (find_bit_value(bm.block_map, i, sizeof(bm.block_map)) == 0) {
-            return i;
-        }
-    }
-
-    return -1;
-}
-
-
-/*****************************************************************/
-// find index of free inode
-// return index or -1 for error
-int find_free_inode() {
-    if (sb.free_nodes == 0) return -1;
-
-    for (int i = 0; i < MAX_INODES; i++) {
-        if (find_bit_value(bm.inode_map, i, sizeof(bm.inode_map)) == 0) {
-            return i;
-        }
-    }
-
-    return -1;
-}
-
-
-/*****************************************************************/
-//this function returns inode of specified path
-//returns -2 if path is correct, but the last element isn t 
-//returns -1 if path is wrong
-int find_inode_of_path(unsigned char *path, int crt_inode, int *parent_inode, unsigned char **last_file_name) {
-    if (path == NULL) return -1;
-
-    unsigned char *copy_path = strdup(path);
-    if (copy_path == NULL) return -1;
-
-    // verify if it s absolute path
-    if (copy_path[0] == '/') { 
-        crt_inode = ROOT_INODE_INDEX;
-    }
-
-    // token will contain file/dir name
-    char *token = strtok(copy_path, "/");
-
-    if (parent_inode != NULL) {
-        *parent_inode = crt_inode;
-    }
-
-    int is_file = 0;
-    int exist = 1;
-
-    while (token != NULL) {
-        // copy last name from path
-        if (last_file_name != NULL) {
-            free(*last_file_name);
-            *last_file_name = strdup(token);
-        }
-
-        if (strlen(token) > MAX_FILE_NAME) {
-            free(copy_path);
-            return -1;
-        }
-
-        // if path continues after a file was discovered, is incorrect
-        if (is_file == 1) {
-            free(copy_path);
-            return -1;
-        }
-
-        directory dir;
-        // if can t extract data ,directory doesn t exist
-        if (!extract_data(&dir, crt_inode)) {
-            free(copy_path);
-            return -1;
-        }
-
-        // start_inode will be changed in the next for
-        if (parent_inode != NULL) {
-            *parent_inode = crt_inode;
-        }
-
-        // find file/dir
-        exist = 0;
-        for (int i = 0; i < dir.count; i++) {
-            if (!strcmp(dir.entries[i].filename, token)) {
-                exist = 1;
-                crt_inode = dir.entries[i].inode_index;
-
-                if (inodes[dir.entries[i].inode_index].file_type == 0) {
-                    is_file = 1;
-                }
-                break;
-            }
-        }
-        if (exist == 0) {
-            // if -2 is returned, we know that last file/directory from path does n exist
-            crt_inode = -2;
-        }
-        token = strtok(NULL, "/");
-    }
-
-    free(copy_path);
-    // will return necessary inode
-    return crt_inode;
+// the filesystem can t go on (no memory for its cache), the process ends after this
+void fatal_message(int err) {
+    printf("%s\n", fs_strerror(err));
+    fflush(stdout);
 }
@@ -0,0 +1,44 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/* requests of clients to the server, over a Unix socket. A request is a header
+followed by "path_len" bytes of path and "data_len" bytes of data; the answer is a
+header followed by "data_len" bytes. Numbers are in the byte order of the machine,
+client and server run on the same one. A client can send many requests without
+waiting: they run in order and their answers come in the same order, with the "id"
+of their request */
+
+#include <stdint.h>
+
+#define SERVER_SOCKET "filesystem.sock"
+#define MAX_REQUEST_DATA (1 << 20)      // longest path or data of a request
+
+enum request_op {
+    OP_MKDIR,           // create directory "path"
+    OP_TOUCH,           // create empty file "path"
+    OP_WRITE,           // replace content of file "path" with data (echo >)
+    OP_APPEND,          // add data to file "path" (echo >>)
+    OP_CAT,             // answer with content of file "path"
+    OP_LS,              // answer with names of directory "path", each ended by '\n'
+    OP_RM,              // remove file "path"
+    OP_RMDIR,           // remove empty directory "path"
+    OP_CD,              // change current directory of the connection
+    OP_PWD,             // answer with path of current directory
+    OP_COUNT
+};
+
+struct request_header {
+    uint32_t id;        // chosen by client, copied in the answer
+    uint8_t op;         // enum request_op
+    uint8_t pad[3];
+    uint32_t path_len;
+    uint32_t data_len;
+};
+
+struct answer_header {
+    uint32_t id;
+    int32_t status;     // 0 or a negative error code, like the fs_* functions
+    uint32_t data_len;
+};
+
+#endif
@@ -0,0 +1,661 @@
+#define _GNU_SOURCE     // accept4
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "fs.h"
+#include "protocol.h"
+
+/************************** Defining Constants for server *******************/
+
+#define FILESYSTEM_NAME "filesystem.bin"    // represents "disk"
+#define WORKERS 4               // threads that run requests
+#define MAX_EVENTS 64           // events taken by one epoll_wait
+#define RECV_CHUNK 65536        // bytes received at once
+#define OUT_LIMIT (4 << 20)     // answers kept for a client before reading stops
+#define READ_CHUNK 4096         // bytes read from a file at once
+
+/* the main thread waits in epoll for clients and their bytes; a client with whole
+requests goes in the queue, and a worker runs all of them in order and sends the
+answers. A client is taken by one worker at a time, so its requests never run out
+of order, while the requests of different clients run at the same time */
+
+typedef struct {
+    char *data;
+    int len;
+    int size;
+} buffer;
+
+typedef struct connection {
+    int sock;
+    int cwd;                    // descriptor of current directory, -1 for root
+    pthread_mutex_t lock;       // guards the fields below
+    buffer in;                  // received bytes, not run yet
+    buffer out;                 // answers, not sent yet
+    int queued;                 // waits in the queue or is run by a worker
+    int closed;                 // client left, freed when no worker has it
+    struct connection *next;    // in the queue
+} connection;
+
+struct work_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    connection *first;
+    connection *last;
+    int stop;
+} work = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+int epoll_fd;
+int listen_fd;
+int signal_fd;
+long served;            // requests run, for the message at exit
+
+/************************** functions *******************/
+
+int server_init(const char *);
+void event_loop();
+void accept_clients();
+void receive(connection *);
+void watch(connection *);
+void send_answers(connection *);
+void free_connection(connection *);
+void enqueue(connection *);
+void *worker(void *);
+void run_requests(connection *, char *, int);
+int run_request(connection *, struct request_header *, char *, char *, buffer *);
+int request_len(buffer *);
+int write_content(int, const char *, char *, int);
+int read_file(const char *, buffer *);
+int list_dir(const char *, buffer *);
+int change_dir(connection *, const char *);
+int current_dir(buffer *);
+int reserve(buffer *, int);
+void take_bytes(buffer *, int);
+void mount_notes(const fs_options *);
+void fatal_message(int);
+
+
+/*****************************************************************/
+
+int main(int args, char *options[]) {
+    const char *socket_path = SERVER_SOCKET;
+    int workers = WORKERS;
+
+    fs_options opts;
+    fs_default_options(&opts);
+    opts.fatal = fatal_message;
+    for (int i = 1; i < args; i++) {
+        if (!strcmp(options[i], "--socket") && i + 1 < args) {
+            socket_path = options[++i];
+        } else if (!strcmp(options[i], "--workers") && i + 1 < args) {
+            workers = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--extents")) {
+            opts.extents = 1;
+        } else if (!strcmp(options[i], "--mmap")) {
+            opts.mmap = 1;
+        } else if (!strcmp(options[i], "--no-journal")) {
+            opts.journal = 0;
+        } else if (!strcmp(options[i], "--no-inline")) {
+            opts.inline_data = 0;
+        } else if (!strcmp(options[i], "--checksums")) {
+            opts.checksums = 1;
+        } else if (!strcmp(options[i], "--cache") && i + 1 < args) {
+            opts.cache_kb = atoi(options[++i]);
+        } else if (!strcmp(options[i], "--io") && i + 1 < args) {
+            opts.io = options[++i];
+        } else if (!strcmp(options[i], "--flush") && i + 1 < args) {
+            opts.flush_interval = atoi(options[++i]);
+        } else {
+            printf("Optiune necunoscuta: %s\n", options[i]);
+        }
+    }
+    if (workers < 1) workers = 1;
+
+    // a client that leaves doesn t stop the server, the signals end it by epoll
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+    int err = fs_mount(FILESYSTEM_NAME, &opts);
+    if (err < 0) {
+        printf("Discul nu a putut fi deschis: %s\n", fs_strerror(err));
+        return 1;
+    }
+    mount_notes(&opts);
+    if (!server_init(socket_path)) {
+        perror("Serverul nu a putut porni");
+        fs_unmount();
+        return 1;
+    }
+
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    printf("Serverul asteapta clienti la %s.\n", socket_path);
+    fflush(stdout);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    event_loop();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // workers end the clients they run, then the disk is saved
+    pthread_mutex_lock(&work.lock);
+    work.stop = 1;
+    pthread_cond_broadcast(&work.ready);
+    pthread_mutex_unlock(&work.lock);
+    for (int i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    unlink(socket_path);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Au fost servite %ld cereri (%.0f cereri/s).\n", served, seconds > 0 ? served / seconds : 0);
+    err = fs_unmount();
+    if (err < 0) {
+        printf("%s\n", fs_strerror(err));
+        return 1;
+    }
+    return 0;
+}
+
+
+/*****************************************************************/
+// listen at "socket_path" and watch it, with SIGINT and SIGTERM, in epoll
+// return 1 for success
+int server_init(const char *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return 0;
+    strcpy(addr.sun_path, socket_path);
+
+    // blocked by main before any thread started
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    signal_fd = signalfd(-1, &stop, SFD_CLOEXEC);
+
+    unlink(socket_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || listen_fd == -1 || epoll_fd == -1 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, SOMAXCONN) == -1) {
+        return 0;
+    }
+
+    // the two are told apart from clients by their pointer
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &listen_fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) return 0;
+    event.data.ptr = &signal_fd;
+    return (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) != -1);
+}
+
+
+/*****************************************************************/
+// wait for new clients, requests and room to send answers, until a signal
+void event_loop() {
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &signal_fd) {
+                return;
+            }
+            if (events[i].data.ptr == &listen_fd) {
+                accept_clients();
+                continue;
+            }
+
+            connection *conn = events[i].data.ptr;
+            if (events[i].events & EPOLLOUT) {
+                pthread_mutex_lock(&conn->lock);
+                send_answers(conn);
+                watch(conn);
+                pthread_mutex_unlock(&conn->lock);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                receive(conn);
+            }
+        }
+    }
+}
+
+
+/*****************************************************************/
+// take every client waiting to connect
+void accept_clients() {
+    int sock;
+    while ((sock = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        connection *conn = calloc(1, sizeof(connection));
+        if (conn == NULL) {
+            close(sock);
+            continue;
+        }
+        conn->sock = sock;
+        conn->cwd = -1;
+        pthread_mutex_init(&conn->lock, NULL);
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) == -1) {
+            free_connection(conn);
+        }
+    }
+}
+
+
+/*****************************************************************/
+// keep the bytes sent by a client, and give it to a worker if a request is whole
+void receive(connection *conn) {
+    pthread_mutex_lock(&conn->lock);
+    int left = 0;
+    while (1) {
+        if (!reserve(&conn->in, RECV_CHUNK)) {
+            left = 1;
+            break;
+        }
+        int len = recv(conn->sock, conn->in.data + conn->in.len, RECV_CHUNK, 0);
+        if (len > 0) {
+            conn->in.len += len;
+            continue;
+        }
+        if (len == -1 && errno == EINTR) continue;
+        left = (len == 0 || errno != EAGAIN);
+        break;
+    }
+
+    // a wrong request ends the client
+    if (request_len(&conn->in) < 0) left = 1;
+
+    if (left) {
+        // requests received before stay unanswered
+        conn->closed = 1;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock, NULL);
+        int free_now = !conn->queued;
+        pthread_mutex_unlock(&conn->lock);
+        if (free_now) free_connection(conn);
+        return;
+    }
+
+    int whole = (request_len(&conn->in) > 0);
+    int start = whole && !conn->queued;
+    if (start) conn->queued = 1;
+    pthread_mutex_unlock(&conn->lock);
+    if (start) enqueue(conn);
+}
+
+
+/*****************************************************************/
+// wait for requests while the client reads its answers, and for room to send them;
+// called with the lock of connection
+void watch(connection *conn) {
+    if (conn->closed) return;
+    struct epoll_event event = {.data.ptr = conn};
+    if (conn->out.len < OUT_LIMIT) event.events |= EPOLLIN;
+    if (conn->out.len > 0) event.events |= EPOLLOUT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sock, &event);
+}
+
+
+/*****************************************************************/
+// send as many answers as the socket takes; called with the lock of connection
+void send_answers(connection *conn) {
+    int sent = 0;
+    while (sent < conn->out.len) {
+        int len = send(conn->sock, conn->out.data + sent, conn->out.len - sent, MSG_NOSIGNAL);
+        if (len > 0) {
+            sent += len;
+        } else if (len == -1 && errno == EINTR) {
+            continue;
+        } else {
+            // a broken socket is found by epoll, its answers are dropped
+            if (len == -1 && errno != EAGAIN) sent = conn->out.len;
+            break;
+        }
+    }
+    take_bytes(&conn->out, sent);
+}
+
+
+/*****************************************************************/
+void free_connection(connection *conn) {
+    if (conn->cwd != -1) fs_close(conn->cwd);
+    close(conn->sock);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+
+/*****************************************************************/
+// give a client with requests to the workers
+void enqueue(connection *conn) {
+    pthread_mutex_lock(&work.lock);
+    conn->next = NULL;
+    if (work.last) {
+        work.last->next = conn;
+    } else {
+        work.first = conn;
+    }
+    work.last = conn;
+    pthread_cond_signal(&work.ready);
+    pthread_mutex_unlock(&work.lock);
+}
+
+
+/*****************************************************************/
+// run the requests of clients from the queue, until the server stops
+void *worker(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&work.lock);
+        while (work.first == NULL && !work.stop) {
+            pthread_cond_wait(&work.ready, &work.lock);
+        }
+        connection *conn = work.first;
+        if (conn == NULL) {
+            pthread_mutex_unlock(&work.lock);
+            return NULL;
+        }
+        work.first = conn->next;
+        if (work.first == NULL) work.last = NULL;
+        pthread_mutex_unlock(&work.lock);
+
+        // relative paths of this client start at its own directory
+        fs_fchdir(conn->cwd);
+
+        // take the whole requests received until now, run them without the lock
+        // and send their answers; stop when no whole request is left
+        pthread_mutex_lock(&conn->lock);
+        while (!conn->closed) {
+            int len = 0, next;
+            while ((next = request_len(&(buffer){conn->in.data + len, conn->in.len - len, 0})) > 0) {
+                len += next;
+            }
+            if (next < 0) {
+                // epoll sees the end and drops the client
+                shutdown(conn->sock, SHUT_RDWR);
+            }
+            if (len == 0) break;
+
+            char *requests = malloc(len);
+            if (requests == NULL) break;
+            memcpy(requests, conn->in.data, len);
+            take_bytes(&conn->in, len);
+            pthread_mutex_unlock(&conn->lock);
+
+            run_requests(conn, requests, len);
+            free(requests);
+            pthread_mutex_lock(&conn->lock);
+        }
+        conn->queued = 0;
+        int closed = conn->closed;
+        pthread_mutex_unlock(&conn->lock);
+        fs_fchdir(-1);
+
+        if (closed) free_connection(conn);
+    }
+}
+
+
+/*****************************************************************/
+// run "len" bytes of whole requests of a client and send their answers
+void run_requests(connection *conn, char *requests, int len) {
+    buffer answers = {NULL, 0, 0};
+    int count = 0;
+    for (int pos = 0; pos < len; count++) {
+        struct request_header header;
+        memcpy(&header, requests + pos, sizeof(header));
+        char *path = requests + pos + sizeof(header);
+        char *data = path + header.path_len;
+        pos += sizeof(header) + header.path_len + header.data_len;
+
+        // the path gets its '\0' in a copy
+        char *name = strndup(path, header.path_len);
+        if (!reserve(&answers, sizeof(struct answer_header))) {
+            free(name);
+            break;
+        }
+        int at = answers.len;
+        answers.len += sizeof(struct answer_header);
+
+        struct answer_header answer = {header.id, 0, 0};
+        answer.status = name ? run_request(conn, &header, name, data, &answers) : -ENOMEM;
+        if (answer.status < 0) answers.len = at + sizeof(answer);
+        answer.data_len = answers.len - at - sizeof(answer);
+        memcpy(answers.data + at, &answer, sizeof(answer));
+        free(name);
+    }
+    __atomic_fetch_add(&served, count, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&conn->lock);
+    if (!conn->closed && reserve(&conn->out, answers.len)) {
+        memcpy(conn->out.data + conn->out.len, answers.data, answers.len);
+        conn->out.len += answers.len;
+        send_answers(conn);
+        watch(conn);
+    }
+    pthread_mutex_unlock(&conn->lock);
+    free(answers.data);
+}
+
+
+/*****************************************************************/
+// run one request, its answer data is added to "answer"
+// return 0 for success or a negative error code
+int run_request(connection *conn, struct request_header *header, char *path, char *data, buffer *answer) {
+    int fd;
+    switch (header->op) {
+    case OP_MKDIR:
+        return fs_mkdir(path);
+    case OP_TOUCH:
+        fd = fs_open(path, FS_O_WRONLY | FS_O_CREAT | FS_O_EXCL);
+        return (fd < 0) ? fd : fs_close(fd);
+    case OP_WRITE:
+    case OP_APPEND:
+        return write_content(header->op, path, data, header->data_len);
+    case OP_CAT:
+        return read_file(path, answer);
+    case OP_LS:
+        return list_dir(path[0] ? path : ".", answer);
+    case OP_RM:
+        return fs_unlink(path);
+    case OP_RMDIR:
+        return fs_rmdir(path);
+    case OP_CD:
+        return change_dir(conn, path);
+    case OP_PWD:
+        return current_dir(answer);
+    default:
+        return -EINVAL;
+    }
+}
+
+
+/*****************************************************************/
+// length of the first request of "buf"
+// return its bytes, 0 if it isn t whole yet, or -1 if it is wrong
+int request_len(buffer *buf) {
+    struct request_header header;
+    if (buf->len < (int)sizeof(header)) return 0;
+    memcpy(&header, buf->data, sizeof(header));
+    if (header.path_len > MAX_REQUEST_DATA || header.data_len > MAX_REQUEST_DATA) return -1;
+
+    int len = sizeof(header) + header.path_len + header.data_len;
+    return (buf->len >= len) ? len : 0;
+}
+
+
+/*****************************************************************/
+// write "data" in the file of "path" like echo: content is kept with a '\0' at the
+// end, which the content added by OP_APPEND overwrites
+// return 0 for success or a negative error code
+int write_content(int op, const char *path, char *data, int len) {
+    int fd = fs_open(path, FS_O_WRONLY | (op == OP_WRITE ? FS_O_TRUNC : 0));
+    if (fd < 0) return fd;
+
+    int err = 0;
+    if (len > 0) {
+        err = fs_lseek(fd, 0, SEEK_END);
+        if (err > 0) {
+            err = fs_lseek(fd, -1, SEEK_END);
+        }
+        if (err >= 0) {
+            err = fs_write(fd, data, len);
+        }
+        if (err >= 0) {
+            err = fs_write(fd, "", 1);
+        }
+    }
+    fs_close(fd);
+    return (err < 0) ? err : 0;
+}
+
+
+/*****************************************************************/
+// add the content of file "path" to "answer", until the '\0' that ends it
+// return 0 for success or a negative error code
+int read_file(const char *path, buffer *answer) {
+    int fd = fs_open(path, FS_O_RDONLY);
+    if (fd < 0) return fd;
+
+    int len = 0;
+    while (1) {
+        if (!reserve(answer, READ_CHUNK)) {
+            len = -ENOMEM;
+            break;
+        }
+        len = fs_read(fd, answer->data + answer->len, READ_CHUNK);
+        if (len <= 0) break;
+        char *end = memchr(answer->data + answer->len, '\0', len);
+        answer->len += end ? end - (answer->data + answer->len) : len;
+        if (end) break;
+    }
+    fs_close(fd);
+    return (len < 0) ? len : 0;
+}
+
+
+/*****************************************************************/
+// add the names of directory "path" to "answer", each ended by '\n'
+// return 0 for success or a negative error code
+int list_dir(const char *path, buffer *answer) {
+    int fd = fs_open(path, FS_O_RDONLY);
+    if (fd < 0) return fd;
+
+    struct fs_dirent entry;
+    int err;
+    while ((err = fs_readdir(fd, &entry)) == 1) {
+        int len = strlen(entry.name);
+        if (!reserve(answer, len + 1)) {
+            err = -ENOMEM;
+            break;
+        }
+        memcpy(answer->data + answer->len, entry.name, len);
+        answer->data[answer->len + len] = '\n';
+        answer->len += len + 1;
+    }
+    fs_close(fd);
+    return (err < 0) ? err : 0;
+}
+
+
+/*****************************************************************/
+// make directory "path" the current directory of client; it stays open, so it can t
+// be removed while the client is in it
+// return 0 for success or a negative error code
+int change_dir(connection *conn, const char *path) {
+    int fd = fs_open(path, FS_O_RDONLY);
+    if (fd < 0) return fd;
+
+    int err = fs_fchdir(fd);
+    if (err < 0) {
+        fs_close(fd);
+        return err;
+    }
+    if (conn->cwd != -1) fs_close(conn->cwd);
+    conn->cwd = fd;
+    return 0;
+}
+
+
+/*****************************************************************/
+// add the path of current directory to "answer"
+// return 0 for success or a negative error code
+int current_dir(buffer *answer) {
+    int len = 256;
+    while (reserve(answer, len)) {
+        int err = fs_getcwd(answer->data + answer->len, len);
+        if (err >= 0) {
+            answer->len += err;
+            return 0;
+        }
+        if (err != -ERANGE) return err;
+        len *= 2;
+    }
+    return -ENOMEM;
+}
+
+
+/*****************************************************************/
+// make room for "len" more bytes in "buf"
+// return 1 for success
+int reserve(buffer *buf, int len) {
+    if (buf->len + len <= buf->size) return 1;
+
+    int size = buf->size ? buf->size : RECV_CHUNK;
+    while (size < buf->len + len) {
+        size *= 2;
+    }
+    char *data = realloc(buf->data, size);
+    if (data == NULL) return 0;
+    buf->data = data;
+    buf->size = size;
+    return 1;
+}
+
+
+/*****************************************************************/
+// drop the first "len" bytes of "buf"
+void take_bytes(buffer *buf, int len) {
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+
+/*****************************************************************/
+// tell when the disk was opened otherwise than the options asked
+void mount_notes(const fs_options *opts) {
+    struct fs_info info;
+    if (fs_statfs(&info) < 0) return;
+
+    if (info.converted) {
+        printf("Discul a fost convertit la formatul acestui program.\n");
+    }
+    if (opts->mmap && !info.mapped) {
+        printf("Discul nu a putut fi mapat, va fi citit in memorie.\n");
+    }
+    if (!info.mapped && strcmp(info.io, opts->io)) {
+        printf("Dispozitivul %s nu poate fi folosit, se foloseste %s.\n", opts->io, info.io);
+    }
+}
+
+
+/*****************************************************************/
+// the filesystem can t go on (no memory for its cache), the process ends after this
+void fatal_message(int err) {
+    printf("%s\n", fs_strerror(err));
+    fflush(stdout);
+}